@@ -0,0 +1,429 @@
+///Name: AsyncIO.cpp
+///Purpose: define methods from AsyncIO class - queue of reads and writes running in the background
+
+
+
+#include "AsyncIO.h"
+
+#include <iostream>
+#include <algorithm>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///function creates io_uring instance and maps its rings
+///return value: -1 if io_uring is not available, else 0
+int AsyncIO::setUpRing()
+{
+    struct io_uring_params parameters;
+    void* address;
+
+    memset(&parameters, 0, sizeof(parameters));
+    ringFd = (int)syscall(__NR_io_uring_setup, queueDepth, &parameters);
+    if(-1 == ringFd)    ///old kernel, or io_uring turned off
+        return -1;
+
+    submissionRingSize = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned);
+    completionRingSize = parameters.cq_off.cqes + parameters.cq_entries * sizeof(struct io_uring_cqe);
+    if(parameters.features & IORING_FEAT_SINGLE_MMAP)   ///both rings in one mapping
+        submissionRingSize = completionRingSize = std::max(submissionRingSize, completionRingSize);
+    submissionEntriesSize = parameters.sq_entries * sizeof(struct io_uring_sqe);
+
+    address = mmap(NULL, submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    submissionRing = MAP_FAILED == address ? NULL : (unsigned char*)address;
+
+    if(parameters.features & IORING_FEAT_SINGLE_MMAP)
+        completionRing = submissionRing;
+    else
+    {
+        address = mmap(NULL, completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        completionRing = MAP_FAILED == address ? NULL : (unsigned char*)address;
+    }
+
+    address = mmap(NULL, submissionEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    submissionEntries = MAP_FAILED == address ? NULL : (struct io_uring_sqe*)address;
+
+    if(NULL == submissionRing || NULL == completionRing || NULL == submissionEntries)
+    {
+        tearDownRing();
+        return -1;
+    }
+
+    submissionHead = (unsigned*)(submissionRing + parameters.sq_off.head);
+    submissionTail = (unsigned*)(submissionRing + parameters.sq_off.tail);
+    submissionMask = (unsigned*)(submissionRing + parameters.sq_off.ring_mask);
+    submissionArray = (unsigned*)(submissionRing + parameters.sq_off.array);
+    completionHead = (unsigned*)(completionRing + parameters.cq_off.head);
+    completionTail = (unsigned*)(completionRing + parameters.cq_off.tail);
+    completionMask = (unsigned*)(completionRing + parameters.cq_off.ring_mask);
+    completionEntries = (struct io_uring_cqe*)(completionRing + parameters.cq_off.cqes);
+
+    return 0;
+}
+
+
+
+///function unmaps rings and closes io_uring instance
+void AsyncIO::tearDownRing()
+{
+    if(NULL != submissionEntries)
+        munmap(submissionEntries, submissionEntriesSize);
+    if(NULL != completionRing && completionRing != submissionRing)
+        munmap(completionRing, completionRingSize);
+    if(NULL != submissionRing)
+        munmap(submissionRing, submissionRingSize);
+
+    submissionEntries = NULL;
+    completionRing = NULL;
+    submissionRing = NULL;
+
+    if(-1 != ringFd)
+    {
+        close(ringFd);
+        ringFd = -1;
+    }
+}
+
+
+
+///function hands queued submission entries to the kernel, waiting for a completion if asked to
+///parameters: whether to wait until at least one completion is posted
+///return value: -1 on failure, else 0
+int AsyncIO::enterRing(bool wait)
+{
+    unsigned nToSubmit;
+    long result;
+
+    do
+    {
+        ///entries the kernel did not take last time are handed over again
+        nToSubmit = *submissionTail - __atomic_load_n(submissionHead, __ATOMIC_ACQUIRE);
+        if(0 == nToSubmit && !wait)
+            return 0;
+
+        result = syscall(__NR_io_uring_enter, ringFd, nToSubmit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    }
+    while(-1 == result && (EINTR == errno || EAGAIN == errno || EBUSY == errno));
+
+    return -1 == result ? -1 : 0;
+}
+
+
+
+///function puts rest of a transfer into the submission ring and hands it to the kernel
+///parameters: slot of transfer
+void AsyncIO::queueOnRing(int slot)
+{
+    Request& request = requests[slot];
+    unsigned tail = *submissionTail;     ///only this thread moves the tail
+    unsigned index = tail & *submissionMask;
+    struct io_uring_sqe* entry = &submissionEntries[index];
+
+    request.vector.iov_base = request.buffer;
+    request.vector.iov_len = (size_t)std::min(request.nBytesLeft, (int64_t)1 << 30);  ///result of a transfer is a 32-bit number
+
+    memset(entry, 0, sizeof(*entry));
+    entry->opcode = request.isWrite ? IORING_OP_WRITEV : IORING_OP_READV;  ///vectored operations are there since the first io_uring kernel
+    entry->fd = request.fd;
+    entry->addr = (uint64_t)(uintptr_t)&request.vector;
+    entry->len = 1;
+    entry->off = (uint64_t)request.position;
+    entry->user_data = (uint64_t)slot;
+
+    submissionArray[index] = index;
+    __atomic_store_n(submissionTail, tail + 1, __ATOMIC_RELEASE);
+
+    enterRing(false);    ///if it fails, entry is handed over by next enterRing()
+}
+
+
+
+///function waits for next transfer finished by the kernel, continuing transfers which ended early
+///return value: slot of finished transfer, -1 on failure
+int AsyncIO::reapFromRing()
+{
+    unsigned head;
+    int slot;
+    int result;
+
+    while(true)
+    {
+        head = *completionHead;     ///only this thread moves the head
+        if(head == __atomic_load_n(completionTail, __ATOMIC_ACQUIRE))
+        {
+            if(-1 == enterRing(true))
+            {
+                std::cerr << "Asynchronous I/O failed!\n";
+                return -1;
+            }
+            continue;
+        }
+
+        slot = (int)completionEntries[head & *completionMask].user_data;
+        result = completionEntries[head & *completionMask].res;
+        __atomic_store_n(completionHead, head + 1, __ATOMIC_RELEASE);
+
+        Request& request = requests[slot];
+        if(-EINTR == result || -EAGAIN == result)   ///nothing transferred, try again
+        {
+            queueOnRing(slot);
+            continue;
+        }
+        if(result < 0)                              ///error - report what was transferred before it
+        {
+            if(0 == request.nBytesDone)
+                request.nBytesDone = -1;
+            return slot;
+        }
+
+        request.buffer += result;
+        request.position += result;
+        request.nBytesLeft -= result;
+        request.nBytesDone += result;
+        if(result > 0 && request.nBytesLeft > 0)    ///transfer ended early - continue it
+        {
+            queueOnRing(slot);
+            continue;
+        }
+
+        return slot;
+    }
+}
+
+
+
+///function takes transfers from the list of pending ones and does them until the queue is stopped (body of a worker thread)
+void AsyncIO::runWorker()
+{
+    std::unique_lock<std::mutex> lock(workerMutex);
+    int slot;
+
+    while(true)
+    {
+        pendingChanged.wait(lock, [this] { return isStopping || !pendingSlots.empty(); });
+        if(pendingSlots.empty())    ///stopping
+            return;
+
+        slot = pendingSlots.front();
+        pendingSlots.pop_front();
+
+        lock.unlock();
+        transfer(requests[slot]);
+        lock.lock();
+
+        completedSlots.push_back(slot);
+        completedChanged.notify_one();
+    }
+}
+
+
+
+///function does whole transfer with pread/pwrite, repeating them until everything is transferred
+///parameters: transfer to do
+void AsyncIO::transfer(Request& request)
+{
+    ssize_t result;
+
+    while(request.nBytesLeft > 0)    ///pread and pwrite may transfer less than asked
+    {
+        if(request.isWrite)
+            result = pwrite(request.fd, request.buffer, request.nBytesLeft, request.position);
+        else
+            result = pread(request.fd, request.buffer, request.nBytesLeft, request.position);
+
+        if(-1 == result && EINTR == errno)
+            continue;
+        if(-1 == result && 0 == request.nBytesDone)
+            request.nBytesDone = -1;
+        if(result <= 0)     ///end of file or error
+            break;
+
+        request.buffer += result;
+        request.position += result;
+        request.nBytesLeft -= result;
+        request.nBytesDone += result;
+    }
+}
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           public methods                                                                                                 *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///constructor
+AsyncIO::AsyncIO()
+{
+    queueDepth = 0;
+    nInFlight = 0;
+    ringFd = -1;
+    submissionRing = NULL;
+    completionRing = NULL;
+    submissionEntries = NULL;
+    isStopping = false;
+}
+
+
+
+///destructor
+AsyncIO::~AsyncIO()
+{
+    stop();
+}
+
+
+
+///function prepares queue for use - sets up io_uring, or starts worker threads if it is not available
+///parameters: maximum number of transfers in flight
+void AsyncIO::start(int newQueueDepth)
+{
+    stop();
+
+    queueDepth = std::max(1, std::min(newQueueDepth, MAX_QUEUE_DEPTH));
+    requests.assign(queueDepth, Request());
+    freeSlots.clear();
+    for(int i = queueDepth - 1; i >= 0; --i)
+        freeSlots.push_back(i);
+    nInFlight = 0;
+
+    if(0 == setUpRing())
+        return;
+
+    for(int i = 0; i < std::min(queueDepth, MAX_ASYNC_WORKERS); ++i)
+        workers.push_back(std::thread(&AsyncIO::runWorker, this));
+}
+
+
+
+///function stops queue, releasing io_uring instance or worker threads (every transfer must be collected first)
+void AsyncIO::stop()
+{
+    tearDownRing();
+
+    if(!workers.empty())
+    {
+        {
+            std::lock_guard<std::mutex> lock(workerMutex);
+            isStopping = true;
+        }
+        pendingChanged.notify_all();
+
+        for(int i = 0; i < (int)workers.size(); ++i)
+            workers[i].join();
+        workers.clear();
+        isStopping = false;
+    }
+}
+
+
+
+///function starts a transfer without waiting for it
+///parameters: descriptor of file, whether to write, buffer, position within file, number of bytes, value handed back on completion
+///return value: -1 if queue is full, else 0
+int AsyncIO::submit(int fd, bool isWrite, void* buffer, int64_t position, int64_t nBytes, uint64_t tag)
+{
+    int slot;
+
+    if(freeSlots.empty())
+        return -1;
+
+    slot = freeSlots.back();
+    freeSlots.pop_back();
+    ++nInFlight;
+
+    Request& request = requests[slot];
+    request.fd = fd;
+    request.isWrite = isWrite;
+    request.buffer = (unsigned char*)buffer;
+    request.position = position;
+    request.nBytesLeft = nBytes;
+    request.nBytesDone = 0;
+    request.tag = tag;
+
+    if(-1 != ringFd)
+        queueOnRing(slot);
+    else
+    {
+        std::lock_guard<std::mutex> lock(workerMutex);
+        pendingSlots.push_back(slot);
+        pendingChanged.notify_one();
+    }
+
+    return 0;
+}
+
+
+
+///function waits until any transfer in flight finishes
+///parameters: tag of finished transfer (output), number of bytes transferred (output, less than asked at end of file, -1 on error)
+///return value: -1 if nothing is in flight (or queue failed), else 0
+int AsyncIO::waitForCompletion(uint64_t& tag, int64_t& nBytes)
+{
+    int slot;
+
+    if(0 == nInFlight)
+        return -1;
+
+    if(-1 != ringFd)
+    {
+        slot = reapFromRing();
+        if(-1 == slot)
+            return -1;
+    }
+    else
+    {
+        std::unique_lock<std::mutex> lock(workerMutex);
+        completedChanged.wait(lock, [this] { return !completedSlots.empty(); });
+        slot = completedSlots.front();
+        completedSlots.pop_front();
+    }
+
+    tag = requests[slot].tag;
+    nBytes = requests[slot].nBytesDone;
+    freeSlots.push_back(slot);
+    --nInFlight;
+
+    return 0;
+}
+
+
+
+///function gets number of transfers submitted but not collected yet
+///return value: number of transfers in flight
+int AsyncIO::getNInFlight()
+{
+    return nInFlight;
+}
+
+
+
+///function gets maximum number of transfers in flight
+///return value: queue depth
+int AsyncIO::getQueueDepth()
+{
+    return queueDepth;
+}
+
+
+
+///function checks which backend is in use
+///return value: true for io_uring, false for worker threads
+bool AsyncIO::isUsingRing()
+{
+    return -1 != ringFd;
+}
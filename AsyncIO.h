@@ -0,0 +1,222 @@
+///Name: AsyncIO.h
+///Purpose: declare and describe AsyncIO class - queue of reads and writes running in the background
+
+
+
+
+#ifndef ASYNCIO_H_INCLUDED
+#define ASYNCIO_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "Defines.h"
+
+
+
+
+/*********************************************************************
+ *                            AsyncIO class                          *
+ *********************************************************************/
+/**
+        This class keeps many reads and writes of files in flight at once.
+        Transfers are handed over with submit() and the caller goes on with
+        its work; finished transfers are collected with waitForCompletion(),
+        in whatever order they finish, recognized by the tag given on
+        submission. At most queueDepth transfers are in flight.
+
+        Two backends are available, chosen when the queue is started:
+
+        io_uring        -> submission and completion rings shared with the
+                           kernel (set up with raw system calls, no library
+                           needed), one system call per submission and none
+                           per completion which is already there
+        worker threads  -> if the kernel has no io_uring (or it is turned
+                           off), transfers are done with pread/pwrite by a
+                           pool of threads
+
+        Transfers which end early (a short read or write which is not the end
+        of the file) are continued by the queue, so a completion is only
+        reported when everything is transferred, end of file is reached or
+        an error occurred.
+
+        A queue is used by one thread at a time; buffers handed to submit()
+        must stay untouched until their transfer completes.
+**/
+
+
+class AsyncIO
+{
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private attributes                                                                                             *
+ ********************************************************************************************************************************************************************************************/
+
+    struct Request
+    {
+        int fd;                                ///descriptor of file to read or write
+        bool isWrite;                          ///whether transfer is a write
+        unsigned char* buffer;                 ///next byte of the buffer to transfer
+        int64_t position;                      ///next position within the file
+        int64_t nBytesLeft;                    ///number of bytes not transferred yet
+        int64_t nBytesDone;                    ///number of bytes transferred so far, -1 on error
+        uint64_t tag;                          ///value handed back on completion
+        struct iovec vector;                   ///rest of the buffer in the form io_uring reads it from
+    };
+
+    int queueDepth;                            ///maximum number of transfers in flight
+    std::vector<Request> requests;             ///transfers, one slot for each transfer which may be in flight
+    std::vector<int> freeSlots;                ///slots of requests not in use
+    int nInFlight;                             ///number of transfers submitted but not collected
+
+    int ringFd;                                ///descriptor of io_uring instance, -1 if worker threads are used
+    unsigned char* submissionRing;             ///mapped submission ring
+    size_t submissionRingSize;                 ///size of mapped submission ring
+    unsigned char* completionRing;             ///mapped completion ring (same as submission ring on newer kernels)
+    size_t completionRingSize;                 ///size of mapped completion ring
+    struct io_uring_sqe* submissionEntries;    ///mapped array of submission entries
+    size_t submissionEntriesSize;              ///size of mapped array of submission entries
+    unsigned* submissionHead;                  ///first entry not yet consumed by the kernel
+    unsigned* submissionTail;                  ///entry after last one queued
+    unsigned* submissionMask;                  ///mask turning position into index within the ring
+    unsigned* submissionArray;                 ///indices of submission entries, in order of submission
+    unsigned* completionHead;                  ///first completion not yet collected
+    unsigned* completionTail;                  ///completion after last one posted by the kernel
+    unsigned* completionMask;                  ///mask turning position into index within the ring
+    struct io_uring_cqe* completionEntries;    ///array of completions
+
+    std::vector<std::thread> workers;          ///threads doing transfers when there is no io_uring
+    std::deque<int> pendingSlots;              ///transfers waiting for a worker
+    std::deque<int> completedSlots;            ///transfers done by workers but not collected
+    std::mutex workerMutex;                    ///guards both lists of slots and stop flag
+    std::condition_variable pendingChanged;    ///signalled when a transfer waits for a worker or workers have to stop
+    std::condition_variable completedChanged;  ///signalled when a worker finishes a transfer
+    bool isStopping;                           ///whether workers have to stop
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+    ///function creates io_uring instance and maps its rings
+    ///return value: -1 if io_uring is not available, else 0
+    int setUpRing();
+
+
+
+    ///function unmaps rings and closes io_uring instance
+    void tearDownRing();
+
+
+
+    ///function hands queued submission entries to the kernel, waiting for a completion if asked to
+    ///parameters: whether to wait until at least one completion is posted
+    ///return value: -1 on failure, else 0
+    int enterRing(bool wait);
+
+
+
+    ///function puts rest of a transfer into the submission ring and hands it to the kernel
+    ///parameters: slot of transfer
+    void queueOnRing(int slot);
+
+
+
+    ///function waits for next transfer finished by the kernel, continuing transfers which ended early
+    ///return value: slot of finished transfer, -1 on failure
+    int reapFromRing();
+
+
+
+    ///function takes transfers from the list of pending ones and does them until the queue is stopped (body of a worker thread)
+    void runWorker();
+
+
+
+    ///function does whole transfer with pread/pwrite, repeating them until everything is transferred
+    ///parameters: transfer to do
+    static void transfer(Request& request);
+
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                              public methods                                                                                              *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+public:
+
+    ///constructor
+    AsyncIO();
+
+
+
+    ///destructor
+    ~AsyncIO();
+
+
+
+    ///function prepares queue for use - sets up io_uring, or starts worker threads if it is not available
+    ///parameters: maximum number of transfers in flight
+    void start(int newQueueDepth);
+
+
+
+    ///function stops queue, releasing io_uring instance or worker threads (every transfer must be collected first)
+    void stop();
+
+
+
+    ///function starts a transfer without waiting for it
+    ///parameters: descriptor of file, whether to write, buffer, position within file, number of bytes, value handed back on completion
+    ///return value: -1 if queue is full, else 0
+    int submit(int fd, bool isWrite, void* buffer, int64_t position, int64_t nBytes, uint64_t tag);
+
+
+
+    ///function waits until any transfer in flight finishes
+    ///parameters: tag of finished transfer (output), number of bytes transferred (output, less than asked at end of file, -1 on error)
+    ///return value: -1 if nothing is in flight (or queue failed), else 0
+    int waitForCompletion(uint64_t& tag, int64_t& nBytes);
+
+
+
+    ///function gets number of transfers submitted but not collected yet
+    ///return value: number of transfers in flight
+    int getNInFlight();
+
+
+
+    ///function gets maximum number of transfers in flight
+    ///return value: queue depth
+    int getQueueDepth();
+
+
+
+    ///function checks which backend is in use
+    ///return value: true for io_uring, false for worker threads
+    bool isUsingRing();
+
+
+
+};
+
+
+
+
+#endif // ASYNCIO_H_INCLUDED
@@ -0,0 +1,295 @@
+///Name: Bitmap.cpp
+///Purpose: define methods from Bitmap class - in-memory copy of an i-node or data bitmap
+
+
+
+#include "Bitmap.h"
+
+#include <string.h>
+#include <algorithm>
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///function marks block of the bitmap holding given entry as changed
+///parameters: id of changed entry
+void Bitmap::markDirty(int entryId)
+{
+    dirtyBlocks[entryId / BITS_PER_BLOCK] = true;
+    unloggedBlocks[entryId / BITS_PER_BLOCK] = true;
+    isDirty = true;
+    hasUnlogged = true;
+}
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           public methods                                                                                                 *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///constructor
+Bitmap::Bitmap()
+{
+    nBits = 0;
+    searchHint = 0;
+    isDirty = false;
+    hasUnlogged = false;
+}
+
+
+
+///function sets number of entries and clears the bitmap
+///parameters: number of entries
+void Bitmap::setSize(int newNBits)
+{
+    int nBlocks = std::max((newNBits + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK, 1);
+
+    nBits = newNBits;
+    words.assign(nBlocks * (BLOCK_SIZE / sizeof(uint64_t)), 0);  ///whole blocks, so they can be written back as they are
+    dirtyBlocks.assign(nBlocks, false);
+    unloggedBlocks.assign(nBlocks, false);
+    searchHint = 0;
+    isDirty = false;
+    hasUnlogged = false;
+}
+
+
+
+///function loads bitmap from bytes read from the disk
+///parameters: bytes of the on-disk bitmap, number of bytes
+void Bitmap::load(const unsigned char* source, int nBytes)
+{
+    int maxBytes = words.size() * sizeof(uint64_t);
+
+    std::fill(words.begin(), words.end(), 0);
+    memcpy(words.data(), source, std::min(nBytes, maxBytes));
+    searchHint = 0;
+    markClean();
+}
+
+
+
+///function marks every entry as free
+void Bitmap::clear()
+{
+    std::fill(words.begin(), words.end(), 0);
+    std::fill(dirtyBlocks.begin(), dirtyBlocks.end(), true);
+    std::fill(unloggedBlocks.begin(), unloggedBlocks.end(), true);
+    searchHint = 0;
+    isDirty = true;
+    hasUnlogged = true;
+}
+
+
+
+///function checks status of an entry
+///parameters: id of entry
+///return value: status of entry (free or used)
+bool Bitmap::checkBit(int entryId)
+{
+    return (words[entryId / BITS_PER_WORD] >> (entryId % BITS_PER_WORD)) & 1;
+}
+
+
+
+///function changes status of an entry
+///parameters: id of entry, new status (free or used)
+void Bitmap::changeBit(int entryId, bool newStatus)
+{
+    int wordId = entryId / BITS_PER_WORD;
+
+    if(newStatus)
+        words[wordId] |= ((uint64_t)1 << (entryId % BITS_PER_WORD));    ///set
+    else
+    {
+        words[wordId] &= ~((uint64_t)1 << (entryId % BITS_PER_WORD));   ///unset
+        searchHint = std::min(searchHint, wordId);
+    }
+
+    markDirty(entryId);
+}
+
+
+
+///function finds first free entry
+///return value: id of first free entry, -1 if there is none
+int Bitmap::findFirstFree()
+{
+    int result;
+
+    for(int i = searchHint; i < (int)words.size(); ++i)
+    {
+        if(~words[i])  ///at least one free entry in this word
+        {
+            searchHint = i;
+            result = i * BITS_PER_WORD + __builtin_ctzll(~words[i]);
+            return result < nBits ? result : -1;
+        }
+    }
+
+    searchHint = words.size();
+    return -1;
+}
+
+
+
+///function finds first run of free entries of given length, or the longest run if there is no such
+///parameters: wanted length of run, found length of run (output, at most wanted length)
+///return value: id of first entry of the run, -1 if there is no free entry
+int Bitmap::findFreeRun(int nEntries, int& runLength)
+{
+    int bestStart = -1;
+    int bestLength = 0;
+    int start = -1;
+    int length = 0;
+    int i = searchHint * BITS_PER_WORD;
+
+    while(i < nBits && length < nEntries)
+    {
+        uint64_t word = words[i / BITS_PER_WORD];
+
+        if(0 == i % BITS_PER_WORD && 0 == word && i + BITS_PER_WORD <= nBits)   ///whole word free
+        {
+            if(-1 == start)
+                start = i;
+            length += BITS_PER_WORD;
+            i += BITS_PER_WORD;
+        }
+        else if(0 == i % BITS_PER_WORD && ~(uint64_t)0 == word)                ///whole word used
+        {
+            if(length > bestLength)
+            {
+                bestStart = start;
+                bestLength = length;
+            }
+            start = -1;
+            length = 0;
+            i += BITS_PER_WORD;
+        }
+        else if(checkBit(i))                                                    ///single used entry
+        {
+            if(length > bestLength)
+            {
+                bestStart = start;
+                bestLength = length;
+            }
+            start = -1;
+            length = 0;
+            ++i;
+        }
+        else                                                                    ///single free entry
+        {
+            if(-1 == start)
+                start = i;
+            ++length;
+            ++i;
+        }
+    }
+
+    if(length > bestLength)
+    {
+        bestStart = start;
+        bestLength = length;
+    }
+
+    runLength = std::min(bestLength, nEntries);
+    return bestStart;
+}
+
+
+
+///function gets bytes of the bitmap in on-disk layout
+///return value: pointer to first byte
+const unsigned char* Bitmap::getBytes()
+{
+    return (const unsigned char*)words.data();
+}
+
+
+
+///function counts used entries
+///return value: number of used entries
+int Bitmap::countUsed()
+{
+    int result = 0;
+
+    for(int i = 0; i < (int)words.size(); ++i)
+        result += __builtin_popcountll(words[i]);
+
+    return result;
+}
+
+
+
+///function gets number of blocks the bitmap takes on the disk
+///return value: number of blocks
+int Bitmap::getNBlocks()
+{
+    return dirtyBlocks.size();
+}
+
+
+
+///function checks whether any entry changed since last write-back
+///return value: true if bitmap has to be written back
+bool Bitmap::hasChanges()
+{
+    return isDirty;
+}
+
+
+
+///function checks whether block of the bitmap changed since last write-back
+///parameters: index of block within the bitmap
+///return value: true if block has to be written back
+bool Bitmap::isBlockDirty(int blockId)
+{
+    return dirtyBlocks[blockId];
+}
+
+
+
+///function marks bitmap as written back (nothing is left for the journal either)
+void Bitmap::markClean()
+{
+    std::fill(dirtyBlocks.begin(), dirtyBlocks.end(), false);
+    isDirty = false;
+    markLogged();
+}
+
+
+
+///function checks whether any entry changed since bitmap was last given to the journal
+///return value: true if some block has to be logged
+bool Bitmap::hasUnloggedChanges()
+{
+    return hasUnlogged;
+}
+
+
+
+///function checks whether block of the bitmap changed since it was last given to the journal
+///parameters: index of block within the bitmap
+///return value: true if block has to be logged
+bool Bitmap::isBlockUnlogged(int blockId)
+{
+    return unloggedBlocks[blockId];
+}
+
+
+
+///function marks every block of the bitmap as given to the journal
+void Bitmap::markLogged()
+{
+    std::fill(unloggedBlocks.begin(), unloggedBlocks.end(), false);
+    hasUnlogged = false;
+}
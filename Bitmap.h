@@ -0,0 +1,185 @@
+///Name: Bitmap.h
+///Purpose: declare and describe Bitmap class - in-memory copy of an i-node or data bitmap
+
+
+
+
+#ifndef BITMAP_H_INCLUDED
+#define BITMAP_H_INCLUDED
+
+#include <vector>
+#include <stdint.h>
+
+#include "Defines.h"
+
+
+
+
+/*********************************************************************
+ *                            Bitmap class                           *
+ *********************************************************************/
+/**
+        This class keeps one bitmap of the virtual disk in memory.
+        Bits are stored in 64-bit words, so free entries can be searched
+        one word at a time instead of one bit at a time.
+        Byte i, bit j of the on-disk bitmap is entry i * 8 + j, which on a
+        little-endian host is exactly the layout of the words in memory.
+
+        The bitmap may span many blocks of the disk. Blocks with changed
+        entries are remembered as dirty, the owner writes them back to the
+        disk and then marks the bitmap as clean. Changed blocks are also
+        remembered separately for the journal, which takes them as they are
+        into next transaction and then marks them as logged.
+**/
+
+
+class Bitmap
+{
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private attributes                                                                                             *
+ ********************************************************************************************************************************************************************************************/
+
+    std::vector<uint64_t> words;               ///bits of the bitmap, BITS_PER_WORD in each word
+    int nBits;                                 ///number of valid entries
+    int searchHint;                            ///index of first word which may contain a free entry
+    std::vector<char> dirtyBlocks;             ///whether block of the bitmap changed since last write-back
+    bool isDirty;                              ///whether any block changed since last write-back
+    std::vector<char> unloggedBlocks;          ///whether block of the bitmap changed since it was last given to the journal
+    bool hasUnlogged;                          ///whether any block changed since it was last given to the journal
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+    ///function marks block of the bitmap holding given entry as changed
+    ///parameters: id of changed entry
+    void markDirty(int entryId);
+
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                              public methods                                                                                              *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+public:
+
+    ///constructor
+    Bitmap();
+
+
+
+    ///function sets number of entries and clears the bitmap
+    ///parameters: number of entries
+    void setSize(int newNBits);
+
+
+
+    ///function loads bitmap from bytes read from the disk
+    ///parameters: bytes of the on-disk bitmap, number of bytes
+    void load(const unsigned char* source, int nBytes);
+
+
+
+    ///function marks every entry as free
+    void clear();
+
+
+
+    ///function checks status of an entry
+    ///parameters: id of entry
+    ///return value: status of entry (free or used)
+    bool checkBit(int entryId);
+
+
+
+    ///function changes status of an entry
+    ///parameters: id of entry, new status (free or used)
+    void changeBit(int entryId, bool newStatus);
+
+
+
+    ///function finds first free entry
+    ///return value: id of first free entry, -1 if there is none
+    int findFirstFree();
+
+
+
+    ///function finds first run of free entries of given length, or the longest run if there is no such
+    ///parameters: wanted length of run, found length of run (output, at most wanted length)
+    ///return value: id of first entry of the run, -1 if there is no free entry
+    int findFreeRun(int nEntries, int& runLength);
+
+
+
+    ///function gets bytes of the bitmap in on-disk layout
+    ///return value: pointer to first byte
+    const unsigned char* getBytes();
+
+
+
+    ///function counts used entries
+    ///return value: number of used entries
+    int countUsed();
+
+
+
+    ///function gets number of blocks the bitmap takes on the disk
+    ///return value: number of blocks
+    int getNBlocks();
+
+
+
+    ///function checks whether any entry changed since last write-back
+    ///return value: true if bitmap has to be written back
+    bool hasChanges();
+
+
+
+    ///function checks whether block of the bitmap changed since last write-back
+    ///parameters: index of block within the bitmap
+    ///return value: true if block has to be written back
+    bool isBlockDirty(int blockId);
+
+
+
+    ///function marks bitmap as written back (nothing is left for the journal either)
+    void markClean();
+
+
+
+    ///function checks whether any entry changed since bitmap was last given to the journal
+    ///return value: true if some block has to be logged
+    bool hasUnloggedChanges();
+
+
+
+    ///function checks whether block of the bitmap changed since it was last given to the journal
+    ///parameters: index of block within the bitmap
+    ///return value: true if block has to be logged
+    bool isBlockUnlogged(int blockId);
+
+
+
+    ///function marks every block of the bitmap as given to the journal
+    void markLogged();
+
+
+
+};
+
+
+
+
+#endif // BITMAP_H_INCLUDED
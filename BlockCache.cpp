@@ -0,0 +1,462 @@
+///Name: BlockCache.cpp
+///Purpose: define methods from BlockCache class - LRU cache of data blocks with write-back
+
+
+
+#include "BlockCache.h"
+
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///function gets cached block, reading or evicting blocks if necessary (cacheMutex is released while the disk is read)
+///parameters: lock on cacheMutex, absolute index of block, whether contents on the disk are needed (false if whole block is overwritten)
+///return value: cached block, moved to the front of the list
+BlockCache::CachedBlock& BlockCache::getBlock(std::unique_lock<std::mutex>& lock, int64_t blockIndex, bool needsContents)
+{
+    std::unordered_map<int64_t, std::list<CachedBlock>::iterator>::iterator found = blockMap.find(blockIndex);
+    unsigned char contents[BLOCK_SIZE];
+
+    if(found != blockMap.end())   ///hit - move to the front
+    {
+        ++nHits;
+        lruList.splice(lruList.begin(), lruList, found->second);
+        return lruList.front();
+    }
+
+    ++nMisses;
+
+    if(needsContents)
+    {
+        readFromDisk(lock, blockIndex, 0, contents, BLOCK_SIZE);
+        found = blockMap.find(blockIndex);
+        if(found != blockMap.end())   ///cached by another thread meanwhile - its copy is newer
+        {
+            lruList.splice(lruList.begin(), lruList, found->second);
+            return lruList.front();
+        }
+    }
+
+    CachedBlock& block = *addBlock(blockIndex, true);
+    if(needsContents)
+        memcpy(block.data, contents, BLOCK_SIZE);
+
+    return block;
+}
+
+
+
+///function puts block which is not cached at the front of the list, evicting least recently used block which may go if cache is full
+///parameters: absolute index of block, whether cache may grow above its budget if no block may go
+///return value: cached block (contents not read), NULL if there is no room for it
+BlockCache::CachedBlock* BlockCache::addBlock(int64_t blockIndex, bool mayGrow)
+{
+    std::list<CachedBlock>::iterator victim = lruList.end();
+
+    if((int)lruList.size() >= maxBlocks)   ///full - find least recently used block which may go
+    {
+        victim = --lruList.end();
+        while(holdsChanges && victim->isDirty && victim != lruList.begin())  ///changed blocks stay until checkpoint
+            --victim;
+        if(holdsChanges && victim->isDirty)
+            victim = lruList.end();
+    }
+
+    if(victim != lruList.end())   ///reuse it
+    {
+        writeBack(*victim);
+        if(-1 != victim->blockIndex)
+            blockMap.erase(victim->blockIndex);
+        lruList.splice(lruList.begin(), lruList, victim);
+    }
+    else if(mayGrow || (int)lruList.size() < maxBlocks)
+    {
+        CachedBlock newBlock;
+        newBlock.data = new unsigned char [BLOCK_SIZE];
+        lruList.push_front(newBlock);
+    }
+    else
+        return NULL;
+
+    CachedBlock& block = lruList.front();
+    block.blockIndex = blockIndex;
+    block.isDirty = false;
+    block.loggedSequence = 0;
+    blockMap[blockIndex] = lruList.begin();
+
+    return &block;
+}
+
+
+
+///function writes block back to the disk if it was changed
+///parameters: cached block
+void BlockCache::writeBack(CachedBlock& block)
+{
+    if(block.isDirty)
+    {
+        markStale(block.blockIndex, 1);
+        diskIO->writeBytes(block.blockIndex, 0, block.data, BLOCK_SIZE);
+        block.isDirty = false;
+    }
+}
+
+
+
+///function reads bytes of a run of blocks from the disk with cacheMutex released, again if the read goes stale meanwhile
+///parameters: lock on cacheMutex (held before and after), absolute index of first block, offset within first block, destination buffer, number of bytes
+///return value: number of bytes read
+int BlockCache::readFromDisk(std::unique_lock<std::mutex>& lock, int64_t firstBlockIndex, int offset, void* destination, int nBytes)
+{
+    std::list<PendingRead>::iterator pending;
+    int bytesRead;
+
+    pendingReads.push_front(PendingRead());
+    pending = pendingReads.begin();
+    pending->firstBlockIndex = firstBlockIndex;
+    pending->nBlocks = (offset + nBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    do
+    {
+        pending->isStale = false;
+        lock.unlock();
+        bytesRead = diskIO->readBytes(firstBlockIndex, offset, destination, nBytes);
+        lock.lock();
+    } while(pending->isStale);
+
+    pendingReads.erase(pending);
+    return bytesRead;
+}
+
+
+
+///function marks pending reads of blocks as stale - their contents on the disk changed or are about to
+///parameters: absolute index of first block, number of blocks
+void BlockCache::markStale(int64_t firstBlockIndex, int nBlocks)
+{
+    for(std::list<PendingRead>::iterator it = pendingReads.begin(); it != pendingReads.end(); ++it)
+        if(it->firstBlockIndex < firstBlockIndex + nBlocks && firstBlockIndex < it->firstBlockIndex + it->nBlocks)
+            it->isStale = true;
+}
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           public methods                                                                                                 *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///constructor
+BlockCache::BlockCache()
+{
+    diskIO = NULL;
+    maxBlocks = 0;
+    holdsChanges = false;
+    nHits = 0;
+    nMisses = 0;
+}
+
+
+
+///destructor
+BlockCache::~BlockCache()
+{
+    for(std::list<CachedBlock>::iterator it = lruList.begin(); it != lruList.end(); ++it)
+        delete [] it->data;
+}
+
+
+
+///function sets disk to cache and memory budget, dropping cached blocks
+///parameters: access to the virtual disk file, memory budget (in bytes)
+void BlockCache::setBudget(DiskIO* newDiskIO, int64_t budget)
+{
+    if(NULL != diskIO)
+        flush();
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    for(std::list<CachedBlock>::iterator it = lruList.begin(); it != lruList.end(); ++it)
+        delete [] it->data;
+    lruList.clear();
+    blockMap.clear();
+
+    diskIO = newDiskIO;
+    maxBlocks = (int)(budget / BLOCK_SIZE);
+}
+
+
+
+///function reads bytes from a block
+///parameters: absolute index of block, offset within block, destination buffer, number of bytes
+///return value: number of bytes read
+int BlockCache::readBlock(int64_t blockIndex, int offset, void* destination, int nBytes)
+{
+    std::unique_lock<std::mutex> lock(cacheMutex);
+    if(0 == maxBlocks && (!holdsChanges || 0 == blockMap.count(blockIndex)))   ///cache turned off, block not held
+        return readFromDisk(lock, blockIndex, offset, destination, nBytes);
+
+    CachedBlock& block = getBlock(lock, blockIndex, true);
+    memcpy(destination, block.data + offset, nBytes);
+
+    return nBytes;
+}
+
+
+
+///function writes bytes to a block
+///parameters: absolute index of block, offset within block, source buffer, number of bytes
+///return value: number of bytes written
+int BlockCache::writeBlock(int64_t blockIndex, int offset, const void* source, int nBytes)
+{
+    std::unique_lock<std::mutex> lock(cacheMutex);
+    if(0 == maxBlocks && !holdsChanges)   ///cache turned off
+    {
+        markStale(blockIndex, 1);
+        return diskIO->writeBytes(blockIndex, offset, source, nBytes);
+    }
+
+    CachedBlock& block = getBlock(lock, blockIndex, BLOCK_SIZE != nBytes);
+    memcpy(block.data + offset, source, nBytes);
+    block.isDirty = true;
+    block.loggedSequence = 0;
+
+    return nBytes;
+}
+
+
+
+///function reads bytes of a run of neighbouring blocks, from the cache if it holds all of them, else with a single disk access keeping whole blocks read
+///parameters: absolute index of first block, offset within first block, destination buffer, number of bytes
+///return value: number of bytes read
+int BlockCache::readBlocks(int64_t firstBlockIndex, int offset, void* destination, int nBytes)
+{
+    std::unordered_map<int64_t, std::list<CachedBlock>::iterator>::iterator found;
+    CachedBlock* block;
+    std::unique_lock<std::mutex> lock(cacheMutex);
+    int nBlocks = (offset + nBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int nCachedBlocks = 0;
+    int bytesRead;
+    int first;
+    int last;
+
+    for(int i = 0; i < nBlocks && !blockMap.empty(); ++i)
+        nCachedBlocks += blockMap.count(firstBlockIndex + i);
+
+    ///every block in memory - no disk access
+    if(0 != maxBlocks && nBlocks == nCachedBlocks)
+    {
+        for(int i = 0; i < nBlocks; ++i)
+        {
+            found = blockMap.find(firstBlockIndex + i);
+            first = std::max(i * BLOCK_SIZE, offset);
+            last = std::min((i + 1) * BLOCK_SIZE, offset + nBytes);
+            memcpy((unsigned char*)destination + first - offset, found->second->data + first - i * BLOCK_SIZE, last - first);
+            lruList.splice(lruList.begin(), lruList, found->second);
+        }
+        nHits += nBlocks;
+        return nBytes;
+    }
+
+    bytesRead = readFromDisk(lock, firstBlockIndex, offset, destination, nBytes);
+
+    ///cached copies (also ones cached during the read) may be newer than the disk - their part within the bytes read is taken
+    for(int i = 0; i < nBlocks && (0 != maxBlocks || !blockMap.empty()); ++i)
+    {
+        found = blockMap.find(firstBlockIndex + i);
+        first = std::max(i * BLOCK_SIZE, offset);
+        last = std::min((i + 1) * BLOCK_SIZE, offset + nBytes);
+        if(found != blockMap.end())
+        {
+            memcpy((unsigned char*)destination + first - offset, found->second->data + first - i * BLOCK_SIZE, last - first);
+            if(0 != maxBlocks)
+            {
+                ++nHits;
+                lruList.splice(lruList.begin(), lruList, found->second);
+            }
+        }
+        else if(0 != maxBlocks)
+            ++nMisses;
+    }
+
+    ///blocks read whole are kept while there is room - only once every copy is taken, as making room may write one back and let it go
+    for(int i = 0; i < nBlocks && 0 != maxBlocks; ++i)
+    {
+        first = std::max(i * BLOCK_SIZE, offset);
+        last = std::min((i + 1) * BLOCK_SIZE, offset + nBytes);
+        if(BLOCK_SIZE == last - first && last - offset <= bytesRead && 0 == blockMap.count(firstBlockIndex + i) && NULL != (block = addBlock(firstBlockIndex + i, false)))
+            memcpy(block->data, (unsigned char*)destination + first - offset, BLOCK_SIZE);
+    }
+
+    return bytesRead;
+}
+
+
+
+///function forgets cached copies of blocks overwritten on the disk directly, without writing them back - called before the write (changed copies
+///must not be written back over it) and again once it is done (copies read meanwhile hold old contents)
+///parameters: absolute index of first block, number of blocks
+void BlockCache::dropBlocks(int64_t firstBlockIndex, int nBlocks)
+{
+    std::unordered_map<int64_t, std::list<CachedBlock>::iterator>::iterator found;
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    markStale(firstBlockIndex, nBlocks);    ///reads running now may get old or new contents
+
+    ///cached copies must not go stale (or be written back over new data later) - their memory is reused first
+    for(int i = 0; i < nBlocks && !blockMap.empty(); ++i)
+    {
+        found = blockMap.find(firstBlockIndex + i);
+        if(found != blockMap.end())
+        {
+            found->second->blockIndex = -1;      ///no block of the disk, so it is not taken out of the map again when reused
+            found->second->isDirty = false;
+            lruList.splice(lruList.end(), lruList, found->second);
+            blockMap.erase(found);
+        }
+    }
+}
+
+
+
+///function writes every changed block back to the disk
+void BlockCache::flush()
+{
+    std::vector<CachedBlock*> dirtyBlocks;
+    struct iovec vectors[MAX_TRANSFER_BLOCKS];
+    int runLength;
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    for(std::list<CachedBlock>::iterator it = lruList.begin(); it != lruList.end(); ++it)
+        if(it->isDirty)
+            dirtyBlocks.push_back(&(*it));
+
+    ///write in order of position on the disk, each run of neighbouring blocks with a single access
+    std::sort(dirtyBlocks.begin(), dirtyBlocks.end(), [](CachedBlock* a, CachedBlock* b) { return a->blockIndex < b->blockIndex; });
+    for(int i = 0; i < (int)dirtyBlocks.size(); i += runLength)
+    {
+        runLength = 1;
+        while(i + runLength < (int)dirtyBlocks.size() && runLength < MAX_TRANSFER_BLOCKS && dirtyBlocks[i + runLength]->blockIndex == dirtyBlocks[i]->blockIndex + runLength)
+            ++runLength;
+
+        for(int j = 0; j < runLength; ++j)
+        {
+            vectors[j].iov_base = dirtyBlocks[i + j]->data;
+            vectors[j].iov_len = BLOCK_SIZE;
+            dirtyBlocks[i + j]->isDirty = false;
+        }
+        markStale(dirtyBlocks[i]->blockIndex, runLength);
+        diskIO->writeVector(dirtyBlocks[i]->blockIndex, 0, vectors, runLength);
+    }
+}
+
+
+
+///function sets whether changed blocks are kept in memory until checkpoint (used with a journal)
+///parameters: whether to keep changed blocks
+void BlockCache::keepChanges(bool keep)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    holdsChanges = keep;
+}
+
+
+
+///function adds every block changed since last call to next transaction of the journal
+///parameters: journal, number of next transaction
+void BlockCache::logChanges(Journal& journal, uint64_t sequence)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    for(std::list<CachedBlock>::iterator it = lruList.begin(); it != lruList.end(); ++it)
+    {
+        if(it->isDirty && 0 == it->loggedSequence)
+        {
+            journal.addEntry(it->blockIndex, 0, it->data, BLOCK_SIZE);
+            it->loggedSequence = sequence;
+        }
+    }
+}
+
+
+
+///function marks blocks as written back once their transactions are replayed to the disk, then shrinks cache to its budget
+///parameters: number of last replayed transaction
+void BlockCache::markCheckpointed(uint64_t sequence)
+{
+    std::list<CachedBlock>::iterator it;
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    for(it = lruList.begin(); it != lruList.end(); ++it)
+    {
+        if(it->isDirty && 0 != it->loggedSequence && it->loggedSequence <= sequence)
+        {
+            markStale(it->blockIndex, 1);   ///replayed to the disk while reads of it may be running
+            it->isDirty = false;
+        }
+    }
+
+    ///blocks kept above the budget go, least recently used first
+    it = lruList.end();
+    while((int)lruList.size() > maxBlocks && it != lruList.begin())
+    {
+        --it;
+        if(!it->isDirty)
+        {
+            if(-1 != it->blockIndex)
+                blockMap.erase(it->blockIndex);
+            delete [] it->data;
+            it = lruList.erase(it);
+        }
+    }
+}
+
+
+
+///function gets number of cache hits
+///return value: number of accesses served from memory
+uint64_t BlockCache::getHits()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return nHits;
+}
+
+
+
+///function gets number of cache misses
+///return value: number of accesses which needed reading the disk
+uint64_t BlockCache::getMisses()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return nMisses;
+}
+
+
+
+///function gets number of cached blocks
+///return value: number of blocks in memory
+int BlockCache::getCachedBlocks()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return lruList.size();
+}
+
+
+
+///function gets maximum number of cached blocks
+///return value: capacity of the cache (in blocks)
+int BlockCache::getMaxBlocks()
+{
+    return maxBlocks;
+}
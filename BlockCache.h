@@ -0,0 +1,242 @@
+///Name: BlockCache.h
+///Purpose: declare and describe BlockCache class - LRU cache of data blocks with write-back
+
+
+
+
+#ifndef BLOCKCACHE_H_INCLUDED
+#define BLOCKCACHE_H_INCLUDED
+
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <stdint.h>
+
+#include "Defines.h"
+#include "DiskIO.h"
+#include "Journal.h"
+
+
+
+
+/*********************************************************************
+ *                          BlockCache class                         *
+ *********************************************************************/
+/**
+        This class caches blocks of the virtual disk in memory.
+        Blocks are identified by their absolute index within the image
+        (firstDataIndex + blockAddress for data blocks).
+
+        The cache holds at most budget / BLOCK_SIZE blocks. When it is full,
+        the least recently used block is evicted and, if it was changed,
+        written back first. flush() writes back every changed block, runs of
+        neighbouring blocks with a single vectored write.
+        A budget of 0 turns the cache off - every access goes to the disk.
+        readBlocks() serves runs of file data: from memory when every block
+        of the run is cached, otherwise with one disk access, after which
+        the blocks read whole are kept as unchanged entries (never above
+        the budget).
+
+        With a journal, changed blocks must not reach the disk before their
+        transaction is committed and replayed, so the cache holds them
+        (keepChanges()): only clean blocks are evicted, the cache grows above
+        its budget if there is none, and even with a budget of 0 writes are
+        kept in memory. logChanges() adds blocks changed since last call to
+        next transaction, markCheckpointed() lets blocks go once their
+        transaction is replayed to the disk.
+
+        Public methods may be called from several threads. They hold
+        cacheMutex while they use the list and the map, but not while they
+        read the disk: a read is noted as pending, the lock is released for
+        it and taken again afterwards. A block which leaves the cache with
+        contents the disk did not have when the read began (written back,
+        dropped, checkpointed) makes the pending reads of it stale - they
+        are repeated. Copies cached meanwhile are newer than the bytes read,
+        so they are taken instead, and blocks read are only added if they
+        are still not cached.
+**/
+
+
+class BlockCache
+{
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private attributes                                                                                             *
+ ********************************************************************************************************************************************************************************************/
+
+    struct CachedBlock
+    {
+        int64_t blockIndex;                    ///absolute index of block
+        unsigned char* data;                   ///contents of block
+        bool isDirty;                          ///whether block changed since it was read
+        uint64_t loggedSequence;               ///transaction holding current contents, 0 if not logged yet
+    };
+
+    struct PendingRead
+    {
+        int64_t firstBlockIndex;               ///absolute index of first block read
+        int nBlocks;                           ///number of blocks read
+        bool isStale;                          ///whether one of the blocks changed on the disk during the read
+    };
+
+    DiskIO* diskIO;                            ///access to the virtual disk file
+    int maxBlocks;                             ///maximum number of cached blocks
+    bool holdsChanges;                         ///whether changed blocks are kept until checkpoint instead of being written back
+    std::list<CachedBlock> lruList;            ///cached blocks, most recently used first
+    std::unordered_map<int64_t, std::list<CachedBlock>::iterator> blockMap; ///position of cached block on the list
+    std::list<PendingRead> pendingReads;       ///disk reads running without cacheMutex
+    uint64_t nHits;                            ///number of accesses served from memory
+    uint64_t nMisses;                          ///number of accesses which needed reading the disk
+    std::mutex cacheMutex;                     ///guards list, map, pending reads and contents of cached blocks
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+    ///function gets cached block, reading or evicting blocks if necessary (cacheMutex is released while the disk is read)
+    ///parameters: lock on cacheMutex, absolute index of block, whether contents on the disk are needed (false if whole block is overwritten)
+    ///return value: cached block, moved to the front of the list
+    CachedBlock& getBlock(std::unique_lock<std::mutex>& lock, int64_t blockIndex, bool needsContents);
+
+
+
+    ///function puts block which is not cached at the front of the list, evicting least recently used block which may go if cache is full
+    ///parameters: absolute index of block, whether cache may grow above its budget if no block may go
+    ///return value: cached block (contents not read), NULL if there is no room for it
+    CachedBlock* addBlock(int64_t blockIndex, bool mayGrow);
+
+
+
+    ///function writes block back to the disk if it was changed
+    ///parameters: cached block
+    void writeBack(CachedBlock& block);
+
+
+
+    ///function reads bytes of a run of blocks from the disk with cacheMutex released, again if the read goes stale meanwhile
+    ///parameters: lock on cacheMutex (held before and after), absolute index of first block, offset within first block, destination buffer, number of bytes
+    ///return value: number of bytes read
+    int readFromDisk(std::unique_lock<std::mutex>& lock, int64_t firstBlockIndex, int offset, void* destination, int nBytes);
+
+
+
+    ///function marks pending reads of blocks as stale - their contents on the disk changed or are about to
+    ///parameters: absolute index of first block, number of blocks
+    void markStale(int64_t firstBlockIndex, int nBlocks);
+
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                              public methods                                                                                              *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+public:
+
+    ///constructor
+    BlockCache();
+
+
+
+    ///destructor
+    ~BlockCache();
+
+
+
+    ///function sets disk to cache and memory budget, dropping cached blocks
+    ///parameters: access to the virtual disk file, memory budget (in bytes)
+    void setBudget(DiskIO* newDiskIO, int64_t budget);
+
+
+
+    ///function reads bytes from a block
+    ///parameters: absolute index of block, offset within block, destination buffer, number of bytes
+    ///return value: number of bytes read
+    int readBlock(int64_t blockIndex, int offset, void* destination, int nBytes);
+
+
+
+    ///function writes bytes to a block
+    ///parameters: absolute index of block, offset within block, source buffer, number of bytes
+    ///return value: number of bytes written
+    int writeBlock(int64_t blockIndex, int offset, const void* source, int nBytes);
+
+
+
+    ///function reads bytes of a run of neighbouring blocks, from the cache if it holds all of them, else with a single disk access keeping whole blocks read
+    ///parameters: absolute index of first block, offset within first block, destination buffer, number of bytes
+    ///return value: number of bytes read
+    int readBlocks(int64_t firstBlockIndex, int offset, void* destination, int nBytes);
+
+
+
+    ///function forgets cached copies of blocks overwritten on the disk directly, without writing them back - called before the write (changed copies
+    ///must not be written back over it) and again once it is done (copies read meanwhile hold old contents)
+    ///parameters: absolute index of first block, number of blocks
+    void dropBlocks(int64_t firstBlockIndex, int nBlocks);
+
+
+
+    ///function writes every changed block back to the disk
+    void flush();
+
+
+
+    ///function sets whether changed blocks are kept in memory until checkpoint (used with a journal)
+    ///parameters: whether to keep changed blocks
+    void keepChanges(bool keep);
+
+
+
+    ///function adds every block changed since last call to next transaction of the journal
+    ///parameters: journal, number of next transaction
+    void logChanges(Journal& journal, uint64_t sequence);
+
+
+
+    ///function marks blocks as written back once their transactions are replayed to the disk, then shrinks cache to its budget
+    ///parameters: number of last replayed transaction
+    void markCheckpointed(uint64_t sequence);
+
+
+
+    ///function gets number of cache hits
+    ///return value: number of accesses served from memory
+    uint64_t getHits();
+
+
+
+    ///function gets number of cache misses
+    ///return value: number of accesses which needed reading the disk
+    uint64_t getMisses();
+
+
+
+    ///function gets number of cached blocks
+    ///return value: number of blocks in memory
+    int getCachedBlocks();
+
+
+
+    ///function gets maximum number of cached blocks
+    ///return value: capacity of the cache (in blocks)
+    int getMaxBlocks();
+
+
+
+};
+
+
+
+
+#endif // BLOCKCACHE_H_INCLUDED
@@ -0,0 +1,198 @@
+///Name: Checksum.cpp
+///Purpose: define methods from Checksum class - CRC32C of blocks
+
+
+
+#include "Checksum.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+
+
+uint32_t Checksum::tables[8][256];
+uint32_t Checksum::streamShifts[2];
+bool Checksum::useInstructions = false;
+bool Checksum::isReady = Checksum::initialize();
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///function builds lookup tables and stream factors, and chooses implementation
+///return value: true
+bool Checksum::initialize()
+{
+    uint32_t crc;
+
+    for(int b = 0; b < 256; ++b)
+    {
+        crc = b;
+        for(int i = 0; i < BYTE_SIZE; ++i)
+            crc = (crc & 1) ? (crc >> 1) ^ CHECKSUM_POLYNOMIAL : crc >> 1;
+        tables[0][b] = crc;
+    }
+    for(int k = 1; k < 8; ++k)
+        for(int b = 0; b < 256; ++b)
+            tables[k][b] = (tables[k - 1][b] >> 8) ^ tables[0][tables[k - 1][b] & 0xFF];
+
+    ///carry-less product of CRC and x^(n-33) reduced by crc32 instruction is CRC moved past n bits of zeros
+    streamShifts[0] = powerOfX(2 * CHECKSUM_STREAM_BYTES * BYTE_SIZE - 33);
+    streamShifts[1] = powerOfX(CHECKSUM_STREAM_BYTES * BYTE_SIZE - 33);
+
+#if defined(__x86_64__)
+    useInstructions = __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+#endif
+
+    return true;
+}
+
+
+
+///function continues CRC register with bytes, eight at a time through lookup tables
+///parameters: CRC register, buffer, number of bytes
+///return value: CRC register after the bytes
+uint32_t Checksum::updateWithTables(uint32_t crc, const unsigned char* data, int64_t nBytes)
+{
+    uint64_t word;
+
+    for(; nBytes >= 8; nBytes -= 8, data += 8)
+    {
+        memcpy(&word, data, sizeof(word));     ///little endian, as everything on the disk
+        word ^= crc;
+        crc = tables[7][word & 0xFF] ^ tables[6][(word >> 8) & 0xFF] ^ tables[5][(word >> 16) & 0xFF] ^ tables[4][(word >> 24) & 0xFF]
+            ^ tables[3][(word >> 32) & 0xFF] ^ tables[2][(word >> 40) & 0xFF] ^ tables[1][(word >> 48) & 0xFF] ^ tables[0][word >> 56];
+    }
+
+    for(; nBytes > 0; --nBytes, ++data)
+        crc = (crc >> 8) ^ tables[0][(crc ^ *data) & 0xFF];
+
+    return crc;
+}
+
+
+
+#if defined(__x86_64__)
+
+///function continues CRC register with bytes, using crc32 instruction over three streams at once
+///parameters: CRC register, buffer, number of bytes
+///return value: CRC register after the bytes
+__attribute__((target("sse4.2,pclmul")))
+uint32_t Checksum::updateWithInstructions(uint32_t crc, const unsigned char* data, int64_t nBytes)
+{
+    uint64_t crc0;
+    uint64_t crc1;
+    uint64_t crc2;
+    uint64_t words[3];
+    __m128i product;
+
+    for(; nBytes > 0 && 0 != ((uintptr_t)data & 7); --nBytes, ++data)
+        crc = _mm_crc32_u8(crc, *data);
+
+    ///each instruction waits for the one before it in its stream only - three streams keep the unit busy
+    for(; nBytes >= 3 * CHECKSUM_STREAM_BYTES; nBytes -= 3 * CHECKSUM_STREAM_BYTES, data += 3 * CHECKSUM_STREAM_BYTES)
+    {
+        crc0 = crc;
+        crc1 = 0;
+        crc2 = 0;
+        for(int i = 0; i < CHECKSUM_STREAM_BYTES; i += 8)
+        {
+            memcpy(&words[0], data + i, sizeof(uint64_t));
+            memcpy(&words[1], data + CHECKSUM_STREAM_BYTES + i, sizeof(uint64_t));
+            memcpy(&words[2], data + 2 * CHECKSUM_STREAM_BYTES + i, sizeof(uint64_t));
+            crc0 = _mm_crc32_u64(crc0, words[0]);
+            crc1 = _mm_crc32_u64(crc1, words[1]);
+            crc2 = _mm_crc32_u64(crc2, words[2]);
+        }
+
+        ///CRC of the whole is CRCs of first two streams moved past the streams after them, added to CRC of the last one
+        product = _mm_xor_si128(_mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc0), _mm_cvtsi32_si128((int)streamShifts[0]), 0),
+                                _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc1), _mm_cvtsi32_si128((int)streamShifts[1]), 0));
+        crc = (uint32_t)crc2 ^ (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(product));
+    }
+
+    for(; nBytes >= 8; nBytes -= 8, data += 8)
+    {
+        memcpy(&words[0], data, sizeof(uint64_t));
+        crc = (uint32_t)_mm_crc32_u64(crc, words[0]);
+    }
+    for(; nBytes > 0; --nBytes, ++data)
+        crc = _mm_crc32_u8(crc, *data);
+
+    return crc;
+}
+
+#else
+
+///function continues CRC register with bytes (no crc32 instruction on this processor family - lookup tables)
+///parameters: CRC register, buffer, number of bytes
+///return value: CRC register after the bytes
+uint32_t Checksum::updateWithInstructions(uint32_t crc, const unsigned char* data, int64_t nBytes)
+{
+    return updateWithTables(crc, data, nBytes);
+}
+
+#endif
+
+
+
+///function computes x to a power modulo CRC32C polynomial (bit-reflected, as CRC registers are)
+///parameters: exponent
+///return value: remainder
+uint32_t Checksum::powerOfX(int exponent)
+{
+    uint32_t remainder = 0x80000000;   ///x^0 - highest bit holds lowest power
+
+    for(int i = 0; i < exponent; ++i)
+        remainder = (remainder & 1) ? (remainder >> 1) ^ CHECKSUM_POLYNOMIAL : remainder >> 1;
+
+    return remainder;
+}
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           public methods                                                                                                 *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///function continues CRC32C of earlier bytes with more bytes
+///parameters: CRC32C of earlier bytes (0 if there are none), buffer, number of bytes
+///return value: CRC32C of all bytes
+uint32_t Checksum::update(uint32_t crc, const void* data, int64_t nBytes)
+{
+    if(useInstructions)
+        return ~updateWithInstructions(~crc, (const unsigned char*)data, nBytes);
+
+    return ~updateWithTables(~crc, (const unsigned char*)data, nBytes);
+}
+
+
+
+///function computes CRC32C of a buffer
+///parameters: buffer, number of bytes
+///return value: CRC32C
+uint32_t Checksum::compute(const void* data, int64_t nBytes)
+{
+    return update(0, data, nBytes);
+}
+
+
+
+///function tells whether CRC32C is computed with SSE4.2 and PCLMULQDQ instructions
+///return value: true if so, false if lookup tables are used
+bool Checksum::isAccelerated()
+{
+    return useInstructions;
+}
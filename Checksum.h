@@ -0,0 +1,121 @@
+///Name: Checksum.h
+///Purpose: declare and describe Checksum class - CRC32C of blocks
+
+
+
+
+#ifndef CHECKSUM_H_INCLUDED
+#define CHECKSUM_H_INCLUDED
+
+#include <stdint.h>
+
+#include "Defines.h"
+
+
+
+
+/*********************************************************************
+ *                           Checksum class                          *
+ *********************************************************************/
+/**
+        This class computes CRC32C (Castagnoli polynomial, as used by iSCSI
+        and ext4) of buffers. Two implementations give the same results:
+
+        hardware -> crc32 instruction of SSE4.2 over three interleaved
+                    streams of CHECKSUM_STREAM_BYTES each, so the latency
+                    of the instruction is hidden; the three CRCs are joined
+                    with carry-less multiplication (PCLMULQDQ)
+        tables   -> eight tables of 256 entries, eight bytes at a time
+                    (slicing-by-8), on processors without those instructions
+
+        The hardware one is chosen once, when the processor supports both
+        instruction sets. CRCs may be continued, so a buffer given in parts
+        gets the same CRC as given whole.
+**/
+
+
+class Checksum
+{
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private attributes                                                                                             *
+ ********************************************************************************************************************************************************************************************/
+
+    static uint32_t tables[8][256];            ///tables[k][b] - CRC register after byte b followed by k zero bytes
+    static uint32_t streamShifts[2];           ///factors moving CRC of a stream past two streams and past one stream (x^(8*bytes-33) modulo polynomial)
+    static bool useInstructions;               ///whether SSE4.2 and PCLMULQDQ are available
+    static bool isReady;                       ///set once tables are built, before main() runs
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+    ///function builds lookup tables and stream factors, and chooses implementation
+    ///return value: true
+    static bool initialize();
+
+
+
+    ///function continues CRC register with bytes, eight at a time through lookup tables
+    ///parameters: CRC register, buffer, number of bytes
+    ///return value: CRC register after the bytes
+    static uint32_t updateWithTables(uint32_t crc, const unsigned char* data, int64_t nBytes);
+
+
+
+    ///function continues CRC register with bytes, using crc32 instruction over three streams at once
+    ///parameters: CRC register, buffer, number of bytes
+    ///return value: CRC register after the bytes
+    static uint32_t updateWithInstructions(uint32_t crc, const unsigned char* data, int64_t nBytes);
+
+
+
+    ///function computes x to a power modulo CRC32C polynomial (bit-reflected, as CRC registers are)
+    ///parameters: exponent
+    ///return value: remainder
+    static uint32_t powerOfX(int exponent);
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                              public methods                                                                                              *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+public:
+
+    ///function continues CRC32C of earlier bytes with more bytes
+    ///parameters: CRC32C of earlier bytes (0 if there are none), buffer, number of bytes
+    ///return value: CRC32C of all bytes
+    static uint32_t update(uint32_t crc, const void* data, int64_t nBytes);
+
+
+
+    ///function computes CRC32C of a buffer
+    ///parameters: buffer, number of bytes
+    ///return value: CRC32C
+    static uint32_t compute(const void* data, int64_t nBytes);
+
+
+
+    ///function tells whether CRC32C is computed with SSE4.2 and PCLMULQDQ instructions
+    ///return value: true if so, false if lookup tables are used
+    static bool isAccelerated();
+
+
+
+};
+
+
+
+
+#endif // CHECKSUM_H_INCLUDED
@@ -0,0 +1,192 @@
+///Name: Codec.cpp
+///Purpose: define methods from Codec class - compression of chunks of files (LZ4 block format)
+
+
+
+#include "Codec.h"
+
+#include <string.h>
+#include <algorithm>
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///function writes a length which does not fit in its 4 bits of a token
+///parameters: destination buffer, position in it (moved past written bytes), rest of the length (at least 0)
+void Codec::writeLength(unsigned char* destination, int& position, int length)
+{
+    for(; length >= 255; length -= 255)
+        destination[position++] = 255;
+    destination[position++] = (unsigned char)length;
+}
+
+
+
+///function writes one sequence - literals and a match after them (none for the last sequence)
+///parameters: destination buffer, position in it (moved past the sequence), capacity of destination, literals, number of literals, offset of match, length of match (0 for the last sequence)
+///return value: -1 if the sequence does not fit, else 0
+int Codec::writeSequence(unsigned char* destination, int& position, int capacity, const unsigned char* literals, int nLiterals, int offset, int matchLength)
+{
+    int tokenPosition;
+
+    ///token, lengths, literals and offset at most
+    if((int64_t)position + 1 + nLiterals / 255 + 1 + nLiterals + 2 + matchLength / 255 + 1 > capacity)
+        return -1;
+
+    tokenPosition = position++;
+    destination[tokenPosition] = (unsigned char)(std::min(nLiterals, 15) << 4);
+    if(nLiterals >= 15)
+        writeLength(destination, position, nLiterals - 15);
+    memcpy(destination + position, literals, nLiterals);
+    position += nLiterals;
+
+    if(0 == matchLength)    ///last sequence
+        return 0;
+
+    destination[position++] = (unsigned char)(offset & 0xFF);
+    destination[position++] = (unsigned char)(offset >> 8);
+    destination[tokenPosition] |= (unsigned char)std::min(matchLength - CODEC_MIN_MATCH, 15);
+    if(matchLength - CODEC_MIN_MATCH >= 15)
+        writeLength(destination, position, matchLength - CODEC_MIN_MATCH - 15);
+    return 0;
+}
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                              public methods                                                                                              *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///function compresses a buffer
+///parameters: source buffer, number of bytes, destination buffer, capacity of destination
+///return value: number of compressed bytes, 0 if they do not fit in destination
+int Codec::compress(const unsigned char* source, int nBytes, unsigned char* destination, int capacity)
+{
+    int hashTable[1 << CODEC_HASH_LOG];    ///last position of every hashed 4-byte word
+    int position = 0;       ///position in destination
+    int anchor = 0;         ///first byte not yet written
+    int current = 0;
+    int candidate;
+    int matchLength;
+    int matchLimit = nBytes - CODEC_LAST_LITERALS;  ///matches end this far from the end at latest
+    int startLimit = nBytes - CODEC_MATCH_START_LIMIT;  ///and start this far from it at latest
+    int nMisses = 0;
+    uint32_t word;
+    uint32_t hash;
+
+    for(int i = 0; i < (1 << CODEC_HASH_LOG); ++i)
+        hashTable[i] = -1;
+
+    while(current < startLimit)
+    {
+        memcpy(&word, source + current, sizeof(word));
+        hash = (word * 2654435761u) >> (32 - CODEC_HASH_LOG);
+        candidate = hashTable[hash];
+        hashTable[hash] = current;
+
+        if(-1 == candidate || current - candidate > CODEC_MAX_OFFSET || 0 != memcmp(source + candidate, source + current, CODEC_MIN_MATCH))
+        {
+            current += 1 + (nMisses++ >> CODEC_SKIP_SHIFT);   ///data which does not compress is skipped faster and faster
+            continue;
+        }
+        nMisses = 0;
+
+        matchLength = CODEC_MIN_MATCH;
+        while(current + matchLength < matchLimit && source[candidate + matchLength] == source[current + matchLength])
+            ++matchLength;
+
+        if(-1 == writeSequence(destination, position, capacity, source + anchor, current - anchor, current - candidate, matchLength))
+            return 0;
+        current += matchLength;
+        anchor = current;
+    }
+
+    ///rest of the buffer as literals
+    if(-1 == writeSequence(destination, position, capacity, source + anchor, nBytes - anchor, 0, 0))
+        return 0;
+    return position;
+}
+
+
+
+///function decompresses a buffer
+///parameters: compressed bytes, number of them, destination buffer, capacity of destination
+///return value: number of decompressed bytes, -1 if compressed bytes are damaged or do not fit in destination
+int Codec::decompress(const unsigned char* source, int nBytes, unsigned char* destination, int capacity)
+{
+    int position = 0;       ///position in source
+    int written = 0;        ///position in destination
+    int length;
+    int offset;
+    unsigned char token;
+    unsigned char next;
+
+    while(position < nBytes)
+    {
+        token = source[position++];
+
+        ///literals
+        length = token >> 4;
+        if(15 == length)
+        {
+            do
+            {
+                if(position >= nBytes)
+                    return -1;
+                next = source[position++];
+                length += next;
+            }
+            while(255 == next);
+        }
+        if(length > nBytes - position || length > capacity - written)
+            return -1;
+        memcpy(destination + written, source + position, length);
+        position += length;
+        written += length;
+
+        if(position == nBytes)  ///last sequence has no match
+            return written;
+
+        ///match
+        if(nBytes - position < 2)
+            return -1;
+        offset = source[position] | (source[position + 1] << 8);
+        position += 2;
+        if(0 == offset || offset > written)
+            return -1;
+
+        length = token & 15;
+        if(15 == length)
+        {
+            do
+            {
+                if(position >= nBytes)
+                    return -1;
+                next = source[position++];
+                length += next;
+            }
+            while(255 == next);
+        }
+        length += CODEC_MIN_MATCH;
+        if(length > capacity - written)
+            return -1;
+
+        if(offset >= length)
+            memcpy(destination + written, destination + written - offset, length);
+        else    ///match overlaps bytes it produces - copied byte by byte
+            for(int i = 0; i < length; ++i)
+                destination[written + i] = destination[written - offset + i];
+        written += length;
+    }
+
+    return -1;  ///empty input, or last sequence missing
+}
@@ -0,0 +1,88 @@
+///Name: Codec.h
+///Purpose: declare and describe Codec class - compression of chunks of files (LZ4 block format)
+
+
+
+
+#ifndef CODEC_H_INCLUDED
+#define CODEC_H_INCLUDED
+
+#include <stdint.h>
+
+#include "Defines.h"
+
+
+
+
+/*********************************************************************
+ *                            Codec class                            *
+ *********************************************************************/
+/**
+        This class compresses and decompresses buffers in LZ4 block format
+        (no frame around it). A block is a series of sequences:
+
+        token          -> number of literals (high 4 bits) and length of match - 4 (low 4 bits),
+                          15 in either means more bytes of the length follow (each added, until one below 255)
+        literals       -> bytes copied as they are
+        offset         -> 16-bit distance back to the match (little endian)
+
+        The last sequence has literals only. Matches are found greedily
+        through a hash table of CODEC_HASH_LOG bits over 4-byte words, so
+        compression is fast rather than tight. Decompression checks every
+        length and offset against both buffers, so damaged data is reported
+        instead of being read or written out of bounds.
+**/
+
+
+class Codec
+{
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+    ///function writes a length which does not fit in its 4 bits of a token
+    ///parameters: destination buffer, position in it (moved past written bytes), rest of the length (at least 0)
+    static void writeLength(unsigned char* destination, int& position, int length);
+
+
+
+    ///function writes one sequence - literals and a match after them (none for the last sequence)
+    ///parameters: destination buffer, position in it (moved past the sequence), capacity of destination, literals, number of literals, offset of match, length of match (0 for the last sequence)
+    ///return value: -1 if the sequence does not fit, else 0
+    static int writeSequence(unsigned char* destination, int& position, int capacity, const unsigned char* literals, int nLiterals, int offset, int matchLength);
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                              public methods                                                                                              *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+public:
+
+    ///function compresses a buffer
+    ///parameters: source buffer, number of bytes, destination buffer, capacity of destination
+    ///return value: number of compressed bytes, 0 if they do not fit in destination
+    static int compress(const unsigned char* source, int nBytes, unsigned char* destination, int capacity);
+
+
+
+    ///function decompresses a buffer
+    ///parameters: compressed bytes, number of them, destination buffer, capacity of destination
+    ///return value: number of decompressed bytes, -1 if compressed bytes are damaged or do not fit in destination
+    static int decompress(const unsigned char* source, int nBytes, unsigned char* destination, int capacity);
+
+
+
+};
+
+
+
+
+#endif // CODEC_H_INCLUDED
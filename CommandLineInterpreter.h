@@ -9,11 +9,32 @@
 
 #include "VirtualDisk.h"
 
+#include <fstream>
+#include <map>
+#include <chrono>
+#include <iomanip>
+
+
+
+/**
+        In batch mode (script given with -f, or standard input which is not
+        a terminal) no prompt is printed, standard output is buffered, and
+        the status and time of every command go to the log stream (standard
+        error), followed by a timing summary at the end of the batch.
+**/
 
 
 class CommandLineInterpreter
 {
     VirtualDisk *vDisk; ///pointer to virtual disk
+    std::istream* input; ///stream commands are read from (standard input or script)
+    std::ifstream script; ///script file
+    bool isBatch; ///whether running in batch mode
+    bool isRunning; ///false once exit chosen or input ended
+    int nCommands; ///number of commands run in batch mode
+    int nFailedCommands; ///number of commands which failed in batch mode
+    double totalTime; ///time of all commands run in batch mode (in milliseconds)
+    std::map<std::string, std::pair<int, double> > commandTimes; ///for each command: number of runs, total time (in milliseconds)
 
 
 
@@ -22,19 +43,30 @@ class CommandLineInterpreter
 
 
 
-    ///function gets command from standard input and parses it
-    ///return value: parsed command in vector form
+    ///function gets command from input and parses it
+    ///return value: parsed command in vector form, empty at the end of input
     std::vector<std::string> parseCommand();
 
 
 
     ///function interprets command
     ///parameters: parsed command
-    ///return value: -1 if exit chosen, else 0
+    ///return value: -1 if command failed, else 0
     int interpretCommand(std::vector<std::string> parsedCommand);
 
 
 
+    ///function interprets command in batch mode, reporting its status and time
+    ///parameters: parsed command
+    void interpretBatchCommand(std::vector<std::string> parsedCommand);
+
+
+
+    ///function prints timing summary of the batch
+    void printBatchSummary();
+
+
+
     ///function checks argument count and displays appropriate error message
     ///parameters: count of arguments given by the user, minimum number of arguments for given function, maximum number of arguments for given function
     ///return value: -1 if incorrect number of arguments, else 0
@@ -42,13 +74,20 @@ class CommandLineInterpreter
 
 
 
+    ///function takes storage option (-z or -d) out of a copying command
+    ///parameters: parsed command (option is removed)
+    ///return value: storage mode of copied files (STORE_PLAIN if there is no option)
+    int parseStorageMode(std::vector<std::string>& parsedCommand);
+
+
+
 public:
 
 
 
     ///constructor
-    ///parameters: name of virtual disk file, size of virtual disk
-    CommandLineInterpreter(char* vDiskFileName = DEFAULT_NAME, int vDiskSize = -1);
+    ///parameters: name of virtual disk file, size of virtual disk, storage backend (IO_PREAD or IO_MMAP), memory budget of block cache (in bytes), number of transfers kept in flight when copying, name of script file (NULL to read standard input)
+    CommandLineInterpreter(char* vDiskFileName = DEFAULT_NAME, int64_t vDiskSize = -1, int ioMode = IO_PREAD, int64_t cacheSize = DEFAULT_CACHE_SIZE, int queueDepth = DEFAULT_QUEUE_DEPTH, char* scriptName = NULL);
 
 
 
@@ -62,10 +101,33 @@ public:
 
 
 ///constructor
-///parameters: name of virtual disk file, size of virtual disk
-CommandLineInterpreter::CommandLineInterpreter(char* vDiskFileName, int vDiskSize)
+///parameters: name of virtual disk file, size of virtual disk, storage backend (IO_PREAD or IO_MMAP), memory budget of block cache (in bytes), number of transfers kept in flight when copying, name of script file (NULL to read standard input)
+CommandLineInterpreter::CommandLineInterpreter(char* vDiskFileName, int64_t vDiskSize, int ioMode, int64_t cacheSize, int queueDepth, char* scriptName)
 {
-    vDisk = new VirtualDisk(vDiskFileName, vDiskSize);
+    input = &std::cin;
+    isBatch = NULL != scriptName || !isatty(STDIN_FILENO);
+    nCommands = 0;
+    nFailedCommands = 0;
+    totalTime = 0;
+
+    if(NULL != scriptName)
+    {
+        script.open(scriptName);
+        if(!script)
+        {
+            std::cerr << "Could not open script file!\n";
+            exit(EXIT_FAILURE);
+        }
+        input = &script;
+    }
+
+    if(isBatch)     ///standard output gets its own buffer, flushed only when full or at the end
+    {
+        std::ios::sync_with_stdio(false);
+        std::cin.tie(NULL);
+    }
+
+    vDisk = new VirtualDisk(vDiskFileName, vDiskSize, ioMode, cacheSize, queueDepth);
     run();
 }
 
@@ -74,12 +136,32 @@ CommandLineInterpreter::CommandLineInterpreter(char* vDiskFileName, int vDiskSiz
 ///function running the command line interpreter in a loop
 void CommandLineInterpreter::run()
 {
-    while(1)
+    std::vector<std::string> parsedCommand;
+
+    isRunning = true;
+    while(isRunning)
     {
-        printIncentive();
-        if(-1 == interpretCommand(parseCommand()))
+        if(!isBatch)
+            printIncentive();
+
+        parsedCommand = parseCommand();
+        if(parsedCommand.empty())   ///end of input
             break;
+        if(parsedCommand[0].empty() || '#' == parsedCommand[0][0])   ///blank line or comment
+            continue;
+
+        if(isBatch)
+            interpretBatchCommand(parsedCommand);
+        else
+            interpretCommand(parsedCommand);
     }
+
+    if(isBatch)
+        printBatchSummary();
+
+    delete vDisk;
+    vDisk = NULL;
+    std::cout.flush();
 }
 
 
@@ -92,8 +174,8 @@ void CommandLineInterpreter::printIncentive()
 
 
 
-///function gets command from standard input and parses it
-///return value: parsed command in vector form
+///function gets command from input and parses it
+///return value: parsed command in vector form, empty at the end of input
 std::vector<std::string> CommandLineInterpreter::parseCommand()
 {
     std::string command;
@@ -102,7 +184,9 @@ std::vector<std::string> CommandLineInterpreter::parseCommand()
     std::vector<std::string> parsedCommand;
     size_t pos = 0;
 
-    std::getline(std::cin, command);
+    if(!std::getline(*input, command))
+        return parsedCommand;
+
     while((pos = command.find(delimeter)) != std::string::npos)
     {
         token = command.substr(0, pos);
@@ -118,90 +202,162 @@ std::vector<std::string> CommandLineInterpreter::parseCommand()
 
 ///function interprets command
 ///parameters: parsed command
-///return value: -1 if exit chosen, else 0
+///return value: -1 if command failed, else 0
 int CommandLineInterpreter::interpretCommand(std::vector<std::string> parsedCommand)
 {
     int returnValue = 0;
+    int storageMode;
 
     if(parsedCommand.empty())
         return 0;
 
     if("ls" == parsedCommand[0])                                                     ///ls command
     {
-        if(-1 != checkArgumentCount(parsedCommand.size(), 1, 1))
+        returnValue = checkArgumentCount(parsedCommand.size(), 1, 1);
+        if(-1 != returnValue)
             vDisk->listDirectory();
     }
     else if("pwd" == parsedCommand[0])                                               ///pwd command
     {
-        if(-1 != checkArgumentCount(parsedCommand.size(), 1, 1))
+        returnValue = checkArgumentCount(parsedCommand.size(), 1, 1);
+        if(-1 != returnValue)
             vDisk->printPath();
     }
     else if("info" == parsedCommand[0])                                              ///info command
     {
-        if(-1 != checkArgumentCount(parsedCommand.size(), 1, 1))
-            vDisk->printDiskUsageInfo();
+        returnValue = checkArgumentCount(parsedCommand.size(), 1, 2);
+        if(-1 != returnValue)
+            vDisk->printDiskUsageInfo(2 == parsedCommand.size() && "verify" == parsedCommand[1]);
     }
     else if("cd" == parsedCommand[0])                                                ///cd command
     {
-        if(-1 != checkArgumentCount(parsedCommand.size(), 2, 2))
-            vDisk->changeDirectory(parsedCommand[1]);
+        returnValue = checkArgumentCount(parsedCommand.size(), 2, 2);
+        if(-1 != returnValue)
+            returnValue = vDisk->changeDirectory(parsedCommand[1]);
     }
     else if("mkdir" == parsedCommand[0])                                             ///mkdir command
     {
-        if(-1 != checkArgumentCount(parsedCommand.size(), 2, 2))
-            vDisk->createNewDirectory(parsedCommand[1]);
+        returnValue = checkArgumentCount(parsedCommand.size(), 2, 2);
+        if(-1 != returnValue)
+            returnValue = vDisk->createNewDirectory(parsedCommand[1]);
+    }
+    else if("ucp" == parsedCommand[0])                                               ///ucp command - up copy (-z stores file compressed, -d deduplicated)
+    {
+        storageMode = parseStorageMode(parsedCommand);
+        returnValue = checkArgumentCount(parsedCommand.size(), 3, 3);
+        if(-1 != returnValue)
+            returnValue = vDisk->copyToVDisk((char*)parsedCommand[1].c_str(), parsedCommand[2], storageMode);
     }
-    else if("ucp" == parsedCommand[0])                                               ///ucp command - up copy
+    else if("import" == parsedCommand[0])                                            ///import command - copy directory tree from user system (-z, -d as for ucp)
     {
-        if(-1 != checkArgumentCount(parsedCommand.size(), 3, 3))
-            vDisk->copyToVDisk((char*)parsedCommand[1].c_str(), parsedCommand[2]);
+        storageMode = parseStorageMode(parsedCommand);
+        returnValue = checkArgumentCount(parsedCommand.size(), 3, 3);
+        if(-1 != returnValue)
+            returnValue = vDisk->importDirectory((char*)parsedCommand[1].c_str(), parsedCommand[2], storageMode);
     }
     else if("dcp" == parsedCommand[0])                                               ///dcp command - down copy
     {
-        if(-1 != checkArgumentCount(parsedCommand.size(), 3, 3))
-            vDisk->copyFromVDisk(parsedCommand[1], (char*)parsedCommand[2].c_str());
+        returnValue = checkArgumentCount(parsedCommand.size(), 3, 3);
+        if(-1 != returnValue)
+            returnValue = vDisk->copyFromVDisk(parsedCommand[1], (char*)parsedCommand[2].c_str());
     }
     else if("ab" == parsedCommand[0])                                                ///ab command - add bytes
     {
-        if(-1 != checkArgumentCount(parsedCommand.size(), 3, 3))
-            vDisk->addBytes(parsedCommand[1], (unsigned int)stoi(parsedCommand[2]));
+        returnValue = checkArgumentCount(parsedCommand.size(), 3, 3);
+        if(-1 != returnValue)
+            returnValue = vDisk->addBytes(parsedCommand[1], stoull(parsedCommand[2]));
     }
     else if("db" == parsedCommand[0])                                                ///db command - delete bytes
     {
-        if(-1 != checkArgumentCount(parsedCommand.size(), 3, 3))
-            vDisk->deleteBytes(parsedCommand[1], (unsigned int)stoi(parsedCommand[2]));
+        returnValue = checkArgumentCount(parsedCommand.size(), 3, 3);
+        if(-1 != returnValue)
+            returnValue = vDisk->deleteBytes(parsedCommand[1], stoull(parsedCommand[2]));
     }
     else if("ln" == parsedCommand[0])                                                ///ln command
     {
-        if(-1 != checkArgumentCount(parsedCommand.size(), 3, 3))
-            vDisk->addLink(parsedCommand[1], parsedCommand[2]);
+        returnValue = checkArgumentCount(parsedCommand.size(), 3, 3);
+        if(-1 != returnValue)
+            returnValue = vDisk->addLink(parsedCommand[1], parsedCommand[2]);
     }
     else if("rm" == parsedCommand[0])                                                ///rm command
     {
-        if(-1 != checkArgumentCount(parsedCommand.size(), 2, 2))
-            vDisk->deleteFile(parsedCommand[1]);
+        returnValue = checkArgumentCount(parsedCommand.size(), 2, 2);
+        if(-1 != returnValue)
+            returnValue = vDisk->deleteFile(parsedCommand[1]);
     }
     else if("cat" == parsedCommand[0])                                               ///cat command
     {
-        if(-1 != checkArgumentCount(parsedCommand.size(), 2, 2))
-            vDisk->printOnConsole(parsedCommand[1]);
+        returnValue = checkArgumentCount(parsedCommand.size(), 2, 2);
+        if(-1 != returnValue)
+            returnValue = vDisk->printOnConsole(parsedCommand[1]);
+    }
+    else if("scrub" == parsedCommand[0])                                             ///scrub command - check every block against its checksum
+    {
+        returnValue = checkArgumentCount(parsedCommand.size(), 1, 1);
+        if(-1 != returnValue)
+            returnValue = vDisk->scrub();
+    }
+    else if("cache" == parsedCommand[0])                                             ///cache command
+    {
+        returnValue = checkArgumentCount(parsedCommand.size(), 1, 1);
+        if(-1 != returnValue)
+            vDisk->printCacheInfo();
     }
     else if("exit" == parsedCommand[0])                                              ///exit command
     {
-        if(-1 != checkArgumentCount(parsedCommand.size(), 1, 1))
-        {
-            returnValue = -1;
-            delete vDisk;
-        }
+        returnValue = checkArgumentCount(parsedCommand.size(), 1, 1);
+        if(-1 != returnValue)
+            isRunning = false;
     }
     else
+    {
         std::cerr << parsedCommand[0] << ": command not found!\n";
+        returnValue = -1;
+    }
 
     return returnValue;
 }
 
 
 
+///function interprets command in batch mode, reporting its status and time
+///parameters: parsed command
+void CommandLineInterpreter::interpretBatchCommand(std::vector<std::string> parsedCommand)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int status = interpretCommand(parsedCommand);
+    double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    ++nCommands;
+    if(-1 == status)
+        ++nFailedCommands;
+    totalTime += time;
+    ++commandTimes[parsedCommand[0]].first;
+    commandTimes[parsedCommand[0]].second += time;
+
+    ///status line: number of command, status, time, command
+    std::clog << "[" << nCommands << "] " << (-1 == status ? "FAILED" : "OK") << " " << std::fixed << std::setprecision(3) << time << " ms:";
+    for(int i = 0; i < (int)parsedCommand.size(); ++i)
+        std::clog << " " << parsedCommand[i];
+    std::clog << "\n";
+}
+
+
+
+///function prints timing summary of the batch
+void CommandLineInterpreter::printBatchSummary()
+{
+    std::clog << std::fixed << std::setprecision(3);
+    std::clog << "Batch summary: " << nCommands << " commands, " << nFailedCommands << " failed, " << totalTime << " ms\n";
+
+    for(std::map<std::string, std::pair<int, double> >::iterator it = commandTimes.begin(); it != commandTimes.end(); ++it)
+        std::clog << it->first << ": " << it->second.first << " commands, " << it->second.second << " ms, " << it->second.second / it->second.first << " ms average\n";
+
+    std::clog.flush();
+}
+
+
+
 ///function checks argument count and displays appropriate error message
 ///parameters: count of arguments given by the user, minimum number of arguments for given function, maximum number of arguments for given function
 ///return value: -1 if incorrect number of arguments, else 0
@@ -224,4 +380,23 @@ int CommandLineInterpreter::checkArgumentCount(int argCount, int minCount, int m
 }
 
 
+
+///function takes storage option (-z or -d) out of a copying command
+///parameters: parsed command (option is removed)
+///return value: storage mode of copied files (STORE_PLAIN if there is no option)
+int CommandLineInterpreter::parseStorageMode(std::vector<std::string>& parsedCommand)
+{
+    int storageMode = STORE_PLAIN;
+
+    if(parsedCommand.size() > 1 && "-z" == parsedCommand[1])
+        storageMode = STORE_COMPRESSED;
+    else if(parsedCommand.size() > 1 && "-d" == parsedCommand[1])
+        storageMode = STORE_DEDUPLICATED;
+
+    if(STORE_PLAIN != storageMode)
+        parsedCommand.erase(parsedCommand.begin() + 1);
+    return storageMode;
+}
+
+
 #endif // COMMANDLINEINTERPRETER_H_INCLUDED
@@ -9,24 +9,115 @@
 
 
 ///disk defines
+#define FORMAT_VERSION 9
+#define SUPERBLOCK_MAGIC 0x56534653   ///"SFSV" on the disk
+#define SUPERBLOCK_INDEX 0
+#define STATE_CLEAN 1                 ///virtual disk was closed properly
+#define STATE_MOUNTED 2               ///virtual disk is open, or was not closed properly
+#define ROOT_I_NUMBER 0
 #define BLOCK_SIZE 4096
-#define MIN_DISK_SIZE 3 * BLOCK_SIZE
-#define MAX_DISK_SIZE 128 * 1024 * 1024
+#define BITS_PER_BLOCK (BLOCK_SIZE * BYTE_SIZE)
+#define MIN_DISK_SIZE 8 * BLOCK_SIZE
+#define MAX_DISK_SIZE ((int64_t)1024 * 1024 * 1024 * 1024)
+#define MAX_I_NODES 32768             ///i-numbers are stored in directories as 16-bit numbers
 #define AVERAGE_FILE_SIZE_IN_BLOCKS 2
-#define MAX_FILE_SIZE_IN_BLOCKS 56
+#define MAX_FILE_SIZE_IN_BLOCKS (N_DIRECT_BLOCKS + ADDRESSES_PER_BLOCK + ADDRESSES_PER_BLOCK * ADDRESSES_PER_BLOCK)
 #define N_FILES_PER_I_NODE_BLOCK 32
+#define MAX_TRANSFER_BLOCKS 64
 #define DEFAULT_NAME "vDisk.vdf"
 
+///storage modes of a copied file
+#define STORE_PLAIN 0
+#define STORE_COMPRESSED 1            ///'ucp -z'
+#define STORE_DEDUPLICATED 2          ///'ucp -d', 'import -d'
+
+///storage backend defines
+#define IO_PREAD 1     ///pread/pwrite on a file descriptor
+#define IO_MMAP 2      ///whole image mapped into memory
+
+///block cache defines
+#define DEFAULT_CACHE_SIZE 4 * 1024 * 1024
+
+///import defines
+#define MAX_IMPORT_THREADS 8                          ///threads reading files from user system
+#define MAX_IMPORT_BYTES_IN_FLIGHT (64 * 1024 * 1024) ///bytes read but not yet written
+#define MAX_IMPORT_FILE_SIZE (16 * 1024 * 1024)       ///bigger files are copied straight from user system by writer
+
+///asynchronous I/O defines
+#define DEFAULT_QUEUE_DEPTH 16        ///transfers kept in flight by copying between user system and virtual disk
+#define MAX_QUEUE_DEPTH 256
+#define MAX_ASYNC_WORKERS 8           ///threads doing transfers when io_uring is not available
+
+///readahead defines
+#define READAHEAD_BLOCKS 256          ///blocks kept read ahead of a sequential reader (1MB)
+#define MAX_READAHEAD_STREAMS 4       ///files followed by readahead at once
+#define READ_CHUNK_SIZE (MAX_TRANSFER_BLOCKS * BLOCK_SIZE)   ///bytes asked for at once by 'cat' and 'dcp'
+
+///file handle defines
+#define MAX_OPEN_FILES 256            ///handles open at once
+
+///compression defines
+#define COMPRESSION_CHUNK_BLOCKS 16   ///blocks of data compressed together (64KB) - one chunk is read and written at once
+#define CHUNK_HEADER_SIZE 4           ///number of compressed bytes, stored before them in first block of a chunk
+#define CODEC_HASH_LOG 12             ///size of hash table used to find matches (log2 of entries)
+#define CODEC_MIN_MATCH 4
+#define CODEC_MAX_OFFSET 65535
+#define CODEC_LAST_LITERALS 5         ///last bytes are always literals (LZ4 block format)
+#define CODEC_MATCH_START_LIMIT 12    ///no match starts within this many last bytes (LZ4 block format)
+#define CODEC_SKIP_SHIFT 6            ///step grows by one after every 2^CODEC_SKIP_SHIFT positions without a match
+
+///deduplication defines
+#define REFERENCE_COUNT_SIZE 2        ///bytes of reference count entry of a data block
+#define REFERENCE_COUNTS_PER_BLOCK (BLOCK_SIZE / REFERENCE_COUNT_SIZE)
+#define REFERENCE_INDEXED 0x8000      ///block was written by a deduplicated copy - it is in the fingerprint index and never changed in place
+#define MAX_EXTRA_REFERENCES 0x7FFF   ///references beyond the first one, counted in the rest of the entry
+#define FINGERPRINT_ENTRY_SIZE 8      ///32 bits of fingerprint, then 32-bit block address (NO_BLOCK if entry is empty)
+#define FINGERPRINTS_PER_BLOCK (BLOCK_SIZE / FINGERPRINT_ENTRY_SIZE)   ///each block of the index is one bucket of its hash table
+#define FINGERPRINT_INDEX_DIVISOR 512 ///index has one block per this many data blocks - one entry for each of them
+
+///checksum defines
+#define CHECKSUM_SIZE 4               ///bytes of CRC32C of a block in checksum table
+#define CHECKSUMS_PER_BLOCK (BLOCK_SIZE / CHECKSUM_SIZE)
+#define CHECKSUM_POLYNOMIAL 0x82F63B78   ///Castagnoli polynomial, bit-reflected
+#define CHECKSUM_STREAM_BYTES 1360    ///bytes of each of three streams the crc32 instruction works on at once - three of them fill a block but 16 bytes
+#define CHECKSUM_LOCKS 64             ///locks of partly written blocks (block index modulo this), so checksum of a block follows its last write
+#define MAX_SCRUB_THREADS 8           ///threads checking blocks at once
+#define SCRUB_CHUNK_BLOCKS 256        ///blocks checked by a thread at once (1MB)
+
+///journal defines
+#define JOURNAL_MAGIC 0x4C4E524A      ///"JRNL" on the disk
+#define MIN_JOURNAL_BLOCKS 16         ///smaller disks get no journal
+#define MAX_JOURNAL_BLOCKS 8192
+#define JOURNAL_SIZE_DIVISOR 64       ///journal takes this part of the disk (within limits above)
+#define JOURNAL_GROUP_SIZE 64         ///operations committed together at most
+#define JOURNAL_COMMIT_INTERVAL 1000  ///milliseconds an operation waits for its commit at most
+#define JOURNAL_LAST_RECORD 1         ///flag of record ending its transaction
+#define JOURNAL_ITEM_ENTRY 0
+#define JOURNAL_ITEM_REVOKE 1
+#define JOURNAL_ITEM_RELEASE 2
+#define JOURNAL_BLOCK_MASK 0x3FFFFFFF ///block index within first word of an item, type takes two highest bits
+#define JOURNAL_ITEMS_PER_RECORD ((BLOCK_SIZE - 32) / 8)   ///items (two 32-bit words) fitting after header in first block of a record
+
+///dentry cache defines
+#define MAX_DENTRIES 16384
+
 ///i-node defines
 #define I_NODE_SIZE 128
 #define DATA_OFFSET 0
-#define NAMES_OFFSET 112
-#define OTHER_OFFSET 120
-#define SIZE_OFFSET 120
-#define LINK_COUNT_OFFSET 124
-#define IS_DIRECTORY_OFFSET 126
-#define NAME_SIZE 8
-#define ADDRESS_SIZE 2
+#define SIZE_OFFSET 112
+#define LINK_COUNT_OFFSET 120
+#define IS_DIRECTORY_OFFSET 122
+#define CHUNK_BLOCKS_OFFSET 123
+#define IS_DEDUPLICATED_OFFSET 124
+#define RESERVED_OFFSET 125
+#define RESERVED_SIZE 3
+#define ADDRESS_SIZE 4
+#define N_I_NODE_ADDRESSES 28
+#define N_DIRECT_BLOCKS 26
+#define SINGLE_INDIRECT_SLOT 26
+#define DOUBLE_INDIRECT_SLOT 27
+#define ADDRESSES_PER_BLOCK (BLOCK_SIZE / ADDRESS_SIZE)
+#define NO_BLOCK 0      ///data block 0 always belongs to root directory, so in other files it marks a hole (block of zeros with nothing allocated)
 
 ///directory defines
 #define DIRECTORY_SIZE BLOCK_SIZE
@@ -34,10 +125,11 @@
 #define DIRECTORY_I_NUMBER_OFFSET 0
 #define DIRECTORY_NAME_OFFSET 2
 #define DIRECTORY_NAME_SIZE 14
-#define DIRECTORY_MAX_ENTRIES BLOCK_SIZE / DIRECTORY_ENTRY_SIZE
+#define DIRECTORY_ENTRIES_PER_BLOCK (BLOCK_SIZE / DIRECTORY_ENTRY_SIZE)   ///each block of a directory is one bucket of its hash table
 
 ///other
 #define BYTE_SIZE 8
+#define BITS_PER_WORD 64
 #define FREE 0
 #define USED 1
 #define MODE_CD 1
@@ -0,0 +1,132 @@
+///Name: DentryCache.cpp
+///Purpose: define methods from DentryCache class - in-memory results of directory lookups
+
+
+
+#include "DentryCache.h"
+
+#include <string.h>
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///function makes key of a lookup
+///parameters: i-number of directory, name of file
+///return value: key
+std::string DentryCache::makeKey(uint16_t directoryINumber, const char* fileName)
+{
+    std::string key((const char*)&directoryINumber, sizeof(directoryINumber));
+
+    key.append(fileName, strnlen(fileName, DIRECTORY_NAME_SIZE));   ///names are compared on DIRECTORY_NAME_SIZE characters
+    return key;
+}
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           public methods                                                                                                 *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///constructor
+DentryCache::DentryCache()
+{
+    nHits = 0;
+    nMisses = 0;
+}
+
+
+
+///function finds result of an earlier lookup
+///parameters: i-number of directory, name of file, i-number of file (output, -1 for negative entry), whether file is a directory (output)
+///return value: true if lookup is cached
+bool DentryCache::lookup(uint16_t directoryINumber, const char* fileName, short int& iNumber, bool& isDirectory)
+{
+    std::lock_guard<std::mutex> lock(dentryMutex);
+    std::unordered_map<std::string, Dentry>::iterator found = dentries.find(makeKey(directoryINumber, fileName));
+
+    if(dentries.end() == found)
+    {
+        ++nMisses;
+        return false;
+    }
+
+    ++nHits;
+    iNumber = found->second.iNumber;
+    isDirectory = found->second.isDirectory;
+    return true;
+}
+
+
+
+///function remembers result of a lookup
+///parameters: i-number of directory, name of file, i-number of file (-1 if not found), whether file is a directory
+void DentryCache::insert(uint16_t directoryINumber, const char* fileName, short int iNumber, bool isDirectory)
+{
+    Dentry dentry;
+    std::lock_guard<std::mutex> lock(dentryMutex);
+
+    if((int)dentries.size() >= MAX_DENTRIES)
+        dentries.clear();
+
+    dentry.iNumber = iNumber;
+    dentry.isDirectory = isDirectory;
+    dentries[makeKey(directoryINumber, fileName)] = dentry;
+}
+
+
+
+///function forgets result of a lookup
+///parameters: i-number of directory, name of file
+void DentryCache::invalidate(uint16_t directoryINumber, const char* fileName)
+{
+    std::lock_guard<std::mutex> lock(dentryMutex);
+    dentries.erase(makeKey(directoryINumber, fileName));
+}
+
+
+
+///function forgets every lookup
+void DentryCache::clear()
+{
+    std::lock_guard<std::mutex> lock(dentryMutex);
+    dentries.clear();
+}
+
+
+
+///function gets number of cached lookups
+///return value: number of entries
+int DentryCache::getNDentries()
+{
+    std::lock_guard<std::mutex> lock(dentryMutex);
+    return dentries.size();
+}
+
+
+
+///function gets number of lookups served from memory
+///return value: number of hits
+uint64_t DentryCache::getHits()
+{
+    std::lock_guard<std::mutex> lock(dentryMutex);
+    return nHits;
+}
+
+
+
+///function gets number of lookups which needed reading the directory
+///return value: number of misses
+uint64_t DentryCache::getMisses()
+{
+    std::lock_guard<std::mutex> lock(dentryMutex);
+    return nMisses;
+}
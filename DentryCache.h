@@ -0,0 +1,135 @@
+///Name: DentryCache.h
+///Purpose: declare and describe DentryCache class - in-memory results of directory lookups
+
+
+
+
+#ifndef DENTRYCACHE_H_INCLUDED
+#define DENTRYCACHE_H_INCLUDED
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <stdint.h>
+
+#include "Defines.h"
+
+
+
+
+/*********************************************************************
+ *                         DentryCache class                         *
+ *********************************************************************/
+/**
+        This class remembers results of looking names up in directories:
+        (i-number of directory, name) -> (i-number of file, whether it is
+        a directory). Names which were not found are remembered too, as
+        negative entries with i-number -1.
+
+        Entries are dropped by invalidate() whenever a directory entry with
+        that name is added or deleted. When MAX_DENTRIES entries are held,
+        the whole cache is cleared before adding another one.
+        Every method takes dentryMutex, so lookups in different directories
+        may run on several threads.
+**/
+
+
+class DentryCache
+{
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private attributes                                                                                             *
+ ********************************************************************************************************************************************************************************************/
+
+    struct Dentry
+    {
+        short int iNumber;                     ///i-number of file, -1 if there is no such file
+        bool isDirectory;                      ///whether file is a directory
+    };
+
+    std::unordered_map<std::string, Dentry> dentries; ///cached lookups, by key made from directory and name
+    uint64_t nHits;                            ///number of lookups served from memory
+    uint64_t nMisses;                          ///number of lookups which needed reading the directory
+    std::mutex dentryMutex;                    ///guards map and counters
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+    ///function makes key of a lookup
+    ///parameters: i-number of directory, name of file
+    ///return value: key
+    std::string makeKey(uint16_t directoryINumber, const char* fileName);
+
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                              public methods                                                                                              *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+public:
+
+    ///constructor
+    DentryCache();
+
+
+
+    ///function finds result of an earlier lookup
+    ///parameters: i-number of directory, name of file, i-number of file (output, -1 for negative entry), whether file is a directory (output)
+    ///return value: true if lookup is cached
+    bool lookup(uint16_t directoryINumber, const char* fileName, short int& iNumber, bool& isDirectory);
+
+
+
+    ///function remembers result of a lookup
+    ///parameters: i-number of directory, name of file, i-number of file (-1 if not found), whether file is a directory
+    void insert(uint16_t directoryINumber, const char* fileName, short int iNumber, bool isDirectory);
+
+
+
+    ///function forgets result of a lookup
+    ///parameters: i-number of directory, name of file
+    void invalidate(uint16_t directoryINumber, const char* fileName);
+
+
+
+    ///function forgets every lookup
+    void clear();
+
+
+
+    ///function gets number of cached lookups
+    ///return value: number of entries
+    int getNDentries();
+
+
+
+    ///function gets number of lookups served from memory
+    ///return value: number of hits
+    uint64_t getHits();
+
+
+
+    ///function gets number of lookups which needed reading the directory
+    ///return value: number of misses
+    uint64_t getMisses();
+
+
+
+};
+
+
+
+
+#endif // DENTRYCACHE_H_INCLUDED
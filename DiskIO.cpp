@@ -0,0 +1,720 @@
+///Name: DiskIO.cpp
+///Purpose: define methods from DiskIO class - access to the file implementing virtual disk
+
+
+
+#include "DiskIO.h"
+#include "Checksum.h"
+
+#include <iostream>
+#include <algorithm>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <errno.h>
+#include <limits.h>
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///function maps the whole image into memory
+///return value: -1 if could not map, else 0
+int DiskIO::mapFile()
+{
+    void* address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if(MAP_FAILED == address)
+    {
+        std::cerr << "Could not map virtual disk file into memory!\n";
+        mapping = NULL;
+        return -1;
+    }
+
+    mapping = (unsigned char*)address;
+    return 0;
+}
+
+
+
+///function unmaps the image
+void DiskIO::unmapFile()
+{
+    if(NULL != mapping)
+    {
+        munmap(mapping, size);
+        mapping = NULL;
+    }
+}
+
+
+
+///function turns block address into position within the image file
+///parameters: index of block, offset from start of block
+///return value: absolute position (in bytes)
+int64_t DiskIO::getPosition(int64_t blockIndex, int64_t offset)
+{
+    return blockIndex * BLOCK_SIZE + offset;
+}
+
+
+
+///function reads or writes bytes at a position of the image, repeating pread/pwrite until everything is transferred
+///parameters: whether to write, absolute position, buffer, number of bytes
+///return value: number of bytes transferred (less if end of file or error)
+int64_t DiskIO::transfer(bool write, int64_t position, void* buffer, int64_t nBytes)
+{
+    int64_t done = 0;
+    ssize_t result;
+
+    if(IO_MMAP == mode)     ///plain memory copy, only within the mapping
+    {
+        nBytes = std::max((int64_t)0, std::min(nBytes, size - position));
+        if(write)
+            memcpy(mapping + position, buffer, nBytes);
+        else
+            memcpy(buffer, mapping + position, nBytes);
+        return nBytes;
+    }
+
+    while(done < nBytes)    ///pread and pwrite may transfer less than asked
+    {
+        if(write)
+            result = pwrite(fd, (unsigned char*)buffer + done, nBytes - done, position + done);
+        else
+            result = pread(fd, (unsigned char*)buffer + done, nBytes - done, position + done);
+
+        if(-1 == result && EINTR == errno)
+            continue;
+        if(result <= 0)     ///end of file or error
+            break;
+        done += result;
+    }
+
+    return done;
+}
+
+
+
+///function reads or writes bytes at a position of the image from or to several buffers, with a single preadv/pwritev where possible
+///parameters: whether to write, absolute position, buffers, number of buffers
+///return value: number of bytes transferred (less if end of file or error)
+int64_t DiskIO::transferVector(bool write, int64_t position, const struct iovec* vectors, int nVectors)
+{
+    int64_t done = 0;
+    int64_t skipped = 0;    ///bytes of buffers before the current one
+    int64_t bufferEnd;
+
+    if(IO_MMAP != mode)
+    {
+        if(write)
+            done = pwritev(fd, vectors, std::min(nVectors, IOV_MAX), position);
+        else
+            done = preadv(fd, vectors, std::min(nVectors, IOV_MAX), position);
+        done = std::max(done, (int64_t)0);
+    }
+
+    ///whatever was not transferred at once (short transfer, more buffers than IOV_MAX, mapping) - buffer by buffer
+    for(int i = 0; i < nVectors; ++i)
+    {
+        bufferEnd = skipped + vectors[i].iov_len;
+        if(bufferEnd > done)
+        {
+            done += transfer(write, position + done, (unsigned char*)vectors[i].iov_base + (done - skipped), bufferEnd - done);
+            if(done != bufferEnd)   ///end of file or error
+                break;
+        }
+        skipped = bufferEnd;
+    }
+
+    return done;
+}
+
+
+
+///function tells whether a block has a checksum
+///parameters: index of block
+///return value: true if checksums are kept and the block is neither the superblock nor a block of the table
+bool DiskIO::isChecksummed(int64_t blockIndex)
+{
+    return NULL != checksums && blockIndex > SUPERBLOCK_INDEX && blockIndex < nChecksummedBlocks
+           && (blockIndex < checksumTableIndex || blockIndex >= checksumTableIndex + nChecksumTableBlocks);
+}
+
+
+
+///function locks blocks at both ends of a transfer which it covers partly - their checksums depend on bytes outside of it too
+///parameters: absolute position, number of bytes, lock of first block, lock of last block (left empty if not needed)
+void DiskIO::lockPartialBlocks(int64_t position, int64_t nBytes, std::unique_lock<std::mutex>& firstLock, std::unique_lock<std::mutex>& lastLock)
+{
+    int64_t firstBlock = position / BLOCK_SIZE;
+    int64_t lastBlock = (position + nBytes - 1) / BLOCK_SIZE;
+    int first = -1;
+    int last = -1;
+
+    if(nBytes <= 0)
+        return;
+
+    if(0 != position % BLOCK_SIZE || (firstBlock == lastBlock && 0 != (position + nBytes) % BLOCK_SIZE))
+        first = (int)(firstBlock % CHECKSUM_LOCKS);
+    if(firstBlock != lastBlock && 0 != (position + nBytes) % BLOCK_SIZE)
+        last = (int)(lastBlock % CHECKSUM_LOCKS);
+
+    ///taken in order of their indexes, so two transfers never wait for each other
+    if(first == last)
+        last = -1;
+    if(-1 != first && -1 != last && last < first)
+        std::swap(first, last);
+    if(-1 == first)
+        std::swap(first, last);
+
+    if(-1 != first)
+        firstLock = std::unique_lock<std::mutex>(checksumLocks[first]);
+    if(-1 != last)
+        lastLock = std::unique_lock<std::mutex>(checksumLocks[last]);
+}
+
+
+
+///function computes checksums of blocks touched by bytes of buffers, taking the rest of partly covered blocks from the image, and stores them or compares them with the table
+///parameters: whether to store checksums (else compare), absolute position, buffers, number of buffers, number of bytes
+///return value: index of first block which does not match its checksum, -1 if none (or if storing)
+int64_t DiskIO::processChecksums(bool store, int64_t position, const struct iovec* vectors, int nVectors, int64_t nBytes)
+{
+    unsigned char* blockBytes = NULL;   ///partly covered block as it is in the image
+    int64_t blockIndex;
+    int64_t blockOffset;
+    int64_t covered;
+    int64_t length;
+    int64_t vectorOffset = 0;          ///position within current buffer
+    int64_t damagedBlock = -1;
+    int vector = 0;
+    bool hasChecksum;
+    uint32_t crc;
+
+    for(int64_t done = 0; done < nBytes && -1 == damagedBlock; done += covered)
+    {
+        blockIndex = (position + done) / BLOCK_SIZE;
+        blockOffset = (position + done) % BLOCK_SIZE;
+        covered = std::min((int64_t)BLOCK_SIZE - blockOffset, nBytes - done);
+        hasChecksum = isChecksummed(blockIndex);
+
+        crc = 0;
+        if(hasChecksum && covered < BLOCK_SIZE)
+        {
+            if(NULL == blockBytes)
+                blockBytes = new unsigned char [BLOCK_SIZE];
+            transfer(false, blockIndex * BLOCK_SIZE, blockBytes, BLOCK_SIZE);
+            crc = Checksum::update(crc, blockBytes, blockOffset);
+        }
+
+        ///bytes of the block within the buffers - buffers are walked even for blocks without checksum
+        for(int64_t taken = 0; taken < covered && vector < nVectors; )
+        {
+            length = std::min(covered - taken, (int64_t)vectors[vector].iov_len - vectorOffset);
+            if(hasChecksum)
+                crc = Checksum::update(crc, (unsigned char*)vectors[vector].iov_base + vectorOffset, length);
+            taken += length;
+            vectorOffset += length;
+            if(vectorOffset == (int64_t)vectors[vector].iov_len)
+            {
+                ++vector;
+                vectorOffset = 0;
+            }
+        }
+
+        if(!hasChecksum)
+            continue;
+        if(covered < BLOCK_SIZE)
+            crc = Checksum::update(crc, blockBytes + blockOffset + covered, BLOCK_SIZE - blockOffset - covered);
+        crc ^= zeroBlockChecksum;
+
+        if(store)
+            __atomic_store_n(&checksums[blockIndex], crc, __ATOMIC_RELAXED);
+        else if(crc != __atomic_load_n(&checksums[blockIndex], __ATOMIC_RELAXED))
+            damagedBlock = blockIndex;
+    }
+
+    delete [] blockBytes;
+    return damagedBlock;
+}
+
+
+
+///function reads or writes like transferVector(), keeping checksums of written blocks and checking those of read blocks
+///parameters: whether to write, absolute position, buffers, number of buffers
+///return value: number of bytes transferred (less if end of file, error, or if a block read does not match its checksum)
+int64_t DiskIO::checkedTransfer(bool write, int64_t position, const struct iovec* vectors, int nVectors)
+{
+    std::unique_lock<std::mutex> firstLock;
+    std::unique_lock<std::mutex> lastLock;
+    std::vector<int64_t> unreadable;
+    int64_t nBytes = 0;
+    int64_t done;
+    int64_t damagedBlock;
+
+    if(NULL == checksums)
+        return transferVector(write, position, vectors, nVectors);
+
+    for(int i = 0; i < nVectors; ++i)
+        nBytes += vectors[i].iov_len;
+    lockPartialBlocks(position, nBytes, firstLock, lastLock);
+
+    if(write)
+    {
+        processChecksums(true, position, vectors, nVectors, nBytes);
+        done = transferVector(true, position, vectors, nVectors);
+        if(done != nBytes && nBytes > 0)    ///not everything reached the image - checksums of its blocks follow what did
+            checkBlocks(position / BLOCK_SIZE, (position + nBytes - 1) / BLOCK_SIZE - position / BLOCK_SIZE + 1, true, unreadable);
+        return done;
+    }
+
+    done = transferVector(false, position, vectors, nVectors);
+    damagedBlock = processChecksums(false, position, vectors, nVectors, done);
+    if(-1 != damagedBlock)
+    {
+        std::cerr << "Block " << damagedBlock << " of virtual disk does not match its checksum!\n";
+        done = std::max((int64_t)0, damagedBlock * BLOCK_SIZE - position);
+    }
+
+    return done;
+}
+
+
+
+///function checks bytes of the image against checksums of their blocks where they are, without copying them
+///parameters: absolute position, number of bytes
+///return value: number of bytes before first block which does not match its checksum (or cannot be read)
+int64_t DiskIO::checkInPlace(int64_t position, int64_t nBytes)
+{
+    std::unique_lock<std::mutex> firstLock;
+    std::unique_lock<std::mutex> lastLock;
+    struct iovec vector;
+    unsigned char* buffer = NULL;
+    void* address = MAP_FAILED;
+    int64_t pageSize = sysconf(_SC_PAGESIZE);
+    int64_t mapStart = position / pageSize * pageSize;
+    int64_t damagedBlock;
+
+    nBytes = std::max((int64_t)0, std::min(nBytes, size - position));   ///a mapping past the end of the image would fault
+    if(NULL == checksums || 0 == nBytes)
+        return nBytes;
+
+    ///bytes are looked at in the page cache - read into a buffer only if the part cannot be mapped
+    if(IO_MMAP == mode)
+        vector.iov_base = mapping + position;
+    else if(MAP_FAILED != (address = mmap(NULL, position + nBytes - mapStart, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, mapStart)))
+        vector.iov_base = (unsigned char*)address + (position - mapStart);
+    else
+    {
+        buffer = new unsigned char [nBytes];
+        nBytes = transfer(false, position, buffer, nBytes);
+        vector.iov_base = buffer;
+    }
+    vector.iov_len = nBytes;
+
+    lockPartialBlocks(position, nBytes, firstLock, lastLock);
+    damagedBlock = processChecksums(false, position, &vector, 1, nBytes);
+    if(-1 != damagedBlock)
+    {
+        std::cerr << "Block " << damagedBlock << " of virtual disk does not match its checksum!\n";
+        nBytes = std::max((int64_t)0, damagedBlock * BLOCK_SIZE - position);
+    }
+
+    if(MAP_FAILED != address)
+        munmap(address, (size_t)(vector.iov_len + position - mapStart));
+    delete [] buffer;
+    return nBytes;
+}
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           public methods                                                                                                 *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///constructor
+DiskIO::DiskIO()
+{
+    fd = -1;
+    mode = IO_PREAD;
+    mapping = NULL;
+    size = 0;
+    checksums = NULL;
+    nChecksummedBlocks = 0;
+    checksumTableIndex = 0;
+    nChecksumTableBlocks = 0;
+    zeroBlockChecksum = 0;
+}
+
+
+
+///function opens the image, creating it if it does not exist
+///parameters: name of the image file, backend to use (IO_PREAD or IO_MMAP)
+///return value: -1 if could not open, else 0
+int DiskIO::openFile(char* fileName, int newMode)
+{
+    struct stat fileStatus;
+
+    fd = open(fileName, O_RDWR | O_CREAT, 0666);    ///created if it does not exist
+    if(-1 == fd)
+        return -1;
+
+    mode = newMode;
+
+    fstat(fd, &fileStatus);
+    size = fileStatus.st_size;
+
+    if(IO_MMAP == mode && size > 0)   ///existing image - map it right away, so its header can be read
+        return mapFile();
+
+    return 0;
+}
+
+
+
+///function flushes and closes the image
+void DiskIO::closeFile()
+{
+    if(-1 == fd)
+        return;
+
+    flush();
+    unmapFile();
+    close(fd);
+    fd = -1;
+    delete [] checksums;
+    checksums = NULL;
+}
+
+
+
+///function discards contents of the image and sets its size, every byte reads as zero afterwards, then (re)maps it if needed
+///parameters: new size of the image (in bytes)
+///return value: -1 on failure, else 0
+int DiskIO::resetFile(int64_t newSize)
+{
+    struct statvfs fileSystemStatus;
+    bool reserved = false;
+
+    unmapFile();
+
+    if(-1 == ftruncate(fd, 0))
+    {
+        std::cerr << "Could not resize virtual disk file!\n";
+        return -1;
+    }
+
+    ///reserve space up front if there is enough, so the image is not fragmented and cannot run out of space later - otherwise sparse file
+    if(0 == fstatvfs(fd, &fileSystemStatus) && (int64_t)(fileSystemStatus.f_bavail * fileSystemStatus.f_frsize) > newSize)
+        reserved = (0 == fallocate(fd, 0, 0, newSize));
+
+    if(!reserved && -1 == ftruncate(fd, newSize))
+    {
+        std::cerr << "Could not resize virtual disk file!\n";
+        return -1;
+    }
+    size = newSize;
+
+    if(IO_MMAP == mode)
+        return mapFile();
+
+    return 0;
+}
+
+
+
+///function gets current size of the image
+///return value: size of the image (in bytes)
+int64_t DiskIO::getSize()
+{
+    return size;
+}
+
+
+
+///function gets backend in use
+///return value: IO_PREAD or IO_MMAP
+int DiskIO::getMode()
+{
+    return mode;
+}
+
+
+
+///function reads bytes from the image
+///parameters: index of block, offset from start of block, destination buffer, number of bytes
+///return value: number of bytes read (up to first block which does not match its checksum)
+int DiskIO::readBytes(int64_t blockIndex, int64_t offset, void* destination, int nBytes)
+{
+    struct iovec vector = {destination, (size_t)nBytes};
+
+    return (int)checkedTransfer(false, getPosition(blockIndex, offset), &vector, 1);
+}
+
+
+
+///function writes bytes to the image
+///parameters: index of block, offset from start of block, source buffer, number of bytes
+///return value: number of bytes written
+int DiskIO::writeBytes(int64_t blockIndex, int64_t offset, const void* source, int nBytes)
+{
+    struct iovec vector = {(void*)source, (size_t)nBytes};
+
+    return (int)checkedTransfer(true, getPosition(blockIndex, offset), &vector, 1);
+}
+
+
+
+///function reads neighbouring bytes of the image into several buffers with a single access
+///parameters: index of block, offset from start of block, destination buffers, number of buffers
+///return value: number of bytes read (up to first block which does not match its checksum)
+int64_t DiskIO::readVector(int64_t blockIndex, int64_t offset, const struct iovec* vectors, int nVectors)
+{
+    return checkedTransfer(false, getPosition(blockIndex, offset), vectors, nVectors);
+}
+
+
+
+///function writes several buffers to neighbouring bytes of the image with a single access
+///parameters: index of block, offset from start of block, source buffers, number of buffers
+///return value: number of bytes written
+int64_t DiskIO::writeVector(int64_t blockIndex, int64_t offset, const struct iovec* vectors, int nVectors)
+{
+    return checkedTransfer(true, getPosition(blockIndex, offset), vectors, nVectors);
+}
+
+
+
+///function copies bytes from the image into another file without passing them through user-space buffers where possible
+///parameters: index of block, offset from start of block, descriptor of destination file, offset within destination file, number of bytes
+///return value: number of bytes copied (up to first block which does not match its checksum)
+int64_t DiskIO::copyToFile(int64_t blockIndex, int64_t offset, int destinationFd, int64_t destinationOffset, int64_t nBytes)
+{
+    int64_t position = getPosition(blockIndex, offset);
+    loff_t sourceOffset = position;
+    loff_t targetOffset = destinationOffset;
+    off_t sendOffset;
+    int64_t copied = 0;
+    ssize_t result = -1;
+    unsigned char* buffer;
+
+    ///damaged block and anything after it is not copied
+    nBytes = checkInPlace(position, nBytes);
+
+    ///copy inside the kernel, possibly sharing extents on file systems which support it
+    while(copied < nBytes)
+    {
+        result = copy_file_range(fd, &sourceOffset, destinationFd, &targetOffset, nBytes - copied, 0);
+        if(result <= 0)
+            break;
+        copied += result;
+    }
+    if(copied == nBytes || 0 == result)
+        return copied;
+
+    ///not supported for these files (old kernel, different file systems, pipe) - copy through the page cache
+    lseek(destinationFd, destinationOffset + copied, SEEK_SET);    ///fails harmlessly for pipes, which have no position
+    sendOffset = position + copied;
+    while(copied < nBytes)
+    {
+        result = sendfile(destinationFd, fd, &sendOffset, nBytes - copied);
+        if(result <= 0)
+            break;
+        copied += result;
+    }
+    if(copied == nBytes || 0 == result)
+        return copied;
+
+    ///last resort - through a buffer
+    buffer = new unsigned char [MAX_TRANSFER_BLOCKS * BLOCK_SIZE];
+    while(copied < nBytes)
+    {
+        result = pread(fd, buffer, std::min(nBytes - copied, (int64_t)MAX_TRANSFER_BLOCKS * BLOCK_SIZE), position + copied);
+        if(result <= 0 || result != pwrite(destinationFd, buffer, result, destinationOffset + copied))
+            break;
+        copied += result;
+    }
+    delete [] buffer;
+
+    return copied;
+}
+
+
+
+///function starts reading bytes from the image without waiting, completion is collected from the queue (checksums are checked by verifyBytes() then)
+///parameters: queue of transfers, index of block, offset from start of block, destination buffer, number of bytes, value handed back on completion
+///return value: -1 if queue is full, else 0
+int DiskIO::submitRead(AsyncIO& queue, int64_t blockIndex, int64_t offset, void* destination, int nBytes, uint64_t tag)
+{
+    return queue.submit(fd, false, destination, getPosition(blockIndex, offset), nBytes, tag);
+}
+
+
+
+///function starts writing bytes to the image without waiting, completion is collected from the queue (checksums are stored right away)
+///parameters: queue of transfers, index of block, offset from start of block, source buffer, number of bytes, value handed back on completion
+///return value: -1 if queue is full, else 0
+int DiskIO::submitWrite(AsyncIO& queue, int64_t blockIndex, int64_t offset, const void* source, int nBytes, uint64_t tag)
+{
+    struct iovec vector = {(void*)source, (size_t)nBytes};
+
+    ///data stays in the buffer until the write completes, so its checksums hold once it is written
+    if(NULL != checksums)
+    {
+        std::unique_lock<std::mutex> firstLock;
+        std::unique_lock<std::mutex> lastLock;
+        lockPartialBlocks(getPosition(blockIndex, offset), nBytes, firstLock, lastLock);
+        processChecksums(true, getPosition(blockIndex, offset), &vector, 1, nBytes);
+    }
+
+    return queue.submit(fd, true, (void*)source, getPosition(blockIndex, offset), nBytes, tag);
+}
+
+
+
+///function starts keeping checksums of written blocks and checking read ones, with a table of zeros (right for an image of zeros)
+///parameters: index of first block of the table on the disk, number of blocks of the file system
+void DiskIO::setChecksumTable(int64_t firstTableBlock, int64_t nBlocks)
+{
+    unsigned char* zeros = new unsigned char [BLOCK_SIZE]();
+
+    delete [] checksums;
+    zeroBlockChecksum = Checksum::compute(zeros, BLOCK_SIZE);
+    nChecksummedBlocks = nBlocks;
+    checksumTableIndex = firstTableBlock;
+    nChecksumTableBlocks = (nBlocks + CHECKSUMS_PER_BLOCK - 1) / CHECKSUMS_PER_BLOCK;
+    checksums = new uint32_t [nChecksumTableBlocks * CHECKSUMS_PER_BLOCK]();
+    delete [] zeros;
+}
+
+
+
+///function reads checksum table from its place on the disk
+///parameters: CRC32C of the table when it was written
+///return value: -1 if the table could not be read or does not match the CRC, else 0
+int DiskIO::loadChecksumTable(uint32_t tableChecksum)
+{
+    int64_t nBytes = nChecksumTableBlocks * BLOCK_SIZE;
+
+    if(nBytes != transfer(false, getPosition(checksumTableIndex, 0), checksums, nBytes) || tableChecksum != Checksum::compute(checksums, nBytes))
+        return -1;
+
+    return 0;
+}
+
+
+
+///function writes checksum table to its place on the disk
+///return value: CRC32C of the table
+uint32_t DiskIO::storeChecksumTable()
+{
+    int64_t nBytes = nChecksumTableBlocks * BLOCK_SIZE;
+
+    transfer(true, getPosition(checksumTableIndex, 0), checksums, nBytes);   ///table which did not make it is noticed by its CRC
+    return Checksum::compute(checksums, nBytes);
+}
+
+
+
+///function checks blocks against their checksums, or computes their checksums anew (nothing else may write them meanwhile)
+///parameters: index of first block, number of blocks, whether to compute checksums instead of checking them, blocks which do not match or could not be read (output, added to)
+void DiskIO::checkBlocks(int64_t firstBlock, int64_t nBlocks, bool recompute, std::vector<int64_t>& damagedBlocks)
+{
+    unsigned char* buffer = NULL;
+    unsigned char* data;
+    int64_t count;
+    int64_t nRead;
+    uint32_t crc;
+
+    if(NULL == checksums)
+        return;
+    nBlocks = std::min(nBlocks, nChecksummedBlocks - firstBlock);
+    if(IO_MMAP != mode)
+        buffer = new unsigned char [std::min(nBlocks, (int64_t)SCRUB_CHUNK_BLOCKS) * BLOCK_SIZE];
+
+    for(int64_t i = 0; i < nBlocks; i += count)
+    {
+        count = std::min(nBlocks - i, (int64_t)SCRUB_CHUNK_BLOCKS);
+
+        ///mapped image is checked where it is, without copying - a block written meanwhile may look damaged, as with pread(), so caller checks again
+        if(IO_MMAP == mode)
+        {
+            data = mapping + getPosition(firstBlock + i, 0);
+            nRead = std::min(count * BLOCK_SIZE, size - getPosition(firstBlock + i, 0));
+        }
+        else
+        {
+            data = buffer;
+            nRead = transfer(false, getPosition(firstBlock + i, 0), buffer, count * BLOCK_SIZE);
+        }
+
+        for(int64_t j = 0; j < count; ++j)
+        {
+            if(!isChecksummed(firstBlock + i + j))
+                continue;
+            if((j + 1) * BLOCK_SIZE > nRead)    ///could not be read
+            {
+                damagedBlocks.push_back(firstBlock + i + j);
+                continue;
+            }
+
+            crc = Checksum::compute(data + j * BLOCK_SIZE, BLOCK_SIZE) ^ zeroBlockChecksum;
+            if(recompute)
+                __atomic_store_n(&checksums[firstBlock + i + j], crc, __ATOMIC_RELAXED);
+            else if(crc != __atomic_load_n(&checksums[firstBlock + i + j], __ATOMIC_RELAXED))
+                damagedBlocks.push_back(firstBlock + i + j);
+        }
+    }
+
+    delete [] buffer;
+}
+
+
+
+///function checks bytes which were read without DiskIO waiting for them (submitRead()) against checksums of their blocks
+///parameters: index of block, offset from start of block, bytes read, number of bytes
+///return value: -1 if a block does not match its checksum, else 0
+int DiskIO::verifyBytes(int64_t blockIndex, int64_t offset, const void* data, int nBytes)
+{
+    struct iovec vector = {(void*)data, (size_t)nBytes};
+    std::unique_lock<std::mutex> firstLock;
+    std::unique_lock<std::mutex> lastLock;
+
+    if(NULL == checksums)
+        return 0;
+
+    lockPartialBlocks(getPosition(blockIndex, offset), nBytes, firstLock, lastLock);
+    return -1 == processChecksums(false, getPosition(blockIndex, offset), &vector, 1, nBytes) ? 0 : -1;
+}
+
+
+
+///function pushes all written data to the image file (nothing to do for pread/pwrite, msync for the mapping)
+void DiskIO::flush()
+{
+    if(NULL != mapping)
+        msync(mapping, size, MS_SYNC);
+}
+
+
+
+///function makes everything written so far durable - flushes the mapping and waits until data reaches the storage
+///return value: -1 on failure, else 0
+int DiskIO::sync()
+{
+    flush();
+    return fdatasync(fd);
+}
@@ -0,0 +1,306 @@
+///Name: DiskIO.h
+///Purpose: declare and describe DiskIO class - access to the file implementing virtual disk
+
+
+
+
+#ifndef DISKIO_H_INCLUDED
+#define DISKIO_H_INCLUDED
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <vector>
+#include <mutex>
+
+#include "Defines.h"
+#include "AsyncIO.h"
+
+
+
+
+/*********************************************************************
+ *                            DiskIO class                           *
+ *********************************************************************/
+/**
+        This class handles every access to the file on user system
+        which implements the virtual disk. Two backends are available:
+
+        IO_PREAD -> pread/pwrite (preadv/pwritev for several buffers) on a
+                    file descriptor - no shared file position, no buffering
+        IO_MMAP  -> whole image mapped into memory, reads and writes are
+                    plain memory copies, msync on flush
+
+        Every access is addressed by (index of block, offset from start of
+        the block); the offset may go past the end of the block, following
+        blocks are accessed then. This is the only place where block
+        addresses are turned into positions within the image file.
+
+        copyToFile() moves bytes from the image straight into another file,
+        with copy_file_range when the kernel supports it for the two files,
+        else with sendfile, else with pread and pwrite through a buffer.
+        Their blocks are checked against checksums where they are - in the
+        mapping, else in a read-only mapping of the part of the image - so
+        checking takes no copy either.
+
+        submitRead() and submitWrite() hand transfers over to an AsyncIO
+        queue, so many of them can be in flight at once. They go through
+        the file descriptor with either backend; the mapping is shared, so
+        it sees their data.
+
+        Once a checksum table is set, every block but the superblock and
+        the table itself has a CRC32C kept in memory: writes store the CRC
+        of each block they touch (bytes of a partly written block which
+        stay are read from the image), reads compare the CRC of each block
+        they touch and stop short before a block which does not match.
+        The table is written to its place on the disk only when the disk is
+        closed - after a crash it is computed anew from the blocks. CRCs are
+        kept XOR-ed with the CRC of a block of zeros, so a table of zeros
+        fits an image of zeros and a new image needs no table written.
+
+        Methods may be called from several threads without locking, as
+        neither backend has a file position or buffer shared between calls.
+        Only blocks a transfer covers partly are locked (CHECKSUM_LOCKS
+        locks, by block index), so their CRC follows the last write.
+**/
+
+
+class DiskIO
+{
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private attributes                                                                                             *
+ ********************************************************************************************************************************************************************************************/
+
+    int fd;                                    ///file descriptor of the image
+    int mode;                                  ///backend in use (IO_PREAD or IO_MMAP)
+    unsigned char* mapping;                    ///mapped image (IO_MMAP backend only)
+    int64_t size;                              ///size of the image (in bytes)
+
+    uint32_t* checksums;                       ///CRC32C of every block XOR-ed with zeroBlockChecksum, NULL if blocks are not checksummed
+    int64_t nChecksummedBlocks;                ///number of blocks of the file system
+    int64_t checksumTableIndex;                ///index of first block of the table on the disk
+    int64_t nChecksumTableBlocks;              ///size of the table on the disk (in blocks)
+    uint32_t zeroBlockChecksum;                ///CRC32C of a block of zeros
+    std::mutex checksumLocks[CHECKSUM_LOCKS];  ///held while a partly covered block is transferred and checksummed
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+    ///function maps the whole image into memory
+    ///return value: -1 if could not map, else 0
+    int mapFile();
+
+
+
+    ///function unmaps the image
+    void unmapFile();
+
+
+
+    ///function turns block address into position within the image file
+    ///parameters: index of block, offset from start of block
+    ///return value: absolute position (in bytes)
+    int64_t getPosition(int64_t blockIndex, int64_t offset);
+
+
+
+    ///function reads or writes bytes at a position of the image, repeating pread/pwrite until everything is transferred
+    ///parameters: whether to write, absolute position, buffer, number of bytes
+    ///return value: number of bytes transferred (less if end of file or error)
+    int64_t transfer(bool write, int64_t position, void* buffer, int64_t nBytes);
+
+
+
+    ///function reads or writes bytes at a position of the image from or to several buffers, with a single preadv/pwritev where possible
+    ///parameters: whether to write, absolute position, buffers, number of buffers
+    ///return value: number of bytes transferred (less if end of file or error)
+    int64_t transferVector(bool write, int64_t position, const struct iovec* vectors, int nVectors);
+
+
+
+    ///function tells whether a block has a checksum
+    ///parameters: index of block
+    ///return value: true if checksums are kept and the block is neither the superblock nor a block of the table
+    bool isChecksummed(int64_t blockIndex);
+
+
+
+    ///function locks blocks at both ends of a transfer which it covers partly - their checksums depend on bytes outside of it too
+    ///parameters: absolute position, number of bytes, lock of first block, lock of last block (left empty if not needed)
+    void lockPartialBlocks(int64_t position, int64_t nBytes, std::unique_lock<std::mutex>& firstLock, std::unique_lock<std::mutex>& lastLock);
+
+
+
+    ///function computes checksums of blocks touched by bytes of buffers, taking the rest of partly covered blocks from the image, and stores them or compares them with the table
+    ///parameters: whether to store checksums (else compare), absolute position, buffers, number of buffers, number of bytes
+    ///return value: index of first block which does not match its checksum, -1 if none (or if storing)
+    int64_t processChecksums(bool store, int64_t position, const struct iovec* vectors, int nVectors, int64_t nBytes);
+
+
+
+    ///function reads or writes like transferVector(), keeping checksums of written blocks and checking those of read blocks
+    ///parameters: whether to write, absolute position, buffers, number of buffers
+    ///return value: number of bytes transferred (less if end of file, error, or if a block read does not match its checksum)
+    int64_t checkedTransfer(bool write, int64_t position, const struct iovec* vectors, int nVectors);
+
+
+
+    ///function checks bytes of the image against checksums of their blocks where they are, without copying them
+    ///parameters: absolute position, number of bytes
+    ///return value: number of bytes before first block which does not match its checksum (or cannot be read)
+    int64_t checkInPlace(int64_t position, int64_t nBytes);
+
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                              public methods                                                                                              *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+public:
+
+    ///constructor
+    DiskIO();
+
+
+
+    ///function opens the image, creating it if it does not exist
+    ///parameters: name of the image file, backend to use (IO_PREAD or IO_MMAP)
+    ///return value: -1 if could not open, else 0
+    int openFile(char* fileName, int newMode);
+
+
+
+    ///function flushes and closes the image
+    void closeFile();
+
+
+
+    ///function discards contents of the image and sets its size, every byte reads as zero afterwards, then (re)maps it if needed
+    ///parameters: new size of the image (in bytes)
+    ///return value: -1 on failure, else 0
+    int resetFile(int64_t newSize);
+
+
+
+    ///function gets current size of the image
+    ///return value: size of the image (in bytes)
+    int64_t getSize();
+
+
+
+    ///function gets backend in use
+    ///return value: IO_PREAD or IO_MMAP
+    int getMode();
+
+
+
+    ///function reads bytes from the image
+    ///parameters: index of block, offset from start of block, destination buffer, number of bytes
+    ///return value: number of bytes read (up to first block which does not match its checksum)
+    int readBytes(int64_t blockIndex, int64_t offset, void* destination, int nBytes);
+
+
+
+    ///function writes bytes to the image
+    ///parameters: index of block, offset from start of block, source buffer, number of bytes
+    ///return value: number of bytes written
+    int writeBytes(int64_t blockIndex, int64_t offset, const void* source, int nBytes);
+
+
+
+    ///function reads neighbouring bytes of the image into several buffers with a single access
+    ///parameters: index of block, offset from start of block, destination buffers, number of buffers
+    ///return value: number of bytes read (up to first block which does not match its checksum)
+    int64_t readVector(int64_t blockIndex, int64_t offset, const struct iovec* vectors, int nVectors);
+
+
+
+    ///function writes several buffers to neighbouring bytes of the image with a single access
+    ///parameters: index of block, offset from start of block, source buffers, number of buffers
+    ///return value: number of bytes written
+    int64_t writeVector(int64_t blockIndex, int64_t offset, const struct iovec* vectors, int nVectors);
+
+
+
+    ///function copies bytes from the image into another file without passing them through user-space buffers where possible
+    ///parameters: index of block, offset from start of block, descriptor of destination file, offset within destination file, number of bytes
+    ///return value: number of bytes copied (up to first block which does not match its checksum)
+    int64_t copyToFile(int64_t blockIndex, int64_t offset, int destinationFd, int64_t destinationOffset, int64_t nBytes);
+
+
+
+    ///function starts reading bytes from the image without waiting, completion is collected from the queue (checksums are checked by verifyBytes() then)
+    ///parameters: queue of transfers, index of block, offset from start of block, destination buffer, number of bytes, value handed back on completion
+    ///return value: -1 if queue is full, else 0
+    int submitRead(AsyncIO& queue, int64_t blockIndex, int64_t offset, void* destination, int nBytes, uint64_t tag);
+
+
+
+    ///function starts writing bytes to the image without waiting, completion is collected from the queue (checksums are stored right away)
+    ///parameters: queue of transfers, index of block, offset from start of block, source buffer, number of bytes, value handed back on completion
+    ///return value: -1 if queue is full, else 0
+    int submitWrite(AsyncIO& queue, int64_t blockIndex, int64_t offset, const void* source, int nBytes, uint64_t tag);
+
+
+
+    ///function starts keeping checksums of written blocks and checking read ones, with a table of zeros (right for an image of zeros)
+    ///parameters: index of first block of the table on the disk, number of blocks of the file system
+    void setChecksumTable(int64_t firstTableBlock, int64_t nBlocks);
+
+
+
+    ///function reads checksum table from its place on the disk
+    ///parameters: CRC32C of the table when it was written
+    ///return value: -1 if the table could not be read or does not match the CRC, else 0
+    int loadChecksumTable(uint32_t tableChecksum);
+
+
+
+    ///function writes checksum table to its place on the disk
+    ///return value: CRC32C of the table
+    uint32_t storeChecksumTable();
+
+
+
+    ///function checks blocks against their checksums, or computes their checksums anew (nothing else may write them meanwhile)
+    ///parameters: index of first block, number of blocks, whether to compute checksums instead of checking them, blocks which do not match or could not be read (output, added to)
+    void checkBlocks(int64_t firstBlock, int64_t nBlocks, bool recompute, std::vector<int64_t>& damagedBlocks);
+
+
+
+    ///function checks bytes which were read without DiskIO waiting for them (submitRead()) against checksums of their blocks
+    ///parameters: index of block, offset from start of block, bytes read, number of bytes
+    ///return value: -1 if a block does not match its checksum, else 0
+    int verifyBytes(int64_t blockIndex, int64_t offset, const void* data, int nBytes);
+
+
+
+    ///function pushes all written data to the image file (nothing to do for pread/pwrite, msync for the mapping)
+    void flush();
+
+
+
+    ///function makes everything written so far durable - flushes the mapping and waits until data reaches the storage
+    ///return value: -1 on failure, else 0
+    int sync();
+
+
+
+};
+
+
+
+
+#endif // DISKIO_H_INCLUDED
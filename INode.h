@@ -0,0 +1,60 @@
+///Name: INode.h
+///Purpose: declare INode structure - on-disk layout of a single i-node
+
+
+
+
+#ifndef INODE_H_INCLUDED
+#define INODE_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Defines.h"
+
+
+
+
+/*********************************************************************
+ *                          INode structure                          *
+ *********************************************************************/
+/**
+        Exact copy of an i-node as stored in the i-node table, so it can be
+        read and written with a single access. Fields follow offsets from
+        Defines.h:
+
+        DATA_OFFSET         -> 32-bit addresses of data blocks: N_DIRECT_BLOCKS direct ones,
+                               then single indirect and double indirect block
+        SIZE_OFFSET         -> 64-bit size of file (in bytes)
+        LINK_COUNT_OFFSET   -> number of directory entries pointing to the file
+        IS_DIRECTORY_OFFSET -> whether the file is a directory
+        CHUNK_BLOCKS_OFFSET -> number of blocks in a chunk of a compressed file, 0 if file is not compressed
+        IS_DEDUPLICATED_OFFSET -> whether blocks of the file may be shared with other files
+        RESERVED_OFFSET     -> reserved
+**/
+
+
+struct INode
+{
+    uint32_t data[N_I_NODE_ADDRESSES];         ///addresses of data blocks
+    uint64_t size;                             ///size of file (in bytes)
+    uint16_t linkCount;                        ///link count
+    bool isDirectory;                          ///true if file is a directory
+    uint8_t chunkBlocks;                       ///blocks in a chunk of a compressed file, 0 if not compressed
+    bool isDeduplicated;                       ///true if file was copied with deduplication - its blocks are never written in place
+    uint8_t reserved[RESERVED_SIZE];           ///reserved
+} __attribute__((packed));
+
+
+static_assert(sizeof(INode) == I_NODE_SIZE, "INode must match on-disk i-node size");
+static_assert(offsetof(INode, size) == SIZE_OFFSET, "INode size field misplaced");
+static_assert(offsetof(INode, linkCount) == LINK_COUNT_OFFSET, "INode link count field misplaced");
+static_assert(offsetof(INode, isDirectory) == IS_DIRECTORY_OFFSET, "INode directory flag misplaced");
+static_assert(offsetof(INode, chunkBlocks) == CHUNK_BLOCKS_OFFSET, "INode chunk size field misplaced");
+static_assert(offsetof(INode, isDeduplicated) == IS_DEDUPLICATED_OFFSET, "INode deduplication flag misplaced");
+static_assert(offsetof(INode, reserved) == RESERVED_OFFSET, "INode reserved bytes misplaced");
+
+
+
+
+#endif // INODE_H_INCLUDED
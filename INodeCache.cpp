@@ -0,0 +1,137 @@
+///Name: INodeCache.cpp
+///Purpose: define methods from INodeCache class - in-memory copies of i-nodes with dirty tracking
+
+
+
+#include "INodeCache.h"
+
+#include <string.h>
+#include <algorithm>
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           public methods                                                                                                 *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///constructor
+INodeCache::INodeCache()
+{
+    diskIO = NULL;
+    firstTableBlock = 0;
+}
+
+
+
+///function prepares cache for i-node table of a disk
+///parameters: access to the virtual disk file, index of first block of i-node table, number of i-nodes
+void INodeCache::setTable(DiskIO* newDiskIO, int64_t newFirstTableBlock, int nINodes)
+{
+    diskIO = newDiskIO;
+    firstTableBlock = newFirstTableBlock;
+    iNodes.assign(nINodes, INode());
+    isLoaded.assign(nINodes, false);
+    isDirty.assign(nINodes, false);
+    dirtyINumbers.clear();
+    isUnlogged.assign(nINodes, false);
+    unloggedINumbers.clear();
+}
+
+
+
+///function gets i-node, reading it from the disk if not yet cached
+///parameters: i-number
+///return value: reference to cached i-node
+INode& INodeCache::getINode(int iNumber)
+{
+    std::lock_guard<std::mutex> lock(iNodeMutex);
+    if(!isLoaded[iNumber])
+    {
+        diskIO->readBytes(firstTableBlock + iNumber / N_FILES_PER_I_NODE_BLOCK, (iNumber % N_FILES_PER_I_NODE_BLOCK) * I_NODE_SIZE, &iNodes[iNumber], I_NODE_SIZE);
+        isLoaded[iNumber] = true;
+    }
+
+    return iNodes[iNumber];
+}
+
+
+
+///function marks i-node as changed
+///parameters: i-number
+void INodeCache::markDirty(int iNumber)
+{
+    std::lock_guard<std::mutex> lock(iNodeMutex);
+    if(!isDirty[iNumber])
+    {
+        isDirty[iNumber] = true;
+        dirtyINumbers.push_back(iNumber);
+    }
+    if(!isUnlogged[iNumber])
+    {
+        isUnlogged[iNumber] = true;
+        unloggedINumbers.push_back(iNumber);
+    }
+}
+
+
+
+///function resets i-node to an empty one (used for newly allocated i-nodes)
+///parameters: i-number
+///return value: reference to cached i-node
+INode& INodeCache::resetINode(int iNumber)
+{
+    memset(&iNodes[iNumber], 0, I_NODE_SIZE);
+    markDirty(iNumber);
+    std::lock_guard<std::mutex> lock(iNodeMutex);
+    isLoaded[iNumber] = true;
+
+    return iNodes[iNumber];
+}
+
+
+
+///function writes all dirty i-nodes back to the disk (nothing is left for the journal either)
+void INodeCache::flush()
+{
+    int first;
+    int last;
+    std::lock_guard<std::mutex> lock(iNodeMutex);
+
+    std::sort(dirtyINumbers.begin(), dirtyINumbers.end());
+
+    for(int i = 0; i < (int)dirtyINumbers.size(); i = last + 1)
+    {
+        ///find run of neighbouring dirty i-nodes
+        first = i;
+        last = i;
+        while(last + 1 < (int)dirtyINumbers.size() && dirtyINumbers[last + 1] == dirtyINumbers[last] + 1)
+            ++last;
+
+        diskIO->writeBytes(firstTableBlock + dirtyINumbers[first] / N_FILES_PER_I_NODE_BLOCK, (dirtyINumbers[first] % N_FILES_PER_I_NODE_BLOCK) * I_NODE_SIZE, &iNodes[dirtyINumbers[first]], (last - first + 1) * I_NODE_SIZE);
+    }
+
+    for(int i = 0; i < (int)dirtyINumbers.size(); ++i)
+        isDirty[dirtyINumbers[i]] = false;
+    dirtyINumbers.clear();
+    for(int i = 0; i < (int)unloggedINumbers.size(); ++i)
+        isUnlogged[unloggedINumbers[i]] = false;
+    unloggedINumbers.clear();
+}
+
+
+
+///function adds every i-node changed since last call to next transaction of the journal
+///parameters: journal
+void INodeCache::logChanges(Journal& journal)
+{
+    std::lock_guard<std::mutex> lock(iNodeMutex);
+
+    for(int i = 0; i < (int)unloggedINumbers.size(); ++i)
+    {
+        journal.addEntry(firstTableBlock + unloggedINumbers[i] / N_FILES_PER_I_NODE_BLOCK, (unloggedINumbers[i] % N_FILES_PER_I_NODE_BLOCK) * I_NODE_SIZE, &iNodes[unloggedINumbers[i]], I_NODE_SIZE);
+        isUnlogged[unloggedINumbers[i]] = false;
+    }
+    unloggedINumbers.clear();
+}
@@ -0,0 +1,118 @@
+///Name: INodeCache.h
+///Purpose: declare and describe INodeCache class - in-memory copies of i-nodes with dirty tracking
+
+
+
+
+#ifndef INODECACHE_H_INCLUDED
+#define INODECACHE_H_INCLUDED
+
+#include <vector>
+#include <mutex>
+#include <stdint.h>
+
+#include "Defines.h"
+#include "INode.h"
+#include "DiskIO.h"
+#include "Journal.h"
+
+
+
+
+/*********************************************************************
+ *                          INodeCache class                         *
+ *********************************************************************/
+/**
+        This class keeps i-nodes of the virtual disk in memory.
+        An i-node is read whole from the i-node table the first time it is
+        needed, every later access is a memory access. Changed i-nodes are
+        marked dirty and written back by flush(), neighbouring dirty
+        i-nodes in a single write. I-nodes changed since they were last given
+        to the journal are listed separately, logChanges() adds each of them
+        to next transaction.
+
+        Loading and dirty tracking are guarded by iNodeMutex, so i-nodes may
+        be fetched from several threads. Contents of an i-node are guarded by
+        the owner (VirtualDisk keeps a lock per i-node); references stay valid
+        as the table is never resized after setTable().
+**/
+
+
+class INodeCache
+{
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private attributes                                                                                             *
+ ********************************************************************************************************************************************************************************************/
+
+    DiskIO* diskIO;                            ///access to the virtual disk file
+    int64_t firstTableBlock;                   ///index of first block of the i-node table
+    std::vector<INode> iNodes;                 ///cached i-nodes, indexed by i-number
+    std::vector<char> isLoaded;                ///whether i-node was read from the disk
+    std::vector<char> isDirty;                 ///whether i-node changed since last flush
+    std::vector<int> dirtyINumbers;            ///i-numbers of dirty i-nodes
+    std::vector<char> isUnlogged;              ///whether i-node changed since it was last given to the journal
+    std::vector<int> unloggedINumbers;         ///i-numbers of unlogged i-nodes
+    std::mutex iNodeMutex;                     ///guards loading and dirty tracking
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                              public methods                                                                                              *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+public:
+
+    ///constructor
+    INodeCache();
+
+
+
+    ///function prepares cache for i-node table of a disk
+    ///parameters: access to the virtual disk file, index of first block of i-node table, number of i-nodes
+    void setTable(DiskIO* newDiskIO, int64_t newFirstTableBlock, int nINodes);
+
+
+
+    ///function gets i-node, reading it from the disk if not yet cached
+    ///parameters: i-number
+    ///return value: reference to cached i-node
+    INode& getINode(int iNumber);
+
+
+
+    ///function marks i-node as changed
+    ///parameters: i-number
+    void markDirty(int iNumber);
+
+
+
+    ///function resets i-node to an empty one (used for newly allocated i-nodes)
+    ///parameters: i-number
+    ///return value: reference to cached i-node
+    INode& resetINode(int iNumber);
+
+
+
+    ///function writes all dirty i-nodes back to the disk (nothing is left for the journal either)
+    void flush();
+
+
+
+    ///function adds every i-node changed since last call to next transaction of the journal
+    ///parameters: journal
+    void logChanges(Journal& journal);
+
+
+
+};
+
+
+
+
+#endif // INODECACHE_H_INCLUDED
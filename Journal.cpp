@@ -0,0 +1,420 @@
+///Name: Journal.cpp
+///Purpose: define methods from Journal class - write-ahead log of metadata changes
+
+
+
+#include "Journal.h"
+
+#include <iostream>
+#include <unordered_map>
+#include <string.h>
+#include <stddef.h>
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///function computes checksum of a record
+///parameters: first byte of the record, number of blocks of the record
+///return value: FNV-1a hash of the record, with checksum field taken as zero
+uint64_t Journal::computeChecksum(const unsigned char* record, int nRecordBlocks)
+{
+    JournalHeader header;
+    const unsigned char* headerBytes = (const unsigned char*)&header;
+    uint64_t hash = 14695981039346656037ull;
+
+    memcpy(&header, record, sizeof(header));
+    header.checksum = 0;
+
+    for(int i = 0; i < (int)sizeof(header); ++i)
+    {
+        hash ^= headerBytes[i];
+        hash *= 1099511628211ull;
+    }
+    for(int64_t i = sizeof(header); i < (int64_t)nRecordBlocks * BLOCK_SIZE; ++i)
+    {
+        hash ^= record[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+
+
+///function adds a run of blocks to a list of runs, extending last run if the blocks follow it
+///parameters: list of runs, first block, number of blocks
+void Journal::addRun(std::vector<uint32_t>& runs, uint32_t first, uint32_t count)
+{
+    if(!runs.empty() && runs[runs.size() - 2] + runs.back() == first)
+        runs.back() += count;
+    else
+    {
+        runs.push_back(first);
+        runs.push_back(count);
+    }
+}
+
+
+
+///function appends records of one transaction to the sealed ones
+///parameters: items of the transaction (two words each), changed bytes of its entries
+void Journal::buildRecords(const std::vector<uint32_t>& items, const std::vector<unsigned char>& bytes)
+{
+    JournalHeader header;
+    int nItems = items.size() / 2;
+    int item = 0;
+    int64_t usedBytes = 0;   ///changed bytes already put into records
+    int64_t start;
+    int64_t payloadBytes;
+    int n;
+
+    do
+    {
+        start = sealedRecords.size();
+        sealedRecords.resize(start + BLOCK_SIZE, 0);
+
+        ///items go into the header block, as many as fit
+        payloadBytes = 0;
+        for(n = 0; item < nItems && n < JOURNAL_ITEMS_PER_RECORD; ++n, ++item)
+        {
+            memcpy(&sealedRecords[start + sizeof(header) + n * 2 * sizeof(uint32_t)], &items[item * 2], 2 * sizeof(uint32_t));
+            if(JOURNAL_ITEM_ENTRY == items[item * 2] >> 30)
+                payloadBytes += items[item * 2 + 1] >> 16;
+        }
+
+        ///changed bytes of these entries follow in whole blocks
+        header.magic = JOURNAL_MAGIC;
+        header.flags = item == nItems ? JOURNAL_LAST_RECORD : 0;
+        header.sequence = sequence;
+        header.nItems = n;
+        header.nPayloadBlocks = (payloadBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        header.checksum = 0;
+
+        sealedRecords.resize(start + (int64_t)(1 + header.nPayloadBlocks) * BLOCK_SIZE, 0);
+        if(payloadBytes > 0)
+            memcpy(&sealedRecords[start + BLOCK_SIZE], &bytes[usedBytes], payloadBytes);
+        usedBytes += payloadBytes;
+
+        memcpy(&sealedRecords[start], &header, sizeof(header));
+        header.checksum = computeChecksum(&sealedRecords[start], 1 + header.nPayloadBlocks);
+        memcpy(&sealedRecords[start + offsetof(JournalHeader, checksum)], &header.checksum, sizeof(header.checksum));
+    }
+    while(item < nItems);
+}
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           public methods                                                                                                 *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///constructor
+Journal::Journal()
+{
+    diskIO = NULL;
+    firstBlock = 0;
+    nBlocks = 0;
+    head = 0;
+    firstSequence = 1;
+    sequence = 1;
+}
+
+
+
+///function sets region of the disk used for the journal
+///parameters: access to the virtual disk file, index of first block, number of blocks (0 for no journal), number of first transaction in the region
+void Journal::setRegion(DiskIO* newDiskIO, int64_t newFirstBlock, int newNBlocks, uint64_t newFirstSequence)
+{
+    diskIO = newDiskIO;
+    firstBlock = newFirstBlock;
+    nBlocks = newNBlocks;
+    head = 0;
+    firstSequence = newFirstSequence;
+    sequence = newFirstSequence;
+
+    pendingEntries.clear();
+    pendingBytes.clear();
+    pendingRevokes.clear();
+    pendingReleases.clear();
+    sealedRecords.clear();
+    sealedBlocks.clear();
+    sealedReleases.clear();
+    sealedRevokes.clear();
+    loggedBlocks.clear();
+}
+
+
+
+///function checks whether the disk has a journal
+///return value: true if there is a region for the journal
+bool Journal::isEnabled()
+{
+    return nBlocks > 0;
+}
+
+
+
+///function adds changed bytes of a block to next transaction
+///parameters: absolute index of block, offset within block, new contents, number of bytes
+void Journal::addEntry(int64_t blockIndex, int offset, const void* source, int nBytes)
+{
+    pendingEntries.push_back((uint32_t)blockIndex | ((uint32_t)JOURNAL_ITEM_ENTRY << 30));
+    pendingEntries.push_back((uint32_t)offset | ((uint32_t)nBytes << 16));
+    pendingBytes.insert(pendingBytes.end(), (const unsigned char*)source, (const unsigned char*)source + nBytes);
+}
+
+
+
+///function notes that blocks will hold file data written in place, so images of them logged before are not replayed
+///parameters: absolute index of first block, number of blocks
+void Journal::revokeBlocks(int64_t firstBlockIndex, int count)
+{
+    std::lock_guard<std::mutex> lock(journalMutex);
+
+    for(int i = 0; i < count && !loggedBlocks.empty(); ++i)
+        if(loggedBlocks.count(firstBlockIndex + i))
+            addRun(pendingRevokes, (uint32_t)(firstBlockIndex + i), 1);
+}
+
+
+
+///function notes that a data block is freed, it is handed back once the transaction is committed
+///parameters: index of data block
+void Journal::releaseBlock(uint32_t blockId)
+{
+    std::lock_guard<std::mutex> lock(journalMutex);
+    addRun(pendingReleases, blockId, 1);
+}
+
+
+
+///function closes next transaction - turns everything added so far into records ready to be written
+///return value: number of blocks the records take
+int Journal::seal()
+{
+    std::vector<uint32_t> items;
+    std::lock_guard<std::mutex> lock(journalMutex);
+
+    items.swap(pendingEntries);
+    for(int i = 0; i < (int)items.size(); i += 2)
+        sealedBlocks.push_back(items[i] & JOURNAL_BLOCK_MASK);
+    for(int i = 0; i < (int)pendingRevokes.size(); i += 2)
+    {
+        items.push_back(pendingRevokes[i] | ((uint32_t)JOURNAL_ITEM_REVOKE << 30));
+        items.push_back(pendingRevokes[i + 1]);
+    }
+    for(int i = 0; i < (int)pendingReleases.size(); i += 2)
+    {
+        items.push_back(pendingReleases[i] | ((uint32_t)JOURNAL_ITEM_RELEASE << 30));
+        items.push_back(pendingReleases[i + 1]);
+    }
+
+    buildRecords(items, pendingBytes);
+
+    sealedReleases.insert(sealedReleases.end(), pendingReleases.begin(), pendingReleases.end());
+    sealedRevokes.insert(sealedRevokes.end(), pendingRevokes.begin(), pendingRevokes.end());
+    pendingBytes.clear();
+    pendingRevokes.clear();
+    pendingReleases.clear();
+
+    return sealedRecords.size() / BLOCK_SIZE;
+}
+
+
+
+///function writes sealed transaction to the journal and makes it durable
+///parameters: data blocks which may be freed now (output)
+///return value: -1 on failure, else 0
+int Journal::commit(std::vector<uint32_t>& releasedBlocks)
+{
+    int nRecordBlocks = sealedRecords.size() / BLOCK_SIZE;
+
+    if(nRecordBlocks > nBlocks - head || (int64_t)sealedRecords.size() != diskIO->writeBytes(firstBlock + head, 0, sealedRecords.data(), sealedRecords.size()) || -1 == diskIO->sync())
+    {
+        std::cerr << "Could not write journal!\n";
+        ++sequence;     ///whatever reached the region must not be taken for next transaction
+
+        ///blocks stay reserved until a later transaction makes it
+        std::lock_guard<std::mutex> lock(journalMutex);
+        for(int i = 0; i < (int)sealedReleases.size(); i += 2)
+            addRun(pendingReleases, sealedReleases[i], sealedReleases[i + 1]);
+        for(int i = 0; i < (int)sealedRevokes.size(); i += 2)
+            addRun(pendingRevokes, sealedRevokes[i], sealedRevokes[i + 1]);
+        sealedReleases.clear();
+        sealedRevokes.clear();
+        sealedRecords.clear();
+        sealedBlocks.clear();
+        return -1;
+    }
+
+    head += nRecordBlocks;
+    ++sequence;
+
+    {
+        std::lock_guard<std::mutex> lock(journalMutex);
+        loggedBlocks.insert(sealedBlocks.begin(), sealedBlocks.end());
+    }
+
+    discardSealed(releasedBlocks);
+    return 0;
+}
+
+
+
+///function drops sealed transaction after its changes were written in place instead
+///parameters: data blocks which may be freed now (output)
+void Journal::discardSealed(std::vector<uint32_t>& releasedBlocks)
+{
+    for(int i = 0; i < (int)sealedReleases.size(); i += 2)
+        for(uint32_t j = 0; j < sealedReleases[i + 1]; ++j)
+            releasedBlocks.push_back(sealedReleases[i] + j);
+
+    sealedReleases.clear();
+    sealedRevokes.clear();
+    sealedRecords.clear();
+    sealedBlocks.clear();
+}
+
+
+
+///function gets number of next transaction
+///return value: number the transaction being collected will have
+uint64_t Journal::getSequence()
+{
+    return sequence;
+}
+
+
+
+///function gets number of free blocks of the region
+///return value: number of blocks left for transactions
+int Journal::getFreeBlocks()
+{
+    return nBlocks - head;
+}
+
+
+
+///function writes changes of every committed transaction in the region to their places, skipping revoked images
+///parameters: data blocks released by last transaction (output)
+///return value: number of transactions replayed
+int Journal::replay(std::vector<uint32_t>& releasedBlocks)
+{
+    std::vector<unsigned char> records;        ///records of complete transactions
+    std::unordered_map<int64_t, uint64_t> revokedIn;   ///block -> last transaction which revoked it
+    JournalHeader header;
+    uint32_t* items;
+    int64_t start;
+    int64_t completeBytes = 0;
+    int64_t payloadPosition;
+    uint64_t expectedSequence = firstSequence;
+    int position = 0;
+    int nTransactions = 0;
+    uint32_t type;
+    uint32_t blockIndex;
+
+    ///read records until one is missing, old, incomplete or damaged
+    while(position < nBlocks)
+    {
+        start = records.size();
+        records.resize(start + BLOCK_SIZE);
+        diskIO->readBytes(firstBlock + position, 0, &records[start], BLOCK_SIZE);
+        memcpy(&header, &records[start], sizeof(header));
+
+        if(JOURNAL_MAGIC != header.magic || expectedSequence != header.sequence || header.nItems > JOURNAL_ITEMS_PER_RECORD || (int64_t)header.nPayloadBlocks >= nBlocks - position)
+            break;
+
+        records.resize(start + (int64_t)(1 + header.nPayloadBlocks) * BLOCK_SIZE);
+        if(header.nPayloadBlocks > 0)
+            diskIO->readBytes(firstBlock + position + 1, 0, &records[start + BLOCK_SIZE], header.nPayloadBlocks * BLOCK_SIZE);
+        if(computeChecksum(&records[start], 1 + header.nPayloadBlocks) != header.checksum)
+            break;
+
+        position += 1 + header.nPayloadBlocks;
+        if(header.flags & JOURNAL_LAST_RECORD)
+        {
+            completeBytes = records.size();
+            head = position;
+            ++expectedSequence;
+            ++nTransactions;
+        }
+    }
+    records.resize(completeBytes);  ///transaction without its last record never happened
+
+    ///collect revoked blocks, and blocks released by last transaction
+    releasedBlocks.clear();
+    for(start = 0; start < (int64_t)records.size(); start += (int64_t)(1 + header.nPayloadBlocks) * BLOCK_SIZE)
+    {
+        memcpy(&header, &records[start], sizeof(header));
+        items = (uint32_t*)&records[start + sizeof(header)];
+        for(uint32_t i = 0; i < header.nItems; ++i)
+        {
+            type = items[i * 2] >> 30;
+            blockIndex = items[i * 2] & JOURNAL_BLOCK_MASK;
+            if(JOURNAL_ITEM_REVOKE == type)
+                for(uint32_t j = 0; j < items[i * 2 + 1]; ++j)
+                    revokedIn[blockIndex + j] = header.sequence;
+            else if(JOURNAL_ITEM_RELEASE == type && expectedSequence - 1 == header.sequence)
+                for(uint32_t j = 0; j < items[i * 2 + 1]; ++j)
+                    releasedBlocks.push_back(blockIndex + j);
+        }
+    }
+
+    ///blocks revoked by transactions not committed yet already hold file data, no image may overwrite them
+    {
+        std::lock_guard<std::mutex> lock(journalMutex);
+        for(int i = 0; i < (int)sealedRevokes.size(); i += 2)
+            for(uint32_t j = 0; j < sealedRevokes[i + 1]; ++j)
+                revokedIn[sealedRevokes[i] + j] = UINT64_MAX;
+        for(int i = 0; i < (int)pendingRevokes.size(); i += 2)
+            for(uint32_t j = 0; j < pendingRevokes[i + 1]; ++j)
+                revokedIn[pendingRevokes[i] + j] = UINT64_MAX;
+    }
+
+    ///write changed bytes in order of transactions
+    for(start = 0; start < (int64_t)records.size(); start += (int64_t)(1 + header.nPayloadBlocks) * BLOCK_SIZE)
+    {
+        memcpy(&header, &records[start], sizeof(header));
+        items = (uint32_t*)&records[start + sizeof(header)];
+        payloadPosition = start + BLOCK_SIZE;
+        for(uint32_t i = 0; i < header.nItems; ++i)
+        {
+            if(JOURNAL_ITEM_ENTRY != items[i * 2] >> 30)
+                continue;
+
+            blockIndex = items[i * 2] & JOURNAL_BLOCK_MASK;
+            if(!revokedIn.count(blockIndex) || revokedIn[blockIndex] <= header.sequence)
+                diskIO->writeBytes(blockIndex, items[i * 2 + 1] & 0xFFFF, &records[payloadPosition], items[i * 2 + 1] >> 16);
+            payloadPosition += items[i * 2 + 1] >> 16;
+        }
+    }
+
+    if(0 == nTransactions)
+        head = 0;
+    sequence = expectedSequence;
+    return nTransactions;
+}
+
+
+
+///function starts the region over - called once everything in it is at its place on the disk
+///return value: number of first transaction of the new region (to be kept in the superblock)
+uint64_t Journal::reset()
+{
+    std::lock_guard<std::mutex> lock(journalMutex);
+
+    head = 0;
+    firstSequence = sequence;
+    loggedBlocks.clear();
+
+    return firstSequence;
+}
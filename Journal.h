@@ -0,0 +1,229 @@
+///Name: Journal.h
+///Purpose: declare and describe Journal class - write-ahead log of metadata changes
+
+
+
+
+#ifndef JOURNAL_H_INCLUDED
+#define JOURNAL_H_INCLUDED
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+
+#include "Defines.h"
+#include "DiskIO.h"
+
+
+
+
+/*********************************************************************
+ *                      Journal record structure                     *
+ *********************************************************************/
+/**
+        Stored at the beginning of the first block of every record, followed
+        by the items of the record (two 32-bit words each) in the same block.
+        Changed bytes of all entries follow in payloadBlocks blocks, in order
+        of the entries.
+
+        entry   -> absolute index of block | offset within block + (length << 16)
+        revoke  -> absolute index of first block | number of blocks
+        release -> index of first data block | number of blocks
+
+        The type of an item is kept in the two highest bits of its first word.
+**/
+
+
+struct JournalHeader
+{
+    uint32_t magic;                            ///JOURNAL_MAGIC
+    uint32_t flags;                            ///JOURNAL_LAST_RECORD if record ends its transaction
+    uint64_t sequence;                         ///number of transaction the record belongs to
+    uint32_t nItems;                           ///number of items after the header
+    uint32_t nPayloadBlocks;                   ///number of blocks with changed bytes after the header block
+    uint64_t checksum;                         ///FNV-1a of header block (with this field zero) and payload blocks
+} __attribute__((packed));
+
+
+
+
+/*********************************************************************
+ *                            Journal class                          *
+ *********************************************************************/
+/**
+        This class keeps the write-ahead log of metadata changes, in its own
+        region of the virtual disk. Changes of many operations are collected
+        into one transaction and written with a single write and a single
+        fdatasync (group commit); they may reach their places on the disk
+        only afterwards.
+
+        The region is filled from its beginning. Transactions are numbered,
+        the superblock tells which number the first one in the region has, so
+        records left from before are recognized as old. When the region is
+        full, committed transactions are replayed to their places and the
+        region starts over (checkpoint). Replay at mount does the same for
+        everything committed before a crash and stops at the first record
+        which is incomplete or damaged.
+
+        Besides changed bytes, a transaction carries:
+        revoke  -> block which was logged earlier and now holds file data
+                   written in place, so its older images must not be replayed
+        release -> data blocks freed by operations of the transaction; they
+                   are reused only after the transaction is on the disk, so
+                   data written to them cannot hit a file still existing in
+                   the committed state. If the last transaction is replayed,
+                   its released blocks are handed back to be freed.
+**/
+
+
+class Journal
+{
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private attributes                                                                                             *
+ ********************************************************************************************************************************************************************************************/
+
+    DiskIO* diskIO;                            ///access to the virtual disk file
+    int64_t firstBlock;                        ///index of first block of the region
+    int nBlocks;                               ///size of the region (in blocks), 0 if there is no journal
+    int head;                                  ///first free block of the region
+    uint64_t firstSequence;                    ///number of first transaction in the region
+    uint64_t sequence;                         ///number of next transaction to commit
+
+    std::vector<uint32_t> pendingEntries;      ///block and offset + length of every change collected for next transaction
+    std::vector<unsigned char> pendingBytes;   ///changed bytes of collected entries
+    std::vector<uint32_t> pendingRevokes;      ///first block and number of blocks of every revoked run
+    std::vector<uint32_t> pendingReleases;     ///first data block and number of blocks of every released run
+    std::vector<unsigned char> sealedRecords;  ///records of transaction ready to be written
+    std::vector<int64_t> sealedBlocks;         ///blocks with images in sealed records
+    std::vector<uint32_t> sealedReleases;      ///runs released by sealed transaction
+    std::vector<uint32_t> sealedRevokes;       ///runs revoked by sealed transaction
+    std::unordered_set<int64_t> loggedBlocks;  ///blocks with images somewhere in the region
+    std::mutex journalMutex;                   ///guards revokes, releases and logged blocks, which operations add to in parallel
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           private methods                                                                                                *
+ ********************************************************************************************************************************************************************************************/
+
+
+    ///function computes checksum of a record
+    ///parameters: first byte of the record, number of blocks of the record
+    ///return value: FNV-1a hash of the record, with checksum field taken as zero
+    static uint64_t computeChecksum(const unsigned char* record, int nRecordBlocks);
+
+
+
+    ///function adds a run of blocks to a list of runs, extending last run if the blocks follow it
+    ///parameters: list of runs, first block, number of blocks
+    static void addRun(std::vector<uint32_t>& runs, uint32_t first, uint32_t count);
+
+
+
+    ///function appends records of one transaction to the sealed ones
+    ///parameters: items of the transaction (two words each), changed bytes of its entries
+    void buildRecords(const std::vector<uint32_t>& items, const std::vector<unsigned char>& bytes);
+
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                              public methods                                                                                              *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+public:
+
+    ///constructor
+    Journal();
+
+
+
+    ///function sets region of the disk used for the journal
+    ///parameters: access to the virtual disk file, index of first block, number of blocks (0 for no journal), number of first transaction in the region
+    void setRegion(DiskIO* newDiskIO, int64_t newFirstBlock, int newNBlocks, uint64_t newFirstSequence);
+
+
+
+    ///function checks whether the disk has a journal
+    ///return value: true if there is a region for the journal
+    bool isEnabled();
+
+
+
+    ///function adds changed bytes of a block to next transaction
+    ///parameters: absolute index of block, offset within block, new contents, number of bytes
+    void addEntry(int64_t blockIndex, int offset, const void* source, int nBytes);
+
+
+
+    ///function notes that blocks will hold file data written in place, so images of them logged before are not replayed
+    ///parameters: absolute index of first block, number of blocks
+    void revokeBlocks(int64_t firstBlockIndex, int count);
+
+
+
+    ///function notes that a data block is freed, it is handed back once the transaction is committed
+    ///parameters: index of data block
+    void releaseBlock(uint32_t blockId);
+
+
+
+    ///function closes next transaction - turns everything added so far into records ready to be written
+    ///return value: number of blocks the records take
+    int seal();
+
+
+
+    ///function writes sealed transaction to the journal and makes it durable
+    ///parameters: data blocks which may be freed now (output)
+    ///return value: -1 on failure, else 0
+    int commit(std::vector<uint32_t>& releasedBlocks);
+
+
+
+    ///function drops sealed transaction after its changes were written in place instead
+    ///parameters: data blocks which may be freed now (output)
+    void discardSealed(std::vector<uint32_t>& releasedBlocks);
+
+
+
+    ///function gets number of next transaction
+    ///return value: number the transaction being collected will have
+    uint64_t getSequence();
+
+
+
+    ///function gets number of free blocks of the region
+    ///return value: number of blocks left for transactions
+    int getFreeBlocks();
+
+
+
+    ///function writes changes of every committed transaction in the region to their places, skipping revoked images
+    ///parameters: data blocks released by last transaction (output)
+    ///return value: number of transactions replayed
+    int replay(std::vector<uint32_t>& releasedBlocks);
+
+
+
+    ///function starts the region over - called once everything in it is at its place on the disk
+    ///return value: number of first transaction of the new region (to be kept in the superblock)
+    uint64_t reset();
+
+
+
+};
+
+
+
+
+#endif // JOURNAL_H_INCLUDED
@@ -0,0 +1,74 @@
+///Name: Superblock.h
+///Purpose: declare Superblock structure - on-disk description of the file system
+
+
+
+
+#ifndef SUPERBLOCK_H_INCLUDED
+#define SUPERBLOCK_H_INCLUDED
+
+#include <stdint.h>
+
+#include "Defines.h"
+
+
+
+
+/*********************************************************************
+ *                        Superblock structure                       *
+ *********************************************************************/
+/**
+        Stored at the beginning of block SUPERBLOCK_INDEX. It identifies the
+        file as a virtual disk and tells which version of on-disk format it
+        uses. A file without the magic number (all zeros) has no file system
+        yet and gets one created.
+
+        It records geometry of the disk, so an existing virtual disk is opened
+        by reading the superblock alone, and whether the disk was closed
+        properly (state is STATE_MOUNTED while it is open).
+
+        It also keeps usage counters, updated whenever a block or an i-node
+        is allocated or freed and whenever size of a file changes, so disk
+        usage is known without scanning bitmaps and i-nodes - deduplication
+        counters too, kept up to date with reference counts of blocks.
+
+        Location and size of the journal region are kept here too, with the
+        number of first transaction written to it since the region last
+        started over - records with lower numbers are left from before.
+        CRC32C of the checksum table is stored last; it only counts when the
+        disk was closed properly, as the table is written just before.
+**/
+
+
+struct Superblock
+{
+    uint32_t magic;                            ///SUPERBLOCK_MAGIC
+    uint32_t version;                          ///FORMAT_VERSION
+    uint32_t state;                            ///STATE_CLEAN or STATE_MOUNTED
+    uint32_t blockSize;                        ///BLOCK_SIZE
+    uint32_t nBlocks;                          ///total number of blocks
+    uint32_t nInodeBlocks;                     ///number of blocks for i-node tables
+    uint32_t iNodeBitmapIndex;                 ///index of first block of i-node bitmap
+    uint32_t dataBitmapIndex;                  ///index of first block of data bitmap
+    uint32_t firstINodeIndex;                  ///index of first i-node block
+    uint32_t firstDataIndex;                   ///index of first data block
+    uint64_t nDataBlocksInUse;                 ///number of used data blocks
+    uint64_t nINodesInUse;                     ///number of used i-nodes
+    uint64_t nBytesInUse;                      ///sum of sizes of all files
+    uint64_t nIndexedBlocks;                   ///number of data blocks written by deduplicated copies (in the fingerprint index)
+    uint64_t nSharedReferences;                ///number of references to data blocks beyond the first one - blocks saved by deduplication
+    uint32_t referenceCountIndex;              ///index of first block of reference count table
+    uint32_t fingerprintIndex;                 ///index of first block of fingerprint index
+    uint32_t nFingerprintBlocks;               ///size of fingerprint index (in blocks)
+    uint32_t checksumIndex;                    ///index of first block of checksum table
+    uint32_t nChecksumBlocks;                  ///size of checksum table (in blocks)
+    uint32_t journalIndex;                     ///index of first block of the journal
+    uint32_t nJournalBlocks;                   ///size of the journal (in blocks), 0 if disk has none
+    uint64_t journalSequence;                  ///number of first transaction in the journal
+    uint32_t checksumTableChecksum;            ///CRC32C of checksum table - written when the disk is closed properly
+} __attribute__((packed));
+
+
+
+
+#endif // SUPERBLOCK_H_INCLUDED
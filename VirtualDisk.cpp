@@ -5,6 +5,16 @@
 
 #include "VirtualDisk.h"
 
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <chrono>
+#include <stddef.h>
+
 
 
 /********************************************************************************************************************************************************************************************
@@ -14,348 +24,2569 @@
 
 
 ///function opens file from user system be used for virtual disk implementation
-void VirtualDisk::openFile()
+///parameters: backend to use (IO_PREAD or IO_MMAP)
+void VirtualDisk::openFile(int ioMode)
+{
+    if(-1 == diskIO.openFile(vDiskFileName, ioMode))
+    {
+        std::cerr << "Could not open virtual disk file!\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+
+///function closes file from user system be used for virtual disk implementation
+void VirtualDisk::closeFile()
+{
+    diskIO.closeFile();
+}
+
+
+
+///function reads and checks superblock of the virtual disk
+///return value: true if file system already exists, false if virtual disk is empty (exits if format is unsupported)
+bool VirtualDisk::readSuperblock()
 {
+    memset(&superblock, 0, sizeof(superblock));
+    diskIO.readBytes(SUPERBLOCK_INDEX, 0, &superblock, sizeof(superblock));
 
-    if(access(vDiskFileName, F_OK) != -1)       ///file exists
-        vDiskFile = fopen(vDiskFileName, "rb+");
-    else                                        ///file does not exist
-        vDiskFile = fopen(vDiskFileName, "wb+");
+    if(0 == superblock.magic)   ///nothing written yet - file sytem being created, not restored
+    {
+        memset(&superblock, 0, sizeof(superblock));
+        superblock.magic = SUPERBLOCK_MAGIC;
+        superblock.version = FORMAT_VERSION;
+        superblock.blockSize = BLOCK_SIZE;
+        return false;
+    }
 
-    if(vDiskFile == NULL)
+    if(SUPERBLOCK_MAGIC != superblock.magic || FORMAT_VERSION != superblock.version || BLOCK_SIZE != superblock.blockSize)
     {
-        std::cerr << "Could not open virtual disk file!\n";
+        std::cerr << "Unsupported virtual disk format!\n";
+        exit(EXIT_FAILURE);
+    }
+
+    if((int64_t)superblock.nBlocks * BLOCK_SIZE > diskIO.getSize())
+    {
+        std::cerr << "Virtual disk file is shorter than its file system!\n";
+        exit(EXIT_FAILURE);
+    }
+
+    return true;
+}
+
+
+
+///function writes superblock of the virtual disk
+void VirtualDisk::writeSuperblock()
+{
+    diskIO.writeBytes(SUPERBLOCK_INDEX, 0, &superblock, sizeof(superblock));
+}
+
+
+
+///function opens existing file system - geometry is taken from the superblock
+void VirtualDisk::mountVDisk()
+{
+    bool wasClean = STATE_CLEAN == superblock.state;
+    std::vector<uint32_t> releasedBlocks;
+    uint64_t nextSequence;
+    int nTransactions = 0;
+    int nOrphans;
+
+    loadVDiskParameters();
+
+    ///bring back changes committed before the disk was left open - superblock is one of them
+    if(!wasClean && journal.isEnabled())
+    {
+        nTransactions = journal.replay(releasedBlocks);
+        if(nTransactions > 0)
+        {
+            nextSequence = journal.getSequence();
+            readSuperblock();
+            superblock.journalSequence = nextSequence;    ///replayed superblock holds number the region started with - its records must not be taken for new ones
+            loadVDiskParameters();
+        }
+    }
+
+    prepareChecksums(wasClean);
+    prepareBitmaps(true);
+    releaseBlocks(releasedBlocks);
+    currentDirectory = ROOT_I_NUMBER;
+
+    if(nTransactions > 0)
+        std::cerr << "Virtual disk was not closed properly, " << nTransactions << " transactions replayed from journal!\n";
+    else if(!wasClean && !journal.isEnabled() && recountUsage())
+        std::cerr << "Virtual disk was not closed properly, usage counters corrected!\n";
+
+    ///files whose copy was cut off are in no directory - nothing else would ever free them
+    if(!wasClean && journal.isEnabled())
+    {
+        nOrphans = freeOrphans();
+        if(nOrphans > 0)
+        {
+            std::cerr << "Virtual disk was not closed properly, " << nOrphans << " unfinished files freed!\n";
+            iNodeCache.flush();
+            blockCache.flush();
+        }
+    }
+
+    ///replayed changes must be on the disk before journal starts over
+    flushBitmaps();
+    if(journal.isEnabled())
+        diskIO.sync();
+    superblock.journalSequence = journal.reset();
+
+    ///mark as open until closed properly
+    superblock.state = STATE_MOUNTED;
+    writeSuperblock();
+    if(journal.isEnabled())
+        diskIO.sync();
+}
+
+
+
+///function creates new file system on empty virtual disk
+///parameters: size of virtual disk (in bytes), -1 to ask the user
+void VirtualDisk::formatVDisk(int64_t diskSize)
+{
+    setVDiskSize(diskSize);
+    setVDiskParameters();
+    diskIO.setChecksumTable(checksumIndex, nBlocks);   ///image is all zeros, so is the table
+    prepareBitmaps(false);
+    superblock.state = STATE_MOUNTED;
+    createRootDirectory();
+
+    ///empty file system goes to the disk whole, journal starts afterwards
+    blockCache.flush();
+    iNodeCache.flush();
+    flushBitmaps();
+    writeSuperblock();
+    if(journal.isEnabled())
+        diskIO.sync();
+}
+
+
+
+///function prepares in-memory i-node and data bitmaps, loading them from the disk or clearing them during virtual disk creation
+///parameters: whether bitmaps should be loaded from the disk
+void VirtualDisk::prepareBitmaps(bool load)
+{
+    unsigned char* iNodeBitmapBuffer;
+    unsigned char* dataBitmapBuffer;
+    struct iovec vectors[2];
+
+    iNodeBitmap.setSize(nInodeBlocks * BLOCK_SIZE / I_NODE_SIZE);
+    dataBitmap.setSize(nBlocks - firstDataIndex);
+
+    if(!load)   ///file sytem being created, not restored - bitmaps on the disk are already zeros
+    {
+        iNodeBitmap.clear();
+        iNodeBitmap.markClean();
+        dataBitmap.clear();
+        dataBitmap.markClean();
+        return;
+    }
+
+    ///read i-node bitmap and data bitmap - they are neighbours on the disk, so with a single access
+    iNodeBitmapBuffer = new unsigned char [iNodeBitmap.getNBlocks() * BLOCK_SIZE];
+    dataBitmapBuffer = new unsigned char [dataBitmap.getNBlocks() * BLOCK_SIZE];
+    vectors[0].iov_base = iNodeBitmapBuffer;
+    vectors[0].iov_len = iNodeBitmap.getNBlocks() * BLOCK_SIZE;
+    vectors[1].iov_base = dataBitmapBuffer;
+    vectors[1].iov_len = dataBitmap.getNBlocks() * BLOCK_SIZE;
+
+    if(dataBitmapIndex == iNodeBitmapIndex + iNodeBitmap.getNBlocks())
+        diskIO.readVector(iNodeBitmapIndex, 0, vectors, 2);
+    else
+    {
+        diskIO.readVector(iNodeBitmapIndex, 0, vectors, 1);
+        diskIO.readVector(dataBitmapIndex, 0, vectors + 1, 1);
+    }
+
+    iNodeBitmap.load(iNodeBitmapBuffer, iNodeBitmap.getNBlocks() * BLOCK_SIZE);
+    dataBitmap.load(dataBitmapBuffer, dataBitmap.getNBlocks() * BLOCK_SIZE);
+    delete [] dataBitmapBuffer;
+    delete [] iNodeBitmapBuffer;
+}
+
+
+
+///function starts checking blocks against checksum table - loaded from the disk if it was closed properly, computed anew from the blocks otherwise
+///parameters: whether the disk was closed properly
+void VirtualDisk::prepareChecksums(bool wasClean)
+{
+    std::vector<int64_t> unreadableBlocks;
+
+    diskIO.setChecksumTable(checksumIndex, nBlocks);
+    if(wasClean && 0 == diskIO.loadChecksumTable(superblock.checksumTableChecksum))
+        return;
+
+    ///blocks written since the table was stored may have reached the disk without their checksums
+    if(wasClean)
+        std::cerr << "Checksum table of virtual disk is damaged, computing it anew!\n";
+    scanBlocks(true, unreadableBlocks);
+}
+
+
+
+///function checks every block with a checksum against it, or computes every checksum anew, on several threads
+///parameters: whether to compute checksums instead of checking them, blocks which do not match or could not be read (output, in ascending order)
+void VirtualDisk::scanBlocks(bool recompute, std::vector<int64_t>& damagedBlocks)
+{
+    std::vector<std::thread> scanners;
+    std::mutex resultMutex;
+    int64_t nChunks = ((int64_t)nBlocks + SCRUB_CHUNK_BLOCKS - 1) / SCRUB_CHUNK_BLOCKS;
+    int64_t nextChunk = 0;    ///taken by threads one by one, so faster ones take more
+    int nThreads = (int)std::max((int64_t)1, std::min({(int64_t)std::thread::hardware_concurrency(), (int64_t)MAX_SCRUB_THREADS, nChunks}));
+
+    for(int i = 0; i < nThreads; ++i)
+        scanners.push_back(std::thread([&]()
+        {
+            std::vector<int64_t> found;
+            int64_t chunk;
+
+            while((chunk = __atomic_fetch_add(&nextChunk, 1, __ATOMIC_RELAXED)) < nChunks)
+                diskIO.checkBlocks(chunk * SCRUB_CHUNK_BLOCKS, SCRUB_CHUNK_BLOCKS, recompute, found);
+
+            std::lock_guard<std::mutex> lock(resultMutex);
+            damagedBlocks.insert(damagedBlocks.end(), found.begin(), found.end());
+        }));
+
+    for(int i = 0; i < nThreads; ++i)
+        scanners[i].join();
+    std::sort(damagedBlocks.begin(), damagedBlocks.end());
+}
+
+
+
+///function tells what a block of the disk holds
+///parameters: index of block
+///return value: name of region the block belongs to (for data blocks also whether the block is in use)
+std::string VirtualDisk::describeBlock(int64_t blockIndex)
+{
+    std::lock_guard<std::mutex> lock(allocationMutex);
+
+    if(blockIndex >= firstDataIndex)
+        return std::string("data block ") + std::to_string(blockIndex - firstDataIndex) + (USED == dataBitmap.checkBit(blockIndex - firstDataIndex) ? " (in use)" : " (free)");
+    if(blockIndex >= firstINodeIndex)
+        return "i-node table";
+    if(blockIndex >= checksumIndex)
+        return "checksum table";
+    if(blockIndex >= fingerprintIndex)
+        return "fingerprint index";
+    if(blockIndex >= referenceCountIndex)
+        return "reference count table";
+    if(blockIndex >= dataBitmapIndex)
+        return "data bitmap";
+    if(blockIndex >= iNodeBitmapIndex)
+        return "i-node bitmap";
+    return "journal";
+}
+
+
+
+///function writes dirty blocks of a bitmap back to the disk
+///parameters: bitmap to write, index of first block of the bitmap on the disk
+void VirtualDisk::writeBitmap(Bitmap& bitmap, int firstBlockIndex)
+{
+    int runLength;
+
+    if(!bitmap.hasChanges())
+        return;
+
+    ///write each run of neighbouring dirty blocks with a single write
+    for(int i = 0; i < bitmap.getNBlocks(); i += runLength)
+    {
+        runLength = 1;
+        if(!bitmap.isBlockDirty(i))
+            continue;
+
+        while(i + runLength < bitmap.getNBlocks() && bitmap.isBlockDirty(i + runLength))
+            ++runLength;
+        diskIO.writeBytes(firstBlockIndex + i, 0, bitmap.getBytes() + (int64_t)i * BLOCK_SIZE, runLength * BLOCK_SIZE);
+    }
+
+    bitmap.markClean();
+}
+
+
+
+///function writes changed parts of in-memory bitmaps back to the disk
+void VirtualDisk::flushBitmaps()
+{
+    writeBitmap(iNodeBitmap, iNodeBitmapIndex);
+    writeBitmap(dataBitmap, dataBitmapIndex);
+}
+
+
+
+///function starts journaling changes, if disk has a journal - changes wait in memory and a committer thread starts
+void VirtualDisk::startJournal()
+{
+    if(!journal.isEnabled())
+        return;
+
+    isJournaling = true;
+    blockCache.keepChanges(true);
+    committer = std::thread(&VirtualDisk::runCommitter, this);
+}
+
+
+
+///function stops committer thread and commits changes of last operations
+void VirtualDisk::stopJournal()
+{
+    if(!isJournaling)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(committerMutex);
+        isStopping = true;
+    }
+    committerWakeUp.notify_all();
+    committer.join();
+
+    commitJournal();
+    isJournaling = false;
+    blockCache.keepChanges(false);
+}
+
+
+
+///constructor - waits until operations may run
+///parameters: disk changed by the operation, NULL if operation changes nothing after all
+VirtualDisk::Operation::Operation(VirtualDisk* newDisk)
+{
+    disk = NULL != newDisk && newDisk->isJournaling ? newDisk : NULL;
+    if(NULL != disk)
+        disk->beginOperation();
+}
+
+
+
+///destructor - counts operation for next commit
+VirtualDisk::Operation::~Operation()
+{
+    if(NULL != disk)
+        disk->endOperation();
+}
+
+
+
+///function lets an operation start - waits while a commit collects changes
+void VirtualDisk::beginOperation()
+{
+    {
+        std::unique_lock<std::mutex> lock(committerMutex);
+        commitFinished.wait(lock, [&]() { return !isCommitWaiting; });
+    }
+    operationLock.lock_shared();
+}
+
+
+
+///function ends an operation, waking committer thread when enough operations wait for commit
+void VirtualDisk::endOperation()
+{
+    bool isGroupFull;
+
+    operationLock.unlock_shared();
+    {
+        std::lock_guard<std::mutex> lock(committerMutex);
+        isGroupFull = ++nUncommittedOperations >= JOURNAL_GROUP_SIZE;
+    }
+    if(isGroupFull)
+        committerWakeUp.notify_all();
+}
+
+
+
+///function waits until running operations end and keeps new ones waiting
+void VirtualDisk::pauseOperations()
+{
+    {
+        std::lock_guard<std::mutex> lock(committerMutex);
+        isCommitWaiting = true;     ///shared lock is not handed to new operations while exclusive one is waited for
+    }
+    operationLock.lock();
+}
+
+
+
+///function lets waiting operations go on
+void VirtualDisk::resumeOperations()
+{
+    operationLock.unlock();
+    {
+        std::lock_guard<std::mutex> lock(committerMutex);
+        isCommitWaiting = false;
+    }
+    commitFinished.notify_all();
+}
+
+
+
+///function commits transactions until committer thread has to stop (body of committer thread)
+void VirtualDisk::runCommitter()
+{
+    std::unique_lock<std::mutex> lock(committerMutex);
+
+    while(!isStopping)
+    {
+        committerWakeUp.wait_for(lock, std::chrono::milliseconds(JOURNAL_COMMIT_INTERVAL), [&]() { return isStopping || nUncommittedOperations >= JOURNAL_GROUP_SIZE; });
+        if(isStopping || 0 == nUncommittedOperations)
+            continue;
+
+        lock.unlock();
+        commitJournal();
+        lock.lock();
+    }
+}
+
+
+
+///function commits changes of ended operations to the journal as one transaction
+void VirtualDisk::commitJournal()
+{
+    std::vector<uint32_t> releasedBlocks;
+    int nRecordBlocks;
+    bool isSealed = true;
+    std::lock_guard<std::mutex> commitLock(commitMutex);
+
+    ///collect changes of whole operations only
+    pauseOperations();
+    {
+        std::lock_guard<std::mutex> lock(committerMutex);
+        nUncommittedOperations = 0;
+    }
+
+    logChanges();
+    nRecordBlocks = journal.seal();
+    if(nRecordBlocks > journal.getFreeBlocks())
+        checkpointJournal();
+    if(nRecordBlocks > journal.getFreeBlocks())    ///bigger than whole journal - no way to make it atomic
+    {
+        writeInPlace();
+        journal.discardSealed(releasedBlocks);
+        isSealed = false;
+    }
+    resumeOperations();
+
+    ///write and sync while new operations run - their changes wait in memory for next commit
+    if(isSealed && -1 == journal.commit(releasedBlocks))
+    {
+        pauseOperations();
+        checkpointJournal();
+        writeInPlace();
+        resumeOperations();
+    }
+
+    ///blocks freed by the transaction may be reused now, bitmap changes go to next one
+    if(!releasedBlocks.empty())
+    {
+        releaseBlocks(releasedBlocks);
+        std::lock_guard<std::mutex> lock(committerMutex);
+        ++nUncommittedOperations;
+    }
+}
+
+
+
+///function adds changes of bitmaps, superblock, i-nodes and cached blocks to next transaction
+void VirtualDisk::logChanges()
+{
+    {
+        std::lock_guard<std::mutex> lock(allocationMutex);
+        logBitmap(iNodeBitmap, iNodeBitmapIndex);
+        logBitmap(dataBitmap, dataBitmapIndex);
+        journal.addEntry(SUPERBLOCK_INDEX, 0, &superblock, offsetof(Superblock, journalIndex));  ///number of first transaction is only written by checkpoint
+    }
+
+    iNodeCache.logChanges(journal);
+    blockCache.logChanges(journal, journal.getSequence());
+}
+
+
+
+///function adds changed blocks of a bitmap to next transaction
+///parameters: bitmap, index of first block of the bitmap on the disk
+void VirtualDisk::logBitmap(Bitmap& bitmap, int firstBlockIndex)
+{
+    if(!bitmap.hasUnloggedChanges())
+        return;
+
+    for(int i = 0; i < bitmap.getNBlocks(); ++i)
+        if(bitmap.isBlockUnlogged(i))
+            journal.addEntry(firstBlockIndex + i, 0, bitmap.getBytes() + (int64_t)i * BLOCK_SIZE, BLOCK_SIZE);
+
+    bitmap.markLogged();
+}
+
+
+
+///function replays committed transactions to their places on the disk and starts journal over
+void VirtualDisk::checkpointJournal()
+{
+    std::vector<uint32_t> releasedBlocks;   ///blocks of last transaction were freed after its commit already
+    uint64_t firstSequence = superblock.journalSequence;
+    int nTransactions = journal.replay(releasedBlocks);
+
+    ///replayed changes must be on the disk before records are given up
+    diskIO.sync();
+    superblock.journalSequence = journal.reset();
+    diskIO.writeBytes(SUPERBLOCK_INDEX, offsetof(Superblock, journalSequence), &superblock.journalSequence, sizeof(superblock.journalSequence));
+    diskIO.sync();
+
+    if(nTransactions > 0)
+        blockCache.markCheckpointed(firstSequence + nTransactions - 1);
+}
+
+
+
+///function writes every change kept in memory to its place on the disk directly (when a transaction does not fit into the journal)
+void VirtualDisk::writeInPlace()
+{
+    blockCache.flush();
+    iNodeCache.flush();
+    flushBitmaps();
+    writeSuperblock();
+    diskIO.sync();
+}
+
+
+
+///function sets virtual disk size
+///parameters: new size of virtual disk (in bytes)
+void VirtualDisk::setVDiskSize(int64_t newSize)
+{
+
+    if(-1 == newSize)
+    {
+        std::cout << "Please specify size of virtual disk in bytes: ";
+        std::cin >> newSize;
+    }
+
+    newSize = newSize - newSize % BLOCK_SIZE;      ///resize to be a multiply of block size
+    newSize = std::min(newSize, (int64_t)MAX_DISK_SIZE);    ///resize if size bigger than allowed
+    newSize = std::max(newSize, (int64_t)MIN_DISK_SIZE);    ///resize if size smaller than allowed
+
+    vDiskSize = newSize;
+
+    if(-1 == diskIO.resetFile(newSize))    ///image is all zeros afterwards - empty bitmaps and i-node tables need no writing
+    {
+        std::cerr << "Could not prepare virtual disk file!\n";
         exit(EXIT_FAILURE);
     }
+}
+
+
+
+///function gets virtual disk size
+///return value: size of virtual disk
+int64_t VirtualDisk::getVDiskSize()
+{
+    return vDiskSize;
+}
+
+
+
+///function sets virtual disk parameters during virtual disk creation - based on disk size, calculate where bitmaps, i-node table and user data are
+void VirtualDisk::setVDiskParameters()
+{
+    int nINodeBitmapBlocks;
+    int nDataBitmapBlocks;
+    int nReferenceCountBlocks;
+    int blocksLeft;
+
+    vDiskSize = getVDiskSize();
+    nBlocks = (int)(vDiskSize / BLOCK_SIZE);
+    nChecksumBlocks = (nBlocks + CHECKSUMS_PER_BLOCK - 1) / CHECKSUMS_PER_BLOCK;
+
+    ///journal right after the superblock, if the disk is big enough for it
+    nJournalBlocks = std::min(nBlocks / JOURNAL_SIZE_DIVISOR, MAX_JOURNAL_BLOCKS);
+    if(nJournalBlocks < MIN_JOURNAL_BLOCKS)
+        nJournalBlocks = 0;
+    journalIndex = SUPERBLOCK_INDEX + 1;
+
+    nInodeBlocks = (nBlocks - 1 - nJournalBlocks - nChecksumBlocks) / (N_FILES_PER_I_NODE_BLOCK * AVERAGE_FILE_SIZE_IN_BLOCKS + 1);
+    nInodeBlocks = std::max(nInodeBlocks, 1);   ///at least one i-node block must be present
+    nInodeBlocks = std::min(nInodeBlocks, MAX_I_NODES / N_FILES_PER_I_NODE_BLOCK);
+    nINodeBitmapBlocks = (nInodeBlocks * N_FILES_PER_I_NODE_BLOCK + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+
+    ///blocks left for data bitmap, tables of data blocks and data - each data bitmap block covers BITS_PER_BLOCK data blocks
+    blocksLeft = nBlocks - 1 - nJournalBlocks - nChecksumBlocks - nINodeBitmapBlocks - nInodeBlocks;
+    nDataBitmapBlocks = (blocksLeft + BITS_PER_BLOCK) / (BITS_PER_BLOCK + 1);
+    nReferenceCountBlocks = (blocksLeft + REFERENCE_COUNTS_PER_BLOCK) / (REFERENCE_COUNTS_PER_BLOCK + 1);
+    nFingerprintBlocks = std::max(blocksLeft / FINGERPRINT_INDEX_DIVISOR, 1);
+
+    iNodeBitmapIndex = journalIndex + nJournalBlocks;
+    dataBitmapIndex = iNodeBitmapIndex + nINodeBitmapBlocks;
+    referenceCountIndex = dataBitmapIndex + nDataBitmapBlocks;
+    fingerprintIndex = referenceCountIndex + nReferenceCountBlocks;
+    checksumIndex = fingerprintIndex + nFingerprintBlocks;
+    firstINodeIndex = checksumIndex + nChecksumBlocks;
+    firstDataIndex = nInodeBlocks + firstINodeIndex;
+    freeBlocks = nBlocks - firstINodeIndex;
+
+    ///record geometry in the superblock
+    superblock.nBlocks = nBlocks;
+    superblock.nInodeBlocks = nInodeBlocks;
+    superblock.iNodeBitmapIndex = iNodeBitmapIndex;
+    superblock.dataBitmapIndex = dataBitmapIndex;
+    superblock.referenceCountIndex = referenceCountIndex;
+    superblock.fingerprintIndex = fingerprintIndex;
+    superblock.nFingerprintBlocks = nFingerprintBlocks;
+    superblock.checksumIndex = checksumIndex;
+    superblock.nChecksumBlocks = nChecksumBlocks;
+    superblock.firstINodeIndex = firstINodeIndex;
+    superblock.firstDataIndex = firstDataIndex;
+    superblock.journalIndex = journalIndex;
+    superblock.nJournalBlocks = nJournalBlocks;
+    superblock.journalSequence = 1;
+
+    iNodeCache.setTable(&diskIO, firstINodeIndex, nInodeBlocks * BLOCK_SIZE / I_NODE_SIZE);
+    journal.setRegion(&diskIO, journalIndex, nJournalBlocks, superblock.journalSequence);
+}
+
+
+
+///function sets virtual disk parameters of existing file system from the superblock
+void VirtualDisk::loadVDiskParameters()
+{
+    nBlocks = superblock.nBlocks;
+    nInodeBlocks = superblock.nInodeBlocks;
+    iNodeBitmapIndex = superblock.iNodeBitmapIndex;
+    dataBitmapIndex = superblock.dataBitmapIndex;
+    referenceCountIndex = superblock.referenceCountIndex;
+    fingerprintIndex = superblock.fingerprintIndex;
+    nFingerprintBlocks = superblock.nFingerprintBlocks;
+    checksumIndex = superblock.checksumIndex;
+    nChecksumBlocks = superblock.nChecksumBlocks;
+    firstINodeIndex = superblock.firstINodeIndex;
+    firstDataIndex = superblock.firstDataIndex;
+    journalIndex = superblock.journalIndex;
+    nJournalBlocks = superblock.nJournalBlocks;
+    freeBlocks = nBlocks - firstINodeIndex;
+    vDiskSize = (int64_t)nBlocks * BLOCK_SIZE;
+
+    iNodeCache.setTable(&diskIO, firstINodeIndex, nInodeBlocks * BLOCK_SIZE / I_NODE_SIZE);
+    journal.setRegion(&diskIO, journalIndex, nJournalBlocks, superblock.journalSequence);
+}
+
+
+
+///function creates empty directory
+///return value: i-number of created directory, -1 if there is no free i-node or block
+short int VirtualDisk::createEmptyDirectory()
+{
+    short int iNumber = allocateINode();
+    int blockAddress = allocateBlock();
+    unsigned char* zeros;
+
+    if(-1 == iNumber || -1 == blockAddress)
+    {
+        std::cerr << "No free i-node or block found for directory!\n";
+        if(-1 != iNumber)
+            changeINodeStatus(iNumber, FREE);
+        if(-1 != blockAddress)
+            changeBlockStatus(blockAddress, FREE);
+        return -1;
+    }
+
+    ///prepare single empty bucket
+    zeros = new unsigned char [BLOCK_SIZE]();
+    blockCache.writeBlock(firstDataIndex + blockAddress, 0, zeros, BLOCK_SIZE);
+    delete [] zeros;
+
+    ///prepare i-node: block address, directory flag, size (one bucket) and link count
+    INode& directory = iNodeCache.resetINode(iNumber);
+    directory.data[0] = blockAddress;
+    directory.isDirectory = true;
+    directory.linkCount = 0;
+    setFileSize(iNumber, BLOCK_SIZE);
+
+    return iNumber;
+}
+
+
+
+///function creates root directory
+void VirtualDisk::createRootDirectory()
+{
+    short int rootINumber = createEmptyDirectory();
+
+    if(-1 == rootINumber)
+    {
+        std::cerr << "Could not create root directory!\n";
+        exit(EXIT_FAILURE);
+    }
+    currentDirectory = rootINumber;
+
+    addDirectoryEntry(rootINumber, rootINumber, ".");
+    addDirectoryEntry(rootINumber, rootINumber, "..");
+
+    writeSuperblock();
+}
+
+
+
+///function creates child directory
+///parameters: i-number of parent directory, name of child directory
+///return value: i-number of created directory, -1 on failure
+short int VirtualDisk::createChildDirectory(uint16_t directoryINumber, char* childName)
+{
+    std::unique_lock<std::shared_mutex> directoryLock(iNodeLocks[directoryINumber]);
+    Operation operation(this);
+    short int childDirectoryINumber = createEmptyDirectory();
+
+    if(-1 == childDirectoryINumber)
+        return -1;
+
+    ///nobody looks into child before "." and ".." are there - it is found only through the parent, locked until then
+    if(-1 == addDirectoryEntry(directoryINumber, childDirectoryINumber, childName))  ///no room in parent - give child back
+    {
+        changeBlockStatus(iNodeCache.getINode(childDirectoryINumber).data[0], FREE);
+        setFileSize(childDirectoryINumber, 0);
+        changeINodeStatus(childDirectoryINumber, FREE);
+        return -1;
+    }
+
+    addDirectoryEntry(childDirectoryINumber, childDirectoryINumber, ".");
+    addDirectoryEntry(childDirectoryINumber, directoryINumber, "..");
+    return childDirectoryINumber;
+}
+
+
+
+///function creates directories of a tree from user system on virtual disk and lists its files
+///parameters: path to directory on user system, i-number of matching directory on virtual disk, list of files to add to (output)
+///return value: -1 if anything could not be copied, else 0
+int VirtualDisk::walkHostDirectory(std::string hostPath, short int directoryINumber, std::vector<ImportedFile>& files)
+{
+    DIR* directory = opendir(hostPath.c_str());
+    struct dirent* entry;
+    struct stat fileStatus;
+    std::vector<std::string> names;
+    std::string childPath;
+    short int childINumber;
+    ImportedFile imported;
+    int returnValue = 0;
+
+    if(NULL == directory)
+    {
+        std::cerr << hostPath << ": could not open directory!\n";
+        return -1;
+    }
+
+    while(NULL != (entry = readdir(directory)))
+        if(0 != strcmp(entry->d_name, ".") && 0 != strcmp(entry->d_name, ".."))
+            names.push_back(entry->d_name);
+    closedir(directory);
+    std::sort(names.begin(), names.end());  ///same tree gives same layout
+
+    for(int i = 0; i < (int)names.size(); ++i)
+    {
+        childPath = hostPath + "/" + names[i];
+        if(-1 == stat(childPath.c_str(), &fileStatus))
+        {
+            std::cerr << childPath << ": could not read file!\n";
+            returnValue = -1;
+        }
+        else if(S_ISDIR(fileStatus.st_mode))
+        {
+            childINumber = createChildDirectory(directoryINumber, (char*)names[i].c_str());
+            if(-1 == childINumber || -1 == walkHostDirectory(childPath, childINumber, files))
+                returnValue = -1;
+        }
+        else if(S_ISREG(fileStatus.st_mode))
+        {
+            imported.hostPath = childPath;
+            imported.directoryINumber = directoryINumber;
+            imported.name = names[i];
+            imported.size = fileStatus.st_size;
+            imported.isRead = false;
+            imported.isStreamed = fileStatus.st_size > MAX_IMPORT_FILE_SIZE;
+            imported.failed = false;
+            files.push_back(imported);
+        }
+    }
+
+    return returnValue;
+}
+
+
+
+///function gets queue of transfers for the calling thread, reusing an idle one if there is any
+///return value: started queue
+AsyncIO* VirtualDisk::acquireQueue()
+{
+    AsyncIO* queue;
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if(!idleQueues.empty())
+        {
+            queue = idleQueues.back();
+            idleQueues.pop_back();
+            return queue;
+        }
+    }
+
+    queue = new AsyncIO;
+    queue->start(queueDepth);
+    return queue;
+}
+
+
+
+///function gives back queue taken with acquireQueue(), every transfer must be collected first
+///parameters: queue to give back
+void VirtualDisk::releaseQueue(AsyncIO* queue)
+{
+    if(queue->getNInFlight() > 0)   ///queue failed - transfers cannot be collected, so it is not used again
+    {
+        delete queue;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(queueMutex);
+    idleQueues.push_back(queue);
+}
+
+
+
+///function finds readahead stream of a file for a read, taking least recently used one if file has none
+///parameters: i-number of file, offset of read, number of bytes of read
+///return value: index of stream (marked busy), -1 if read is not sequential or no stream is free
+int VirtualDisk::takeReadahead(short int iNumber, uint64_t offset, int64_t nBytes)
+{
+    int stream = -1;
+    bool isSequential;
+
+    std::lock_guard<std::mutex> lock(readaheadMutex);
+    ++nReads;
+    for(int i = 0; i < MAX_READAHEAD_STREAMS && -1 == stream; ++i)
+        if(readaheads[i].iNumber == iNumber)
+            stream = i;
+
+    if(-1 == stream)  ///file not followed yet - least recently used free stream is taken over, blocks read for previous file are forgotten
+    {
+        for(int i = 0; i < MAX_READAHEAD_STREAMS; ++i)
+            if(!readaheads[i].isBusy && (-1 == stream || readaheads[i].lastUse < readaheads[stream].lastUse))
+                stream = i;
+        if(-1 == stream)
+            return -1;
+        readaheads[stream].iNumber = iNumber;
+        readaheads[stream].nextOffset = 0;
+        readaheads[stream].firstBlock = 0;
+        readaheads[stream].nBlocks = 0;
+    }
+    else if(readaheads[stream].isBusy)  ///another thread reads the same file right now
+        return -1;
+
+    isSequential = (0 == offset || offset == readaheads[stream].nextOffset);
+    readaheads[stream].lastUse = nReads;
+    readaheads[stream].nextOffset = offset + nBytes;
+    if(!isSequential)
+        return -1;
+
+    readaheads[stream].isBusy = true;
+    return stream;
+}
+
+
+
+///function gives back readahead stream taken with takeReadahead()
+///parameters: index of stream
+void VirtualDisk::leaveReadahead(int stream)
+{
+    std::lock_guard<std::mutex> lock(readaheadMutex);
+    readaheads[stream].isBusy = false;
+}
+
+
+
+///function forgets blocks read ahead for a file (called when the file changes)
+///parameters: i-number of file
+void VirtualDisk::dropReadahead(short int iNumber)
+{
+    std::lock_guard<std::mutex> lock(readaheadMutex);
+    for(int i = 0; i < MAX_READAHEAD_STREAMS; ++i)
+        if(readaheads[i].iNumber == iNumber)    ///stream cannot be busy - the file is locked exclusively by its writer
+        {
+            readaheads[i].iNumber = -1;
+            readaheads[i].nBlocks = 0;
+        }
+}
+
+
+
+///function waits for blocks of a readahead stream still in flight, forgetting the buffer if any could not be read
+///parameters: readahead stream
+void VirtualDisk::waitForReadahead(Readahead& readahead)
+{
+    uint64_t expectedBytes;
+    int64_t bytesDone;
+
+    while(readahead.queue->getNInFlight() > 0)
+    {
+        if(-1 == readahead.queue->waitForCompletion(expectedBytes, bytesDone))  ///queue failed
+        {
+            readahead.nBlocks = 0;
+            return;
+        }
+        if(bytesDone != (int64_t)expectedBytes)
+            readahead.nBlocks = 0;
+    }
+}
+
+
+
+///function checks blocks which arrived in buffer of a readahead stream against their checksums, forgetting the buffer if one does not match
+///parameters: readahead stream, i-number of file, block map of the file (NULL if none)
+void VirtualDisk::checkReadahead(Readahead& readahead, short int iNumber, const uint32_t* blockMap)
+{
+    INode& file = iNodeCache.getINode(iNumber);
+    int64_t firstIndex = readahead.firstBlock + readahead.nCheckedBlocks;
+    int count = readahead.nBlocks - readahead.nCheckedBlocks;
+    uint32_t* blockAddresses;
+    int runLength;
+    int nBytes;
+
+    readahead.nCheckedBlocks = readahead.nBlocks;
+    if(count <= 0)
+        return;
+
+    blockAddresses = new uint32_t [count];
+    getBlockAddresses(iNumber, blockMap, firstIndex, count, blockAddresses);
+    for(int i = 0; i < count; i += runLength)
+    {
+        runLength = countContiguousBlocks(blockAddresses + i, count - i);
+        if(NO_BLOCK == blockAddresses[i])
+            continue;
+
+        ///damaged block is read again without readahead, which reports it
+        nBytes = (int)std::min((int64_t)runLength * BLOCK_SIZE, (int64_t)file.size - (firstIndex + i) * BLOCK_SIZE);
+        if(-1 == diskIO.verifyBytes(firstDataIndex + blockAddresses[i], 0, readahead.buffer + (int64_t)(readahead.nBlocks - count + i) * BLOCK_SIZE, nBytes))
+        {
+            readahead.nBlocks = 0;
+            readahead.nCheckedBlocks = 0;
+            break;
+        }
+    }
+
+    delete [] blockAddresses;
+}
+
+
+
+///function starts reading blocks of a file into buffer of a readahead stream without waiting
+///parameters: readahead stream, i-number of file, block map of the file (NULL if none), index of first block within file, position within buffer, number of blocks
+///return value: -1 if a read already finished with an error, else 0
+int VirtualDisk::startReadahead(Readahead& readahead, short int iNumber, const uint32_t* blockMap, int64_t firstIndex, int bufferIndex, int count)
+{
+    INode& file = iNodeCache.getINode(iNumber);
+    uint32_t* blockAddresses = new uint32_t [count];
+    unsigned char* destination;
+    int runLength;
+    int nBytes;
+    uint64_t expectedBytes;
+    int64_t bytesDone;
+    bool failed = false;
+
+    getBlockAddresses(iNumber, blockMap, firstIndex, count, blockAddresses);
+    for(int i = 0; i < count && !failed; i += runLength)
+    {
+        runLength = countContiguousBlocks(blockAddresses + i, count - i);
+        nBytes = (int)std::min((int64_t)runLength * BLOCK_SIZE, (int64_t)file.size - (firstIndex + i) * BLOCK_SIZE);
+        destination = readahead.buffer + (int64_t)(bufferIndex + i) * BLOCK_SIZE;
+
+        if(NO_BLOCK == blockAddresses[i])   ///hole - nothing to read
+        {
+            memset(destination, 0, nBytes);
+            continue;
+        }
+
+        ///number of bytes asked for is handed back on completion, so short reads are noticed
+        while(-1 == diskIO.submitRead(*readahead.queue, firstDataIndex + blockAddresses[i], 0, destination, nBytes, nBytes))
+        {
+            ///queue is full - a finished read makes room
+            if(-1 == readahead.queue->waitForCompletion(expectedBytes, bytesDone) || bytesDone != (int64_t)expectedBytes)
+            {
+                failed = true;
+                break;
+            }
+        }
+    }
+
+    delete [] blockAddresses;
+    return failed ? -1 : 0;
+}
+
+
+
+///function reads bytes of a file straight from its blocks, holes read as zeros
+///parameters: i-number of file, block map of the file (NULL if none), offset within file, number of bytes (within file size), destination buffer
+///return value: -1 if a block could not be read, else 0
+int VirtualDisk::readFileBlocks(short int iNumber, const uint32_t* blockMap, uint64_t offset, int64_t nBytes, unsigned char* destination)
+{
+    uint32_t* blockAddresses;
+    int64_t index = (int64_t)(offset / BLOCK_SIZE);   ///index within file of next block to read
+    int offsetInBlock = (int)(offset % BLOCK_SIZE);
+    int nAddresses;
+    int runLength;
+    int runBytes;
+    bool failed = false;
+
+    blockAddresses = new uint32_t [MAX_TRANSFER_BLOCKS];
+    while(nBytes > 0 && !failed)
+    {
+        ///read next part of block addresses
+        nAddresses = (int)std::min((offsetInBlock + nBytes + BLOCK_SIZE - 1) / BLOCK_SIZE, (int64_t)MAX_TRANSFER_BLOCKS);
+        getBlockAddresses(iNumber, blockMap, index, nAddresses, blockAddresses);
+
+        for(int j = 0; j < nAddresses && !failed; j += runLength)
+        {
+            runLength = countContiguousBlocks(blockAddresses + j, nAddresses - j);
+            runBytes = (int)std::min((int64_t)runLength * BLOCK_SIZE - offsetInBlock, nBytes);
+
+            if(NO_BLOCK == blockAddresses[j])
+                memset(destination, 0, runBytes);
+            else if(runBytes != blockCache.readBlocks(firstDataIndex + blockAddresses[j], offsetInBlock, destination, runBytes))
+            {
+                std::cerr << "Could not read the entire block!\n";
+                failed = true;
+            }
+            destination += runBytes;
+            nBytes -= runBytes;
+            offsetInBlock = 0;
+        }
+        index += nAddresses;
+    }
+
+    delete [] blockAddresses;
+    return failed ? -1 : 0;
+}
+
+
+
+///function reads bytes of a file, through readahead when reads are sequential (caller holds lock of the i-node)
+///parameters: i-number of file, block map of the file (NULL if none), offset within file, number of bytes, destination buffer
+///return value: number of bytes read (less than asked at end of file), -1 on failure
+int64_t VirtualDisk::readFile(short int iNumber, const uint32_t* blockMap, uint64_t offset, int64_t nBytes, void* destination)
+{
+    INode& file = iNodeCache.getINode(iNumber);
+    unsigned char* target = (unsigned char*)destination;
+    int stream;
+    int64_t countBlocks;
+    int64_t nextBlock;     ///block where next sequential read starts
+    int64_t windowEnd;     ///index within file of first block after those in buffer
+    int64_t from;          ///part of read found in buffer: from..to
+    int64_t to;
+    int kept;
+    int count;
+    bool failed = false;
+
+    if(nBytes <= 0 || offset >= file.size)
+        return 0;
+    nBytes = std::min(nBytes, (int64_t)(file.size - offset));
+
+    if(file.chunkBlocks > 0)    ///compressed file - chunks are read and decompressed as they are needed
+        return readChunks(iNumber, blockMap, offset, nBytes, target) ? -1 : nBytes;
+
+    stream = takeReadahead(iNumber, offset, nBytes);
+    if(-1 == stream)
+        return readFileBlocks(iNumber, blockMap, offset, nBytes, target) ? -1 : nBytes;
+
+    Readahead& readahead = readaheads[stream];
+    if(NULL == readahead.buffer)
+    {
+        readahead.buffer = new unsigned char [READAHEAD_BLOCKS * BLOCK_SIZE];
+        readahead.queue = acquireQueue();
+    }
+    waitForReadahead(readahead);
+    checkReadahead(readahead, iNumber, blockMap);
+
+
+    ///part of the read already in buffer is copied, the rest is read from the blocks
+    from = std::max((int64_t)offset, readahead.firstBlock * BLOCK_SIZE);
+    to = std::min((int64_t)offset + nBytes, (readahead.firstBlock + readahead.nBlocks) * BLOCK_SIZE);
+    if(from < to)
+    {
+        memcpy(target + (from - (int64_t)offset), readahead.buffer + (from - readahead.firstBlock * BLOCK_SIZE), to - from);
+        if(from > (int64_t)offset && -1 == readFileBlocks(iNumber, blockMap, offset, from - offset, target))
+            failed = true;
+        if(!failed && to < (int64_t)offset + nBytes && -1 == readFileBlocks(iNumber, blockMap, to, offset + nBytes - to, target + (to - offset)))
+            failed = true;
+    }
+    else if(-1 == readFileBlocks(iNumber, blockMap, offset, nBytes, target))
+        failed = true;
+
+
+    ///window slides to where next read starts once less than half of it is left ahead
+    countBlocks = (file.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    nextBlock = (offset + nBytes) / BLOCK_SIZE;
+    windowEnd = readahead.firstBlock + readahead.nBlocks;
+    if(nextBlock < readahead.firstBlock || nextBlock >= windowEnd)
+    {
+        readahead.firstBlock = nextBlock;
+        readahead.nBlocks = 0;
+        windowEnd = nextBlock;
+    }
+    if(!failed && windowEnd - nextBlock < READAHEAD_BLOCKS / 2 && windowEnd < countBlocks)
+    {
+        kept = (int)(windowEnd - nextBlock);
+        memmove(readahead.buffer, readahead.buffer + (nextBlock - readahead.firstBlock) * BLOCK_SIZE, (int64_t)kept * BLOCK_SIZE);
+        readahead.firstBlock = nextBlock;
+        count = (int)std::min((int64_t)(READAHEAD_BLOCKS - kept), countBlocks - windowEnd);
+        readahead.nCheckedBlocks = kept;
+        if(-1 == startReadahead(readahead, iNumber, blockMap, windowEnd, kept, count))
+            readahead.nBlocks = 0;
+        else
+            readahead.nBlocks = kept + count;
+    }
+
+    leaveReadahead(stream);
+    return failed ? -1 : nBytes;
+}
+
+
+
+///function copies blocks of a file stored plainly into a file on user system inside the kernel, run by run - holes are left out (caller holds lock of the i-node)
+///parameters: i-number of file, descriptor of target file
+///return value: -1 if a block could not be copied, else 0
+int VirtualDisk::copyFileBlocks(short int iNumber, int targetFile)
+{
+    INode& file = iNodeCache.getINode(iNumber);
+    uint32_t* blockAddresses = new uint32_t [MAX_TRANSFER_BLOCKS];
+    int64_t countBlocks = (int64_t)((file.size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    int64_t runBytes;
+    int nAddresses;
+    int runLength;
+    bool failed = false;
+
+    ///data of such files never waits in the block cache (only metadata does), so the image holds it
+    for(int64_t i = 0; i < countBlocks && !failed; i += nAddresses)
+    {
+        nAddresses = (int)std::min(countBlocks - i, (int64_t)MAX_TRANSFER_BLOCKS);
+        getBlockAddresses(iNumber, NULL, i, nAddresses, blockAddresses);
+
+        for(int j = 0; j < nAddresses; j += runLength)
+        {
+            runLength = countContiguousBlocks(blockAddresses + j, nAddresses - j);
+            if(NO_BLOCK == blockAddresses[j])
+                continue;
+
+            runBytes = std::min((int64_t)runLength * BLOCK_SIZE, (int64_t)file.size - (i + j) * BLOCK_SIZE);
+            if(runBytes != diskIO.copyToFile(firstDataIndex + blockAddresses[j], 0, targetFile, (i + j) * BLOCK_SIZE, runBytes))
+            {
+                std::cerr << "Could not read the entire block!\n";
+                failed = true;
+                break;
+            }
+        }
+    }
+
+    delete [] blockAddresses;
+    return failed ? -1 : 0;
+}
+
+
+
+///function gets addresses of consecutive blocks of a file, from block map of a handle if there is one
+///parameters: i-number of file, block map of the file (NULL to read addresses from i-node and indirect blocks), index of first block within file, number of addresses, destination buffer
+void VirtualDisk::getBlockAddresses(short int iNumber, const uint32_t* blockMap, int64_t firstIndex, int count, uint32_t* blockAddresses)
+{
+    if(NULL != blockMap)
+        memcpy(blockAddresses, blockMap + firstIndex, count * ADDRESS_SIZE);
+    else
+        readBlockAddresses(iNumber, (int)firstIndex, count, blockAddresses);
+}
+
+
+
+///function gets a handle returned by open()
+///parameters: handle
+///return value: handle data, NULL if handle is not open
+VirtualDisk::FileHandle* VirtualDisk::getHandle(int handle)
+{
+    std::lock_guard<std::mutex> lock(handleMutex);
+
+    if(handle < 0 || handle >= MAX_OPEN_FILES || !fileHandles[handle].isOpen)
+    {
+        std::cerr << "Bad file handle!\n";
+        return NULL;
+    }
+    return fileHandles + handle;
+}
+
+
+
+///function checks that file of a handle still exists (caller holds lock of the i-node and of the block map), reading block map again if addresses changed
+///parameters: handle data
+///return value: -1 if the file was deleted, else 0
+int VirtualDisk::checkHandle(FileHandle& fileHandle)
+{
+    int countBlocks;
+    INode& file = iNodeCache.getINode(fileHandle.iNumber);
+
+    if(iNodeGenerations[fileHandle.iNumber] != fileHandle.generation)
+    {
+        std::cerr << "File no longer exists!\n";
+        return -1;
+    }
+
+    if(!fileHandle.isMapRead || fileHandle.mapVersion != blockMapVersions[fileHandle.iNumber])
+    {
+        countBlocks = (int)countFileBlocks(file.size, file.chunkBlocks);
+        fileHandle.blockMap.resize(countBlocks);
+        if(countBlocks > 0)
+            readBlockAddresses(fileHandle.iNumber, 0, countBlocks, fileHandle.blockMap.data());
+        fileHandle.mapVersion = blockMapVersions[fileHandle.iNumber];
+        fileHandle.isMapRead = true;
+    }
+    return 0;
+}
+
+
+
+///function changes size of a file - blocks past the new end are freed, bytes added are a hole (caller holds exclusive lock of the i-node)
+///parameters: i-number of file, new size (within MAX_FILE_SIZE_IN_BLOCKS blocks)
+///return value: -1 if last chunk of a compressed file or last block of a deduplicated file could not be stored again (size stays), else 0
+int VirtualDisk::resizeFile(short int iNumber, uint64_t newSize)
+{
+    INode& file = iNodeCache.getINode(iNumber);
+    uint32_t lastBlockAddress;
+    int bytesUsedInLastBlock;
+    unsigned char* zeros;
+    unsigned char* buffer;
+    unsigned char* block;
+    int chunkBytes = file.chunkBlocks * BLOCK_SIZE;
+    int returnValue = 0;
+
+    dropReadahead(iNumber);
+
+    ///chunk of a compressed file cut in the middle is stored again without bytes past the new end, so bytes added later read as zeros
+    if(file.chunkBlocks > 0 && newSize < file.size && 0 != newSize % chunkBytes)
+    {
+        buffer = new unsigned char [chunkBytes];
+        if(-1 == readChunk(iNumber, NULL, newSize / chunkBytes, buffer) || -1 == writeChunk(iNumber, newSize / chunkBytes, buffer, newSize % chunkBytes))
+            returnValue = -1;
+        delete [] buffer;
+        if(-1 == returnValue)
+            return -1;
+    }
+
+    if(newSize < file.size)         ///free last blocks
+        freeFileBlocks(iNumber, (int)countFileBlocks(newSize, file.chunkBlocks), (int)countFileBlocks(file.size, file.chunkBlocks));
+    else if(newSize > file.size && 0 == file.chunkBlocks)   ///rest of last block may hold bytes left from before - they become part of the file, so they are cleared
+    {
+        bytesUsedInLastBlock = (int)(file.size % BLOCK_SIZE);
+        if(bytesUsedInLastBlock > 0)
+        {
+            readBlockAddresses(iNumber, (int)(file.size / BLOCK_SIZE), 1, &lastBlockAddress);
+            if(NO_BLOCK != lastBlockAddress && !file.isDeduplicated)
+            {
+                zeros = new unsigned char [BLOCK_SIZE - bytesUsedInLastBlock]();
+                blockCache.dropBlocks(firstDataIndex + lastBlockAddress, 1);    ///cached copy would go stale
+                diskIO.writeBytes(firstDataIndex + lastBlockAddress, bytesUsedInLastBlock, zeros, BLOCK_SIZE - bytesUsedInLastBlock);
+                blockCache.dropBlocks(firstDataIndex + lastBlockAddress, 1);    ///so would a copy read while it was written
+                delete [] zeros;
+            }
+            else if(NO_BLOCK != lastBlockAddress)     ///block may be shared - it is stored again, unless its rest is zeros already
+            {
+                block = new unsigned char [BLOCK_SIZE];
+                zeros = new unsigned char [BLOCK_SIZE - bytesUsedInLastBlock]();
+                if(BLOCK_SIZE != blockCache.readBlock(firstDataIndex + lastBlockAddress, 0, block, BLOCK_SIZE))
+                {
+                    std::cerr << "Could not read the entire block!\n";
+                    returnValue = -1;
+                }
+                else if(0 != memcmp(block + bytesUsedInLastBlock, zeros, BLOCK_SIZE - bytesUsedInLastBlock))
+                {
+                    memset(block + bytesUsedInLastBlock, 0, BLOCK_SIZE - bytesUsedInLastBlock);
+                    returnValue = replaceBlock(iNumber, (int)(file.size / BLOCK_SIZE), lastBlockAddress, block);
+                }
+                delete [] zeros;
+                delete [] block;
+                if(-1 == returnValue)
+                    return -1;
+            }
+        }
+    }
+
+    ///write size of file - addresses of blocks added stay NO_BLOCK
+    setFileSize(iNumber, newSize);
+    return 0;
+}
+
+
+
+///function counts block addresses a file of given size uses - a compressed file uses whole chunks
+///parameters: size of file (in bytes), blocks in a chunk (0 if file is not compressed)
+///return value: number of blocks from the beginning of the file which may have addresses
+int64_t VirtualDisk::countFileBlocks(uint64_t size, int chunkBlocks)
+{
+    int64_t countBlocks = (int64_t)((size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+    if(chunkBlocks > 0)
+        countBlocks = (countBlocks + chunkBlocks - 1) / chunkBlocks * chunkBlocks;
+    return countBlocks;
+}
+
+
+
+///function reads and decompresses one chunk of a compressed file
+///parameters: i-number of file, block map of the file (NULL if none), index of chunk, destination buffer (a whole chunk, bytes past those stored read as zeros)
+///return value: -1 if the chunk could not be read or is damaged, else 0
+int VirtualDisk::readChunk(short int iNumber, const uint32_t* blockMap, int64_t chunkIndex, unsigned char* destination)
+{
+    int chunkBlocks = iNodeCache.getINode(iNumber).chunkBlocks;
+    uint32_t* blockAddresses = new uint32_t [chunkBlocks];
+    unsigned char* buffer;
+    uint32_t storedBytes;
+    int nBlocks = 0;
+    int runLength;
+    bool failed = false;
+
+    getBlockAddresses(iNumber, blockMap, chunkIndex * chunkBlocks, chunkBlocks, blockAddresses);
+    while(nBlocks < chunkBlocks && NO_BLOCK != blockAddresses[nBlocks])
+        ++nBlocks;
+
+    ///chunk taking all its blocks is stored as it is, chunk with no blocks is a hole
+    buffer = nBlocks == chunkBlocks ? destination : new unsigned char [chunkBlocks * BLOCK_SIZE];
+    memset(destination, 0, chunkBlocks * BLOCK_SIZE);
+    for(int i = 0; i < nBlocks && !failed; i += runLength)
+    {
+        runLength = countContiguousBlocks(blockAddresses + i, nBlocks - i);
+        if(runLength * BLOCK_SIZE != blockCache.readBlocks(firstDataIndex + blockAddresses[i], 0, buffer + i * BLOCK_SIZE, runLength * BLOCK_SIZE))
+        {
+            std::cerr << "Could not read the entire block!\n";
+            failed = true;
+        }
+    }
+
+    if(!failed && nBlocks > 0 && nBlocks < chunkBlocks)
+    {
+        memcpy(&storedBytes, buffer, CHUNK_HEADER_SIZE);
+        if(storedBytes > (uint32_t)(nBlocks * BLOCK_SIZE - CHUNK_HEADER_SIZE) || -1 == Codec::decompress(buffer + CHUNK_HEADER_SIZE, (int)storedBytes, destination, chunkBlocks * BLOCK_SIZE))
+        {
+            std::cerr << "Compressed data is damaged!\n";
+            failed = true;
+        }
+    }
+
+    if(buffer != destination)
+        delete [] buffer;
+    delete [] blockAddresses;
+    return failed ? -1 : 0;
+}
+
+
+
+///function compresses one chunk of a file and stores it in new blocks, freeing blocks the chunk had before (a failure leaves the old chunk)
+///parameters: i-number of file, index of chunk, bytes of chunk, number of bytes (at most a whole chunk)
+///return value: -1 on failure, else 0
+int VirtualDisk::writeChunk(short int iNumber, int64_t chunkIndex, const unsigned char* data, int nBytes)
+{
+    int chunkBlocks = iNodeCache.getINode(iNumber).chunkBlocks;
+    unsigned char* buffer = new unsigned char [chunkBlocks * BLOCK_SIZE]();
+    uint32_t* oldAddresses = new uint32_t [chunkBlocks];
+    uint32_t* newAddresses = new uint32_t [chunkBlocks]();   ///all NO_BLOCK
+    uint32_t storedBytes;
+    int compressedBytes;
+    int nBlocks;
+    int nAllocated = 0;
+    int nWritten;
+    int firstBlock;
+    int runLength;
+    bool failed = false;
+
+    readBlockAddresses(iNumber, (int)(chunkIndex * chunkBlocks), chunkBlocks, oldAddresses);
+
+    ///chunk of zeros is a hole, chunk which does not fit in fewer blocks compressed is stored as it is (only such chunk takes all its blocks)
+    if(0 == nBytes || (0 == data[0] && 0 == memcmp(data, data + 1, nBytes - 1)))
+        nBlocks = 0;
+    else
+    {
+        compressedBytes = Codec::compress(data, nBytes, buffer + CHUNK_HEADER_SIZE, (chunkBlocks - 1) * BLOCK_SIZE - CHUNK_HEADER_SIZE);
+        if(compressedBytes > 0)
+        {
+            storedBytes = (uint32_t)compressedBytes;
+            memcpy(buffer, &storedBytes, CHUNK_HEADER_SIZE);
+            nBlocks = (CHUNK_HEADER_SIZE + compressedBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        }
+        else
+        {
+            memcpy(buffer, data, nBytes);
+            nBlocks = chunkBlocks;
+        }
+    }
+
+    ///new blocks are written before addresses point to them
+    while(nAllocated < nBlocks && !failed)
+    {
+        firstBlock = allocateBlockRun(nBlocks - nAllocated, runLength);
+        if(-1 == firstBlock)
+        {
+            std::cerr << "No free block found (not enough free space)!\n";
+            failed = true;
+            break;
+        }
+        if(isJournaling)    ///data goes to the run directly, older images of its blocks must not be replayed over it
+            journal.revokeBlocks(firstDataIndex + firstBlock, runLength);
+        blockCache.dropBlocks(firstDataIndex + firstBlock, runLength);     ///cached copies of freed blocks must not be written back over new data
+        for(int i = 0; i < runLength; ++i)
+            newAddresses[nAllocated + i] = firstBlock + i;
+        nAllocated += runLength;
+
+        if(runLength * BLOCK_SIZE != diskIO.writeBytes(firstDataIndex + firstBlock, 0, buffer + (nAllocated - runLength) * BLOCK_SIZE, runLength * BLOCK_SIZE))
+        {
+            std::cerr << "Could not write the entire block!\n";
+            failed = true;
+        }
+    }
+
+    if(!failed)
+    {
+        nWritten = writeBlockAddresses(iNumber, (int)(chunkIndex * chunkBlocks), chunkBlocks, newAddresses);
+        if(nWritten < chunkBlocks)  ///no block for indirect block - addresses written so far are put back
+        {
+            std::cerr << "No free block found (not enough free space)!\n";
+            writeBlockAddresses(iNumber, (int)(chunkIndex * chunkBlocks), nWritten, oldAddresses);
+            failed = true;
+        }
+    }
+
+    ///blocks which are not part of the file any more are freed
+    for(int i = 0; i < chunkBlocks; ++i)
+    {
+        if(failed && i < nAllocated)
+            changeBlockStatus(newAddresses[i], FREE);
+        else if(!failed && NO_BLOCK != oldAddresses[i])
+            changeBlockStatus(oldAddresses[i], FREE);
+    }
+
+    delete [] newAddresses;
+    delete [] oldAddresses;
+    delete [] buffer;
+    return failed ? -1 : 0;
+}
+
+
+
+///function reads bytes of a compressed file, decompressing every chunk they fall into
+///parameters: i-number of file, block map of the file (NULL if none), offset within file, number of bytes (within file size), destination buffer
+///return value: -1 if a chunk could not be read, else 0
+int VirtualDisk::readChunks(short int iNumber, const uint32_t* blockMap, uint64_t offset, int64_t nBytes, unsigned char* destination)
+{
+    int chunkBytes = iNodeCache.getINode(iNumber).chunkBlocks * BLOCK_SIZE;
+    unsigned char* buffer = NULL;
+    int offsetInChunk;
+    int n;
+    bool failed = false;
+
+    while(nBytes > 0 && !failed)
+    {
+        offsetInChunk = (int)(offset % chunkBytes);
+        n = (int)std::min((int64_t)(chunkBytes - offsetInChunk), nBytes);
+
+        if(0 == offsetInChunk && n == chunkBytes)  ///whole chunk goes straight to destination
+            failed = -1 == readChunk(iNumber, blockMap, offset / chunkBytes, destination);
+        else
+        {
+            if(NULL == buffer)
+                buffer = new unsigned char [chunkBytes];
+            failed = -1 == readChunk(iNumber, blockMap, offset / chunkBytes, buffer);
+            memcpy(destination, buffer + offsetInChunk, n);
+        }
+
+        offset += n;
+        destination += n;
+        nBytes -= n;
+    }
+
+    delete [] buffer;
+    return failed ? -1 : 0;
+}
+
+
+
+///function writes bytes of a compressed file (within its size), storing every chunk they fall into again
+///parameters: i-number of file, offset within file, number of bytes, source buffer
+///return value: -1 on failure, else 0
+int VirtualDisk::writeChunks(short int iNumber, uint64_t offset, int64_t nBytes, const unsigned char* source)
+{
+    INode& file = iNodeCache.getINode(iNumber);
+    int chunkBytes = file.chunkBlocks * BLOCK_SIZE;
+    unsigned char* buffer = new unsigned char [chunkBytes];
+    int64_t chunkIndex;
+    int offsetInChunk;
+    int validBytes;     ///bytes of chunk within file size
+    int n;
+    bool failed = false;
+
+    while(nBytes > 0 && !failed)
+    {
+        chunkIndex = (int64_t)(offset / chunkBytes);
+        offsetInChunk = (int)(offset % chunkBytes);
+        n = (int)std::min((int64_t)(chunkBytes - offsetInChunk), nBytes);
+        validBytes = (int)std::min((uint64_t)chunkBytes, file.size - (uint64_t)chunkIndex * chunkBytes);
+
+        ///chunk written only in part is read first
+        if((0 != offsetInChunk || n != validBytes) && -1 == readChunk(iNumber, NULL, chunkIndex, buffer))
+            failed = true;
+        else
+        {
+            memcpy(buffer + offsetInChunk, source, n);
+            failed = -1 == writeChunk(iNumber, chunkIndex, buffer, validBytes);
+        }
+
+        offset += n;
+        source += n;
+        nBytes -= n;
+    }
+
+    delete [] buffer;
+    return failed ? -1 : 0;
+}
+
+
+
+///function fills a new compressed file with data read from a stream, chunk by chunk, each chunk stored as one operation
+///parameters: i-number of file (empty, not in any directory yet), stream to read data from (NULL if there is no data), number of bytes stored (output)
+///return value: -1 on failure, else 0
+int VirtualDisk::fillCompressedFile(short int iNumber, FILE* source, uint64_t& fileSize)
+{
+    int chunkBytes = COMPRESSION_CHUNK_BLOCKS * BLOCK_SIZE;
+    unsigned char* buffer = new unsigned char [chunkBytes];
+    int bytesRead;
+    int returnValue = 0;
+
+    fileSize = 0;
+    for(int64_t chunkIndex = 0; NULL != source; ++chunkIndex)
+    {
+        bytesRead = fread(buffer, 1, chunkBytes, source);
+        if(ferror(source))
+        {
+            std::cerr << "Error reading file to copy!\n";
+            returnValue = -1;
+            break;
+        }
+        if(bytesRead <= 0)
+            break;
+        if((chunkIndex + 1) * COMPRESSION_CHUNK_BLOCKS > MAX_FILE_SIZE_IN_BLOCKS)
+        {
+            std::cerr << "File would be too big! Copying file stopped.\n";
+            returnValue = -1;
+            break;
+        }
+
+        Operation operation(this);
+        if(-1 == writeChunk(iNumber, chunkIndex, buffer, bytesRead))
+        {
+            std::cerr << "Copying file stopped.\n";
+            returnValue = -1;
+            break;
+        }
+
+        fileSize += bytesRead;
+        if(bytesRead < chunkBytes)  ///end of file
+            break;
+    }
+
+    delete [] buffer;
+    return returnValue;
+}
+
+
+
+///function computes fingerprint of a block of data (XXH64 rounds over 64-bit words)
+///parameters: bytes of block
+///return value: fingerprint of block
+uint64_t VirtualDisk::fingerprintBlock(const unsigned char* data)
+{
+    const uint64_t prime1 = 11400714785074694791ull;
+    const uint64_t prime2 = 14029467366897019727ull;
+    uint64_t hash = prime1;
+    uint64_t word;
+
+    for(int i = 0; i < BLOCK_SIZE; i += (int)sizeof(word))
+    {
+        memcpy(&word, data + i, sizeof(word));
+        hash += word * prime2;
+        hash = ((hash << 31) | (hash >> 33)) * prime1;
+    }
+
+    ///mix all bits into the lower ones (bucket) and the upper ones (fingerprint kept in the entry)
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+
+
+///function finds a block with the same data in the fingerprint index and takes a reference to it
+///parameters: bytes of block, fingerprint of block
+///return value: address of block holding the same data, NO_BLOCK if there is none
+uint32_t VirtualDisk::findDuplicateBlock(const unsigned char* data, uint64_t fingerprint)
+{
+    uint32_t* entries = new uint32_t [FINGERPRINTS_PER_BLOCK * 2];
+    unsigned char* candidate = new unsigned char [BLOCK_SIZE];
+    uint32_t shortFingerprint = (uint32_t)(fingerprint >> 32);
+    uint32_t blockAddress = NO_BLOCK;
+
+    blockCache.readBlock(fingerprintIndex + fingerprint % nFingerprintBlocks, 0, entries, BLOCK_SIZE);
+    for(int i = 0; i < FINGERPRINTS_PER_BLOCK && NO_BLOCK == blockAddress; ++i)
+    {
+        if(NO_BLOCK == entries[2 * i + 1] || shortFingerprint != entries[2 * i] || !referenceBlock(entries[2 * i + 1]))
+            continue;
+
+        ///block can not be freed or changed while the reference is held, so its data is compared only now
+        if(BLOCK_SIZE == blockCache.readBlock(firstDataIndex + entries[2 * i + 1], 0, candidate, BLOCK_SIZE) && 0 == memcmp(candidate, data, BLOCK_SIZE))
+            blockAddress = entries[2 * i + 1];
+        else
+            changeBlockStatus(entries[2 * i + 1], FREE);   ///same fingerprint, other data - reference is dropped
+    }
+
+    delete [] candidate;
+    delete [] entries;
+    return blockAddress;
+}
+
+
+
+///function adds a block written by a deduplicated copy to the fingerprint index
+///parameters: address of block, fingerprint of its data
+void VirtualDisk::indexBlock(uint32_t blockAddress, uint64_t fingerprint)
+{
+    uint32_t* entries = new uint32_t [FINGERPRINTS_PER_BLOCK * 2];
+    int64_t bucket = fingerprintIndex + fingerprint % nFingerprintBlocks;
+    int slot;
+
+    {
+        std::lock_guard<std::mutex> lock(allocationMutex);
+        setReferenceCount(blockAddress, REFERENCE_INDEXED);
+        ++superblock.nIndexedBlocks;
+    }
+
+    ///entry goes to an empty slot - in a full bucket it takes the place of an older one, chosen by fingerprint
+    blockCache.readBlock(bucket, 0, entries, BLOCK_SIZE);
+    slot = (int)((fingerprint >> 32) % FINGERPRINTS_PER_BLOCK);
+    for(int i = 0; i < FINGERPRINTS_PER_BLOCK; ++i)
+    {
+        if(NO_BLOCK == entries[2 * i + 1])
+        {
+            slot = i;
+            break;
+        }
+    }
+
+    entries[2 * slot] = (uint32_t)(fingerprint >> 32);
+    entries[2 * slot + 1] = blockAddress;
+    blockCache.writeBlock(bucket, slot * FINGERPRINT_ENTRY_SIZE, entries + 2 * slot, FINGERPRINT_ENTRY_SIZE);
+    delete [] entries;
+}
+
+
+
+///function fills a new deduplicated file with data read from a stream, each part stored as one operation - blocks already on the disk are shared, blocks of zeros are holes
+///parameters: i-number of file (empty, not in any directory yet), stream to read data from (NULL if there is no data), number of bytes stored (output)
+///return value: -1 on failure, else 0
+int VirtualDisk::fillDeduplicatedFile(short int iNumber, FILE* source, uint64_t& fileSize)
+{
+    unsigned char* buffer = new unsigned char [MAX_TRANSFER_BLOCKS * BLOCK_SIZE];
+    uint32_t* blockAddresses = new uint32_t [MAX_TRANSFER_BLOCKS];
+    uint64_t* fingerprints = new uint64_t [MAX_TRANSFER_BLOCKS];
+    int* sameAs = new int [MAX_TRANSFER_BLOCKS];    ///earlier new block of the same part with the same data, -1 if none
+    bool* isNew = new bool [MAX_TRANSFER_BLOCKS];   ///whether block needs a block of its own
+    unsigned char* block;
+    int bytesRead;
+    int nBlocksRead;
+    int firstBlock;
+    int runLength;
+    int nWritten;
+    bool failed;
+    int returnValue = 0;
+
+    fileSize = 0;
+
+    ///file is read part by part, every block of a part is looked up before blocks are allocated for new ones
+    for(int index = 0; NULL != source; index += nBlocksRead)
+    {
+        bytesRead = fread(buffer, 1, MAX_TRANSFER_BLOCKS * BLOCK_SIZE, source);
+        if(ferror(source))
+        {
+            std::cerr << "Error reading file to copy!\n";
+            returnValue = -1;
+            break;
+        }
+        if(bytesRead <= 0)
+            break;
+        nBlocksRead = (bytesRead + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if(index + nBlocksRead > MAX_FILE_SIZE_IN_BLOCKS)
+        {
+            std::cerr << "File would be too big! Copying file stopped.\n";
+            returnValue = -1;
+            break;
+        }
+        memset(buffer + bytesRead, 0, nBlocksRead * BLOCK_SIZE - bytesRead);
+
+        Operation operation(this);
+
+        ///block of zeros is a hole, block found in the index is shared, block equal to an earlier new one shares it
+        for(int i = 0; i < nBlocksRead; ++i)
+        {
+            block = buffer + i * BLOCK_SIZE;
+            blockAddresses[i] = NO_BLOCK;
+            sameAs[i] = -1;
+            isNew[i] = false;
+            if(0 == block[0] && 0 == memcmp(block, block + 1, BLOCK_SIZE - 1))
+                continue;
+
+            fingerprints[i] = fingerprintBlock(block);
+            for(int j = 0; j < i && -1 == sameAs[i]; ++j)
+                if(isNew[j] && fingerprints[j] == fingerprints[i] && 0 == memcmp(buffer + j * BLOCK_SIZE, block, BLOCK_SIZE))
+                    sameAs[i] = j;
+            if(-1 == sameAs[i])
+                blockAddresses[i] = findDuplicateBlock(block, fingerprints[i]);
+            isNew[i] = -1 == sameAs[i] && NO_BLOCK == blockAddresses[i];
+        }
+
+        ///new blocks are written in runs of neighbouring blocks of the file, before addresses point to them
+        failed = false;
+        for(int i = 0; i < nBlocksRead && !failed; i += runLength)
+        {
+            runLength = 1;
+            if(!isNew[i])
+                continue;
+
+            while(i + runLength < nBlocksRead && isNew[i + runLength])
+                ++runLength;
+            firstBlock = allocateBlockRun(runLength, runLength);
+            if(-1 == firstBlock)
+            {
+                std::cerr << "No free block found (not enough free space)! Copying file stopped.\n";
+                failed = true;
+                break;
+            }
+            if(isJournaling)    ///data goes to the run directly, older images of its blocks must not be replayed over it
+                journal.revokeBlocks(firstDataIndex + firstBlock, runLength);
+            blockCache.dropBlocks(firstDataIndex + firstBlock, runLength);     ///cached copies of freed blocks must not be written back over new data
+
+            if(runLength * BLOCK_SIZE != diskIO.writeBytes(firstDataIndex + firstBlock, 0, buffer + i * BLOCK_SIZE, runLength * BLOCK_SIZE))
+            {
+                std::cerr << "Could not write the entire block!\n";
+                for(int j = 0; j < runLength; ++j)
+                    changeBlockStatus(firstBlock + j, FREE);
+                failed = true;
+                break;
+            }
+            for(int j = 0; j < runLength; ++j)
+            {
+                blockAddresses[i + j] = firstBlock + j;
+                indexBlock(firstBlock + j, fingerprints[i + j]);
+            }
+        }
+
+        ///blocks equal to new ones take references to them
+        for(int i = 0; i < nBlocksRead && !failed; ++i)
+        {
+            if(-1 == sameAs[i])
+                continue;
+            if(referenceBlock(blockAddresses[sameAs[i]]))
+                blockAddresses[i] = blockAddresses[sameAs[i]];
+            else
+            {
+                std::cerr << "Too many references to a block! Copying file stopped.\n";
+                failed = true;
+            }
+        }
+
+        nWritten = 0;
+        if(!failed)
+        {
+            nWritten = writeBlockAddresses(iNumber, index, nBlocksRead, blockAddresses);
+            if(nWritten < nBlocksRead)
+                std::cerr << "No free block found (not enough free space)! Copying file stopped.\n";
+        }
+
+        ///references not written to the file are dropped
+        for(int i = nWritten; i < nBlocksRead; ++i)
+            if(NO_BLOCK != blockAddresses[i])
+                changeBlockStatus(blockAddresses[i], FREE);
+        if(nWritten < nBlocksRead)
+        {
+            fileSize = std::min(fileSize + (uint64_t)nWritten * BLOCK_SIZE, fileSize + bytesRead);
+            returnValue = -1;
+            break;
+        }
+
+        fileSize += bytesRead;
+        if(bytesRead < MAX_TRANSFER_BLOCKS * BLOCK_SIZE)    ///end of file
+            break;
+    }
+
+    delete [] isNew;
+    delete [] sameAs;
+    delete [] fingerprints;
+    delete [] blockAddresses;
+    delete [] buffer;
+    return returnValue;
+}
+
+
+
+///function stores a block of a deduplicated file in a new block and frees the old one (such blocks may be shared, so they are never written in place)
+///parameters: i-number of file, index of block within file, address of block to replace, new bytes of block
+///return value: -1 on failure (old block stays), else 0
+int VirtualDisk::replaceBlock(short int iNumber, int index, uint32_t oldAddress, const unsigned char* data)
+{
+    int blockAddress = allocateBlock();
+    uint32_t newAddress;
+
+    if(-1 == blockAddress)
+    {
+        std::cerr << "No free block found (not enough free space)!\n";
+        return -1;
+    }
+    if(isJournaling)    ///data goes to the block directly, older images of it must not be replayed over it
+        journal.revokeBlocks(firstDataIndex + blockAddress, 1);
+    blockCache.dropBlocks(firstDataIndex + blockAddress, 1);    ///cached copy of freed block must not be written back over new data
+
+    newAddress = blockAddress;
+    if(BLOCK_SIZE != diskIO.writeBytes(firstDataIndex + blockAddress, 0, data, BLOCK_SIZE))
+    {
+        std::cerr << "Could not write the entire block!\n";
+        changeBlockStatus(blockAddress, FREE);
+        return -1;
+    }
+    if(1 != writeBlockAddresses(iNumber, index, 1, &newAddress))
+    {
+        std::cerr << "No free block found (not enough free space)!\n";
+        changeBlockStatus(blockAddress, FREE);
+        return -1;
+    }
+
+    changeBlockStatus(oldAddress, FREE);
+    return 0;
+}
+
+
+
+///function computes hash of a file name (FNV-1a over at most DIRECTORY_NAME_SIZE characters)
+///parameters: name of file
+///return value: hash of name
+uint32_t VirtualDisk::hashName(const char* fileName)
+{
+    uint32_t hash = 2166136261u;
+
+    for(int i = 0; i < DIRECTORY_NAME_SIZE && '\0' != fileName[i]; ++i)
+    {
+        hash ^= (unsigned char)fileName[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+
+///function finds bucket of a directory which holds entry with given name
+///parameters: i-number of directory, name of file
+///return value: index of bucket block on the disk
+int64_t VirtualDisk::findDirectoryBucket(short int directoryINumber, const char* fileName)
+{
+    int nBuckets = (int)(iNodeCache.getINode(directoryINumber).size / BLOCK_SIZE);
+    uint32_t blockAddress;
+
+    readBlockAddresses(directoryINumber, hashName(fileName) & (nBuckets - 1), 1, &blockAddress);
+    return firstDataIndex + blockAddress;
+}
+
+
+
+///function doubles number of buckets of a directory and redistributes its entries
+///parameters: i-number of directory
+///return value: -1 if there is no free space for new buckets, else 0
+int VirtualDisk::growDirectory(short int directoryINumber)
+{
+    INode& directory = iNodeCache.getINode(directoryINumber);
+    int nBuckets = (int)(directory.size / BLOCK_SIZE);
+    int newNBuckets = 2 * nBuckets;
+    uint32_t* blockAddresses;
+    char* oldBuckets;
+    char* newBuckets;
+    std::vector<int> nEntries(newNBuckets, 0);
+    char* entry;
+    int bucket;
+    int blockAddress;
+
+    if(newNBuckets > MAX_FILE_SIZE_IN_BLOCKS)
+    {
+        std::cerr << "Directory already full!\n";
+        return -1;
+    }
+
+    ///add new buckets
+    blockAddresses = new uint32_t [newNBuckets];
+    readBlockAddresses(directoryINumber, 0, nBuckets, blockAddresses);
+    for(int i = nBuckets; i < newNBuckets; ++i)
+    {
+        blockAddress = allocateBlock();
+        if(-1 != blockAddress)
+            blockAddresses[i] = blockAddress;
+
+        if(-1 == blockAddress || 1 != writeBlockAddresses(directoryINumber, i, 1, blockAddresses + i))
+        {
+            std::cerr << "No free block found (not enough free space)!\n";
+            if(-1 != blockAddress)
+                changeBlockStatus(blockAddress, FREE);
+            freeFileBlocks(directoryINumber, nBuckets, i);
+            delete [] blockAddresses;
+            return -1;
+        }
+    }
+
+    ///redistribute entries - entries of old bucket b go to new bucket b or b + nBuckets, so no bucket can overflow
+    oldBuckets = new char [nBuckets * BLOCK_SIZE];
+    newBuckets = new char [newNBuckets * BLOCK_SIZE]();
+    for(int i = 0; i < nBuckets; ++i)
+        blockCache.readBlock(firstDataIndex + blockAddresses[i], 0, oldBuckets + i * BLOCK_SIZE, BLOCK_SIZE);
+
+    for(int i = 0; i < nBuckets * DIRECTORY_ENTRIES_PER_BLOCK; ++i)
+    {
+        entry = oldBuckets + i * DIRECTORY_ENTRY_SIZE;
+        if('\0' == entry[DIRECTORY_NAME_OFFSET])  ///empty slot
+            continue;
+
+        bucket = hashName(entry + DIRECTORY_NAME_OFFSET) & (newNBuckets - 1);
+        memcpy(newBuckets + bucket * BLOCK_SIZE + nEntries[bucket] * DIRECTORY_ENTRY_SIZE, entry, DIRECTORY_ENTRY_SIZE);
+        ++nEntries[bucket];
+    }
+
+    for(int i = 0; i < newNBuckets; ++i)
+        blockCache.writeBlock(firstDataIndex + blockAddresses[i], 0, newBuckets + i * BLOCK_SIZE, BLOCK_SIZE);
+
+    ///update directory size
+    setFileSize(directoryINumber, (uint64_t)newNBuckets * BLOCK_SIZE);
+
+    delete [] newBuckets;
+    delete [] oldBuckets;
+    delete [] blockAddresses;
+    return 0;
+}
+
+
+
+///function adds directory entry
+///parameters: i-number of directory to add in. i-number of file to add, name of file to add
+///return value: -1 if directory could not grow, else 0
+int VirtualDisk::addDirectoryEntry(short int directoryINumber, short int iNumberToAdd, char* fileNameToAdd)
+{
+    char* buffer = new char [BLOCK_SIZE];
+    char entry[DIRECTORY_ENTRY_SIZE];
+    int64_t blockIndex;
+    int index = DIRECTORY_ENTRIES_PER_BLOCK;
+
+    dentryCache.invalidate(directoryINumber, fileNameToAdd);
+
+    ///find free slot in bucket of the name, growing directory while the bucket is full
+    while(DIRECTORY_ENTRIES_PER_BLOCK == index)
+    {
+        blockIndex = findDirectoryBucket(directoryINumber, fileNameToAdd);
+        blockCache.readBlock(blockIndex, 0, buffer, BLOCK_SIZE);
+
+        for(index = 0; index < DIRECTORY_ENTRIES_PER_BLOCK; ++index)
+            if('\0' == buffer[index * DIRECTORY_ENTRY_SIZE + DIRECTORY_NAME_OFFSET])
+                break;
+
+        if(DIRECTORY_ENTRIES_PER_BLOCK == index && -1 == growDirectory(directoryINumber))
+        {
+            delete [] buffer;
+            return -1;
+        }
+    }
+
+    ///prepare entry: i-number and name
+    memset(entry, 0, DIRECTORY_ENTRY_SIZE);
+    memcpy(entry + DIRECTORY_I_NUMBER_OFFSET, &iNumberToAdd, sizeof(iNumberToAdd));
+    memcpy(entry + DIRECTORY_NAME_OFFSET, fileNameToAdd, strnlen(fileNameToAdd, DIRECTORY_NAME_SIZE));  ///full-width name has no terminator
+
+    ///write entry
+    blockCache.writeBlock(blockIndex, index * DIRECTORY_ENTRY_SIZE, entry, DIRECTORY_ENTRY_SIZE);
+
+    ///add link
+    increaseLinkCount(iNumberToAdd);
+
+    delete [] buffer;
+    return 0;
+}
+
+
+
+///function deletes directory entry
+///parameters: i-number of directory to delete from, name of file to delete
+void VirtualDisk::deleteDirectoryEntry(short int directoryINumber, char* fileNameToDelete)
+{
+    int64_t blockIndex = findDirectoryBucket(directoryINumber, fileNameToDelete);
+    char* buffer = new char [BLOCK_SIZE];
+    char entry[DIRECTORY_ENTRY_SIZE];
+    int index;
+
+    dentryCache.invalidate(directoryINumber, fileNameToDelete);
+
+    ///read bucket of the name
+    blockCache.readBlock(blockIndex, 0, buffer, BLOCK_SIZE);
+
+    ///specify file position within bucket
+    for(index = 0; index < DIRECTORY_ENTRIES_PER_BLOCK; ++index)
+    {
+        if('\0' != buffer[index * DIRECTORY_ENTRY_SIZE + DIRECTORY_NAME_OFFSET] && 0 == strncmp(buffer + index * DIRECTORY_ENTRY_SIZE + DIRECTORY_NAME_OFFSET, fileNameToDelete, DIRECTORY_NAME_SIZE))
+            break;
+    }
+
+    ///free the slot - other entries stay where they are
+    if(index < DIRECTORY_ENTRIES_PER_BLOCK)
+    {
+        memset(entry, 0, DIRECTORY_ENTRY_SIZE);
+        blockCache.writeBlock(blockIndex, index * DIRECTORY_ENTRY_SIZE, entry, DIRECTORY_ENTRY_SIZE);
+    }
+
+    delete [] buffer;
+}
+
+
+
+///function finds next free data block and marks it as used
+///return value: index of allocated data block, -1 if there is none
+int VirtualDisk::allocateBlock()
+{
+    std::lock_guard<std::mutex> lock(allocationMutex);
+    int blockId = dataBitmap.findFirstFree();
+
+    if(-1 != blockId)
+    {
+        ++superblock.nDataBlocksInUse;
+        dataBitmap.changeBit(blockId, USED);    ///written back by flushBitmaps()
+    }
+
+    return blockId;
+}
+
+
+
+///function finds run of neighbouring free data blocks and marks them as used
+///parameters: wanted number of blocks, number of blocks allocated (output, may be less than wanted)
+///return value: index of first data block of the run, -1 if there is no free block
+int VirtualDisk::allocateBlockRun(int nBlocksWanted, int& runLength)
+{
+    std::lock_guard<std::mutex> lock(allocationMutex);
+    int firstBlockId = dataBitmap.findFreeRun(nBlocksWanted, runLength);
+
+    if(-1 == firstBlockId)
+        return -1;
+
+    superblock.nDataBlocksInUse += runLength;
+    for(int i = 0; i < runLength; ++i)
+        dataBitmap.changeBit(firstBlockId + i, USED);
+
+    return firstBlockId;
+}
+
+
+
+///function counts how many of given block addresses are neighbouring blocks, or holes if the first one is a hole
+///parameters: block addresses, maximum number of addresses to check
+///return value: length of the run of neighbouring blocks or of holes (at most MAX_TRANSFER_BLOCKS)
+int VirtualDisk::countContiguousBlocks(uint32_t* blockAddresses, int maxCount)
+{
+    int runLength = 1;
+
+    maxCount = std::min(maxCount, MAX_TRANSFER_BLOCKS);
+    if(NO_BLOCK == blockAddresses[0])
+    {
+        while(runLength < maxCount && NO_BLOCK == blockAddresses[runLength])
+            ++runLength;
+    }
+    else
+    {
+        while(runLength < maxCount && blockAddresses[runLength] == blockAddresses[runLength - 1] + 1)
+            ++runLength;
+    }
 
+    return runLength;
 }
 
 
 
-///function closes file from user system be used for virtual disk implementation
-void VirtualDisk::closeFile()
+///function allocates and clears a block for block addresses
+///return value: address of allocated block, NO_BLOCK if there is no free block
+uint32_t VirtualDisk::allocateIndirectBlock()
 {
-    fclose(vDiskFile);
+    int blockAddress = allocateBlock();
+    unsigned char* zeros;
+
+    if(-1 == blockAddress)
+        return NO_BLOCK;
+
+    zeros = new unsigned char [BLOCK_SIZE]();   ///all addresses NO_BLOCK
+    blockCache.writeBlock(firstDataIndex + blockAddress, 0, zeros, BLOCK_SIZE);
+    delete [] zeros;
+
+    return blockAddress;
 }
 
 
 
-///function clears i-node and data bitmaps during virtual disk creation
-void VirtualDisk::prepareBitmaps()
+///function gets indirect block holding address of given block of a file
+///parameters: i-number of file, index of block within file (at least N_DIRECT_BLOCKS), slot of address within indirect block (output), whether missing indirect blocks should be allocated
+///return value: address of indirect block, NO_BLOCK if there is none
+uint32_t VirtualDisk::getIndirectBlock(int iNumber, int fileBlockIndex, int& slot, bool allocate)
 {
-    if(0 == findNextFreeInode())   ///root directory not yet created - file sytem being created, not restored
+    INode& file = iNodeCache.getINode(iNumber);
+    int index = fileBlockIndex - N_DIRECT_BLOCKS;
+    int outerSlot;
+    uint32_t singleIndirectBlock;
+
+    if(index < ADDRESSES_PER_BLOCK)  ///address in single indirect block
     {
-        fseek(vDiskFile, iNodeBitmapIndex * BLOCK_SIZE, SEEK_SET);
-        for(int i = 0; i < 2 * BLOCK_SIZE; ++i)
+        slot = index;
+        if(NO_BLOCK == file.data[SINGLE_INDIRECT_SLOT] && allocate)
         {
-            fputc('\0', vDiskFile);
+            file.data[SINGLE_INDIRECT_SLOT] = allocateIndirectBlock();
+            iNodeCache.markDirty(iNumber);
         }
+        return file.data[SINGLE_INDIRECT_SLOT];
+    }
+
+    ///address in one of single indirect blocks pointed by double indirect block
+    index -= ADDRESSES_PER_BLOCK;
+    outerSlot = index / ADDRESSES_PER_BLOCK;
+    slot = index % ADDRESSES_PER_BLOCK;
+
+    if(NO_BLOCK == file.data[DOUBLE_INDIRECT_SLOT])
+    {
+        if(!allocate)
+            return NO_BLOCK;
+        file.data[DOUBLE_INDIRECT_SLOT] = allocateIndirectBlock();
+        iNodeCache.markDirty(iNumber);
+        if(NO_BLOCK == file.data[DOUBLE_INDIRECT_SLOT])
+            return NO_BLOCK;
+    }
+
+    blockCache.readBlock(firstDataIndex + file.data[DOUBLE_INDIRECT_SLOT], outerSlot * ADDRESS_SIZE, &singleIndirectBlock, ADDRESS_SIZE);
+    if(NO_BLOCK == singleIndirectBlock && allocate)
+    {
+        singleIndirectBlock = allocateIndirectBlock();
+        if(NO_BLOCK != singleIndirectBlock)
+            blockCache.writeBlock(firstDataIndex + file.data[DOUBLE_INDIRECT_SLOT], outerSlot * ADDRESS_SIZE, &singleIndirectBlock, ADDRESS_SIZE);
     }
+
+    return singleIndirectBlock;
 }
 
 
 
-///function sets virtual disk size
-///parameters: new size of virtual disk (in bytes)
-void VirtualDisk::setVDiskSize(int newSize)
+///function reads addresses of consecutive blocks of a file
+///parameters: i-number of file, index of first block within file, number of addresses, destination buffer
+void VirtualDisk::readBlockAddresses(int iNumber, int firstIndex, int count, uint32_t* blockAddresses)
 {
+    INode& file = iNodeCache.getINode(iNumber);
+    uint32_t indirectBlock;
+    int index;
+    int slot;
+    int n;
 
-    if(-1 == newSize)
+    for(int i = 0; i < count; i += n)
     {
-        std::cout << "Please specify size of virtual disk in bytes: ";
-        std::cin >> newSize;
-    }
-
-    newSize = newSize - newSize % BLOCK_SIZE;      ///resize to be a multiply of block size
-    newSize = std::min(newSize, MAX_DISK_SIZE);    ///resize if size bigger than allowed
-    newSize = std::max(newSize, MIN_DISK_SIZE);    ///resize if size smaller than allowed
+        index = firstIndex + i;
 
-    vDiskSize = newSize;
+        if(index < N_DIRECT_BLOCKS)     ///direct addresses
+        {
+            n = std::min(count - i, N_DIRECT_BLOCKS - index);
+            memcpy(blockAddresses + i, file.data + index, n * ADDRESS_SIZE);
+            continue;
+        }
 
-    fseek(vDiskFile, newSize - 1, SEEK_SET);
-    fprintf(vDiskFile, "x");
+        ///addresses from indirect block, as many as possible at once
+        indirectBlock = getIndirectBlock(iNumber, index, slot, false);
+        n = std::min(count - i, ADDRESSES_PER_BLOCK - slot);
+        if(NO_BLOCK == indirectBlock)
+            memset(blockAddresses + i, 0, n * ADDRESS_SIZE);
+        else
+            blockCache.readBlock(firstDataIndex + indirectBlock, slot * ADDRESS_SIZE, blockAddresses + i, n * ADDRESS_SIZE);
+    }
 }
 
 
 
-///function gets virtual disk size
-///return value: size of virtual disk
-int VirtualDisk::getVDiskSize()
+///function writes addresses of consecutive blocks of a file, allocating indirect blocks when needed
+///parameters: i-number of file, index of first block within file, number of addresses, source buffer
+///return value: number of addresses written (less than count if no free block for indirect block)
+int VirtualDisk::writeBlockAddresses(int iNumber, int firstIndex, int count, uint32_t* blockAddresses)
 {
-    return vDiskSize;
-}
+    INode& file = iNodeCache.getINode(iNumber);
+    uint32_t indirectBlock;
+    int index;
+    int slot;
+    int n;
 
+    ++blockMapVersions[iNumber];   ///block maps of handles are out of date
 
+    for(int i = 0; i < count; i += n)
+    {
+        index = firstIndex + i;
 
-///function sets virtual disk parameters during virtual disk creation - based on disk size, calculate where bitmaps, i-node table and user data are
-void VirtualDisk::setVDiskParameters()
-{
-    vDiskSize = getVDiskSize();
-    nBlocks = vDiskSize / BLOCK_SIZE;
-    freeBlocks = nBlocks - 2;
-    nInodeBlocks = freeBlocks / (N_FILES_PER_I_NODE_BLOCK * AVERAGE_FILE_SIZE_IN_BLOCKS + 1);
-    nInodeBlocks = std::max(nInodeBlocks, 1);   ///at least one i-node block must be present
-    iNodeBitmapIndex = 0;
-    dataBitmapIndex = 1;
-    firstINodeIndex = 2;
-    firstDataIndex = nInodeBlocks + firstINodeIndex;
+        if(index < N_DIRECT_BLOCKS)     ///direct addresses
+        {
+            n = std::min(count - i, N_DIRECT_BLOCKS - index);
+            memcpy(file.data + index, blockAddresses + i, n * ADDRESS_SIZE);
+            iNodeCache.markDirty(iNumber);
+            continue;
+        }
+
+        ///addresses to indirect block, as many as possible at once
+        indirectBlock = getIndirectBlock(iNumber, index, slot, true);
+        if(NO_BLOCK == indirectBlock)
+            return i;
+        n = std::min(count - i, ADDRESSES_PER_BLOCK - slot);
+        blockCache.writeBlock(firstDataIndex + indirectBlock, slot * ADDRESS_SIZE, blockAddresses + i, n * ADDRESS_SIZE);
+    }
+
+    return count;
 }
 
 
 
-///function creates empty directory
-///return value: i-number of created directory
-short int VirtualDisk::createEmptyDirectory()
+///function frees blocks of a file from given index on, together with indirect blocks which are no longer needed
+///parameters: i-number of file, index of first block to free, number of blocks used by file
+void VirtualDisk::freeFileBlocks(int iNumber, int firstIndex, int countBlocks)
 {
-    short int iNumber = findNextFreeInode();
-    uint16_t blockAddress = findNextFreeBlock();
-    bool isDirectory = true;
-    uint16_t directorySize = 0;
-    uint16_t linkCount = 0;
-
+    INode& file = iNodeCache.getINode(iNumber);
+    uint32_t* blockAddresses = new uint32_t [ADDRESSES_PER_BLOCK];
+    int firstDoubleIndex = N_DIRECT_BLOCKS + ADDRESSES_PER_BLOCK; ///index of first block addressed through double indirect block
+    int firstOuterSlot;
+    uint32_t indirectBlock;
+    int slot;
+    int n;
+
+    ++blockMapVersions[iNumber];   ///block maps of handles are out of date
+
+    ///free data blocks
+    for(int i = firstIndex; i < countBlocks; i += n)
+    {
+        n = std::min(countBlocks - i, ADDRESSES_PER_BLOCK);
+        readBlockAddresses(iNumber, i, n, blockAddresses);
+        for(int j = 0; j < n; ++j)
+            if(NO_BLOCK != blockAddresses[j])
+                changeBlockStatus(blockAddresses[j], FREE);
+    }
 
-    if(-1 == iNumber || -1 == blockAddress)
+    ///forget addresses of freed blocks kept in the i-node or in an indirect block which stays, so they read as holes
+    if(firstIndex < N_DIRECT_BLOCKS)
     {
-        std::cerr << "Could not create root directory!\n";
-        exit(EXIT_FAILURE);
+        memset(file.data + firstIndex, 0, (N_DIRECT_BLOCKS - firstIndex) * ADDRESS_SIZE);
+        iNodeCache.markDirty(iNumber);
+    }
+    else if(firstIndex < countBlocks)
+    {
+        indirectBlock = getIndirectBlock(iNumber, firstIndex, slot, false);
+        if(NO_BLOCK != indirectBlock && slot > 0)   ///with slot 0 the whole indirect block is freed below
+        {
+            memset(blockAddresses, 0, BLOCK_SIZE);
+            blockCache.writeBlock(firstDataIndex + indirectBlock, slot * ADDRESS_SIZE, blockAddresses, (ADDRESSES_PER_BLOCK - slot) * ADDRESS_SIZE);
+        }
     }
-    changeINodeStatus(iNumber, USED);
-    changeBlockStatus(blockAddress, USED);
 
-    ///add block address to i-node table
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + DATA_OFFSET, SEEK_SET);
-    fwrite((const void* ) &blockAddress, sizeof(blockAddress), 1, vDiskFile);
+    ///free single indirect block if none of its addresses are used any more
+    if(firstIndex <= N_DIRECT_BLOCKS && NO_BLOCK != file.data[SINGLE_INDIRECT_SLOT])
+    {
+        changeBlockStatus(file.data[SINGLE_INDIRECT_SLOT], FREE);
+        file.data[SINGLE_INDIRECT_SLOT] = NO_BLOCK;
+        iNodeCache.markDirty(iNumber);
+    }
 
-    ///note that this is a directory
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + IS_DIRECTORY_OFFSET, SEEK_SET);
-    fwrite((const void* ) &isDirectory, sizeof(isDirectory), 1, vDiskFile);
+    ///free single indirect blocks pointed by double indirect block, and double indirect block itself
+    if(NO_BLOCK != file.data[DOUBLE_INDIRECT_SLOT])
+    {
+        firstOuterSlot = std::max(0, (firstIndex - firstDoubleIndex + ADDRESSES_PER_BLOCK - 1) / ADDRESSES_PER_BLOCK);
+        blockCache.readBlock(firstDataIndex + file.data[DOUBLE_INDIRECT_SLOT], 0, blockAddresses, BLOCK_SIZE);
 
-    ///write directory size (empty)
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fwrite((const void* ) &directorySize, sizeof(directorySize), 1, vDiskFile);
+        for(int i = firstOuterSlot; i < ADDRESSES_PER_BLOCK; ++i)
+        {
+            if(NO_BLOCK != blockAddresses[i])
+            {
+                changeBlockStatus(blockAddresses[i], FREE);
+                blockAddresses[i] = NO_BLOCK;
+            }
+        }
 
-    ///write directory link count
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + LINK_COUNT_OFFSET, SEEK_SET);
-    fwrite((const void* ) &linkCount, sizeof(linkCount), 1, vDiskFile);
+        if(0 == firstOuterSlot)
+        {
+            changeBlockStatus(file.data[DOUBLE_INDIRECT_SLOT], FREE);
+            file.data[DOUBLE_INDIRECT_SLOT] = NO_BLOCK;
+            iNodeCache.markDirty(iNumber);
+        }
+        else
+            blockCache.writeBlock(firstDataIndex + file.data[DOUBLE_INDIRECT_SLOT], 0, blockAddresses, BLOCK_SIZE);
+    }
 
-    return iNumber;
+    delete [] blockAddresses;
 }
 
 
 
-///function creates root directory
-void VirtualDisk::createRootDirectory()
+///function frees files which are in no directory - left by copies cut off when the disk was not closed properly
+///return value: number of files freed
+int VirtualDisk::freeOrphans()
 {
-    if(0 == findNextFreeInode()) ///root directory not yet created - file sytem being created, not restored
+    int nInodesTotal = nInodeBlocks * BLOCK_SIZE / I_NODE_SIZE;
+    int nOrphans = 0;
+
+    for(int i = 0; i < nInodesTotal; ++i)
     {
-        uint16_t rootINumber = createEmptyDirectory();
-        currentDirectory = rootINumber;
+        if(ROOT_I_NUMBER == i || FREE == iNodeBitmap.checkBit(i) || iNodeCache.getINode(i).linkCount > 0)
+            continue;
 
-        addDirectoryEntry(rootINumber, rootINumber, ".");
-        addDirectoryEntry(rootINumber, rootINumber, "..");
+        freeFileBlocks(i, 0, MAX_FILE_SIZE_IN_BLOCKS);  ///size may not cover blocks written so far
+        setFileSize(i, 0);
+        changeINodeStatus(i, FREE);
+        ++nOrphans;
     }
+
+    return nOrphans;
 }
 
 
 
-///function creates child directory
-///parameters: i-number of parent directory, name of child directory
-void VirtualDisk::createChildDirectory(uint16_t directoryINumber, char* childName)
+///function finds next free i-node and marks it as used
+///return value: allocated i-number, -1 if there is none
+short int VirtualDisk::allocateINode()
 {
-    uint16_t childDirectoryINumber = createEmptyDirectory();
-    addDirectoryEntry(childDirectoryINumber, childDirectoryINumber, ".");
-    addDirectoryEntry(childDirectoryINumber, directoryINumber, "..");
-    addDirectoryEntry(directoryINumber, childDirectoryINumber, childName);
-}
+    std::lock_guard<std::mutex> lock(allocationMutex);
+    int iNodeId = iNodeBitmap.findFirstFree();
 
+    if(-1 != iNodeId)
+    {
+        ++superblock.nINodesInUse;
+        iNodeBitmap.changeBit(iNodeId, USED);   ///written back by flushBitmaps()
+    }
 
+    return (short int)iNodeId;
+}
 
-///function adds directory entry
-///parameters: i-number of directory to add in. i-number of file to add, name of file to add
-void VirtualDisk::addDirectoryEntry(short int directoryINumber, short int iNumberToAdd, char* fileNameToAdd)
-{
-    uint16_t blockAddress;
-    uint16_t sizeOfDirectory;
-    uint16_t linkCount;
 
-    ///read directory block address
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + directoryINumber * I_NODE_SIZE + DATA_OFFSET, SEEK_SET);
-    fread(&blockAddress, sizeof(blockAddress), 1, vDiskFile);
 
-    ///read directory size
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + directoryINumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fread(&sizeOfDirectory, sizeof(sizeOfDirectory), 1, vDiskFile);
+///function changes data block status (with a journal, a freed block is only released - freed once the transaction is committed)
+///parameters: index of data block to change, new status (free or used - freeing a shared block only drops one reference)
+void VirtualDisk::changeBlockStatus(int blockId, bool newStatus)
+{
+    if(FREE == newStatus && !dropReference(blockId))    ///other files still use it
+        return;
 
-    if(sizeOfDirectory / DIRECTORY_ENTRY_SIZE >= DIRECTORY_MAX_ENTRIES)
+    if(FREE == newStatus && isJournaling)   ///until then a crash could bring back a file which still uses it
     {
-        std::cerr << "Directory already full!\n";
+        journal.releaseBlock(blockId);
         return;
     }
 
-    ///write i-number
-    fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE + sizeOfDirectory, SEEK_SET);
-    fwrite((const void* ) &iNumberToAdd, sizeof(iNumberToAdd), 1, vDiskFile);
+    std::lock_guard<std::mutex> lock(allocationMutex);
+
+    if(dataBitmap.checkBit(blockId) == newStatus)
+        return;
 
-    ///write name
-    fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE + sizeOfDirectory + DIRECTORY_NAME_OFFSET, SEEK_SET);
-    fwrite(fileNameToAdd, 1, DIRECTORY_NAME_SIZE, vDiskFile);
+    if(USED == newStatus)
+        ++superblock.nDataBlocksInUse;
+    else
+        --superblock.nDataBlocksInUse;
+    dataBitmap.changeBit(blockId, newStatus);   ///written back by flushBitmaps()
+}
 
-    ///add link
-    increaseLinkCount(iNumberToAdd);
 
-    ///update directory size
-    sizeOfDirectory += DIRECTORY_ENTRY_SIZE;
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + directoryINumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fwrite((const void* ) &sizeOfDirectory, sizeof(sizeOfDirectory), 1, vDiskFile);
 
+///function reads reference count entry of a data block (caller holds allocationMutex)
+///parameters: index of data block
+///return value: REFERENCE_INDEXED flag and number of references beyond the first one
+uint16_t VirtualDisk::getReferenceCount(int blockId)
+{
+    uint16_t entry = 0;
+
+    blockCache.readBlock(referenceCountIndex + blockId / REFERENCE_COUNTS_PER_BLOCK, blockId % REFERENCE_COUNTS_PER_BLOCK * REFERENCE_COUNT_SIZE, &entry, REFERENCE_COUNT_SIZE);
+    return entry;
 }
 
 
 
-///function deletes directory entry
-///parameters: i-number of directory to delete from, name of file to delete
-void VirtualDisk::deleteDirectoryEntry(short int directoryINumber, char* fileNameToDelete)
+///function writes reference count entry of a data block (caller holds allocationMutex)
+///parameters: index of data block, new entry
+void VirtualDisk::setReferenceCount(int blockId, uint16_t entry)
 {
-    uint16_t blockAddress;
-    uint16_t sizeOfDirectory;
-    uint16_t linkCount;
-    uint16_t index;
-    char* buffer = new char [DIRECTORY_NAME_SIZE];
-    short int iNumberToMove;
+    blockCache.writeBlock(referenceCountIndex + blockId / REFERENCE_COUNTS_PER_BLOCK, blockId % REFERENCE_COUNTS_PER_BLOCK * REFERENCE_COUNT_SIZE, &entry, REFERENCE_COUNT_SIZE);
+}
 
-    ///read directory block address
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + directoryINumber * I_NODE_SIZE + DATA_OFFSET, SEEK_SET);
-    fread(&blockAddress, sizeof(blockAddress), 1, vDiskFile);
 
-    ///read directory size
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + directoryINumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fread(&sizeOfDirectory, sizeof(sizeOfDirectory), 1, vDiskFile);
 
-    ///specify file position within directory
-    for(index = 0; index < sizeOfDirectory / DIRECTORY_ENTRY_SIZE; ++index)
-    {
-        fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE + index * DIRECTORY_ENTRY_SIZE + DIRECTORY_NAME_OFFSET, SEEK_SET);
-        fread(buffer, 1, DIRECTORY_NAME_SIZE, vDiskFile);
-        if(0 == strcmp(buffer, fileNameToDelete))
-            break;
-    }
+///function takes another reference to a block of the fingerprint index, unless it was freed in the meantime
+///parameters: index of data block
+///return value: true if reference was taken
+bool VirtualDisk::referenceBlock(int blockId)
+{
+    std::lock_guard<std::mutex> lock(allocationMutex);
+    uint16_t entry;
 
-    ///move all next entries back one position
-    while(index < sizeOfDirectory / DIRECTORY_ENTRY_SIZE - 1)
-    {
-        ///moving i-number
-        fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE + (index + 1) * DIRECTORY_ENTRY_SIZE + DIRECTORY_I_NUMBER_OFFSET, SEEK_SET);
-        fread(&iNumberToMove, sizeof(iNumberToMove), 1, vDiskFile);
-        fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE + index * DIRECTORY_ENTRY_SIZE + DIRECTORY_I_NUMBER_OFFSET, SEEK_SET);
-        fwrite((const void* ) &iNumberToMove, sizeof(iNumberToMove), 1, vDiskFile);
+    if(blockId <= 0 || blockId >= nBlocks - firstDataIndex || FREE == dataBitmap.checkBit(blockId))
+        return false;
+
+    ///a block freed for good lost its flag - even if it is used again, it may be changed in place
+    entry = getReferenceCount(blockId);
+    if(0 == (entry & REFERENCE_INDEXED) || MAX_EXTRA_REFERENCES == (entry & MAX_EXTRA_REFERENCES))
+        return false;
+
+    setReferenceCount(blockId, entry + 1);
+    ++superblock.nSharedReferences;
+    return true;
+}
+
+
+
+///function drops a reference to a data block
+///parameters: index of data block
+///return value: true if it was the last one - block has to be freed
+bool VirtualDisk::dropReference(int blockId)
+{
+    std::lock_guard<std::mutex> lock(allocationMutex);
+    uint16_t entry;
 
-        ///moving name
-        fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE + (index + 1) * DIRECTORY_ENTRY_SIZE + DIRECTORY_NAME_OFFSET, SEEK_SET);
-        fread(buffer, 1, DIRECTORY_NAME_SIZE, vDiskFile);
-        fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE + index * DIRECTORY_ENTRY_SIZE + DIRECTORY_NAME_OFFSET, SEEK_SET);
-        fwrite(buffer, 1, DIRECTORY_NAME_SIZE, vDiskFile);
+    if(0 == superblock.nIndexedBlocks)   ///nothing was deduplicated - no block has an entry
+        return true;
 
-        ++index;
+    entry = getReferenceCount(blockId);
+    if(0 == entry)
+        return true;
+
+    if(0 != (entry & MAX_EXTRA_REFERENCES))
+    {
+        setReferenceCount(blockId, entry - 1);
+        --superblock.nSharedReferences;
+        return false;
     }
 
-    ///update directory size
-    sizeOfDirectory -= DIRECTORY_ENTRY_SIZE;
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + directoryINumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fwrite((const void* ) &sizeOfDirectory, sizeof(sizeOfDirectory), 1, vDiskFile);
+    setReferenceCount(blockId, 0);
+    --superblock.nIndexedBlocks;
+    return true;
 }
 
 
 
-///function finds next free data block
-///return value: index of first free data block
-short int VirtualDisk::findNextFreeBlock()
+///function changes i-node status
+///parameters: i-number to change, new status (free or used)
+void VirtualDisk::changeINodeStatus(int iNodeId, bool newStatus)
 {
-    bool found = false;
-    short int result = -1;
+    std::lock_guard<std::mutex> lock(allocationMutex);
+
+    if(iNodeBitmap.checkBit(iNodeId) == newStatus)
+        return;
 
-    for(int i = 0; i < nBlocks - firstDataIndex && !found; ++i)
+    if(USED == newStatus)
+        ++superblock.nINodesInUse;
+    else
     {
-        if(!checkBitFromBitmap(dataBitmapIndex, i))
-        {
-            found = true;
-            result = i;
-        }
+        --superblock.nINodesInUse;
+        ++iNodeGenerations[iNodeId];    ///handles of the file stop working
     }
-
-    return result;
+    iNodeBitmap.changeBit(iNodeId, newStatus);  ///written back by flushBitmaps()
 }
 
 
 
-///function finds next free i-node
-///return value: first free i-number
-short int VirtualDisk::findNextFreeInode()
+///function frees data blocks whose freeing was committed
+///parameters: indices of data blocks
+void VirtualDisk::releaseBlocks(const std::vector<uint32_t>& blockIds)
 {
-    bool found = false;
-    short int result = -1;
+    std::lock_guard<std::mutex> lock(allocationMutex);
 
-    for(int i = 0; i < nInodeBlocks * BLOCK_SIZE / I_NODE_SIZE && !found; ++i)
+    for(int i = 0; i < (int)blockIds.size(); ++i)
     {
-        if(!checkBitFromBitmap(iNodeBitmapIndex, i))
+        if(USED == dataBitmap.checkBit(blockIds[i]))
         {
-            found = true;
-            result = i;
+            --superblock.nDataBlocksInUse;
+            dataBitmap.changeBit(blockIds[i], FREE);
         }
     }
-
-    return result;
 }
 
 
 
-///function changes data block status
-///parameters: index of data block to change, new status (free or used)
-void VirtualDisk::changeBlockStatus(int blockId, bool newStatus)
+///function recomputes usage counters from bitmaps and i-nodes (caller holds allocationMutex if other threads may run)
+///return value: true if counters were wrong and had to be corrected
+bool VirtualDisk::recountUsage()
 {
-    unsigned char c;
-    uint8_t byte;
-
-    ///read
-    fseek(vDiskFile, dataBitmapIndex * BLOCK_SIZE + blockId / BYTE_SIZE, SEEK_SET);
-    c = fgetc(vDiskFile);
-
-    ///change
-    byte = (uint8_t)c;
-    if(newStatus)
-        byte |= (1 << (blockId % BYTE_SIZE));   ///set
-    else
-        byte &= ~(1 << (blockId % BYTE_SIZE));  ///unset
-    c = (unsigned char)byte;
+    int nInodesTotal = nInodeBlocks * BLOCK_SIZE / I_NODE_SIZE;
+    int nDataBlocksTotal = nBlocks - firstDataIndex;
+    uint16_t* entries = new uint16_t [REFERENCE_COUNTS_PER_BLOCK];
+    uint64_t nBytesInUse = 0;
+    uint64_t nIndexedBlocks = 0;
+    uint64_t nSharedReferences = 0;
+    bool isTableChanged;
+    int blockId;
+
+    ///count size of user data in use
+    for(int i = 0; i < nInodesTotal; ++i)
+        if(checkBitFromBitmap(iNodeBitmapIndex, i))
+            nBytesInUse += iNodeCache.getINode(i).size;
 
-    ///write
-    fseek(vDiskFile, dataBitmapIndex * BLOCK_SIZE + blockId / BYTE_SIZE, SEEK_SET);
-    fputc(c, vDiskFile);
+    ///count deduplicated blocks and their references - entries of free blocks (left by a crash without journal) are cleared
+    for(int i = 0; (int64_t)i * REFERENCE_COUNTS_PER_BLOCK < nDataBlocksTotal; ++i)
+    {
+        blockCache.readBlock(referenceCountIndex + i, 0, entries, BLOCK_SIZE);
+        isTableChanged = false;
+        for(int j = 0; j < REFERENCE_COUNTS_PER_BLOCK; ++j)
+        {
+            blockId = i * REFERENCE_COUNTS_PER_BLOCK + j;
+            if(0 != entries[j] && (blockId >= nDataBlocksTotal || FREE == dataBitmap.checkBit(blockId)))
+            {
+                entries[j] = 0;
+                isTableChanged = true;
+            }
+            if(0 != (entries[j] & REFERENCE_INDEXED))
+            {
+                ++nIndexedBlocks;
+                nSharedReferences += entries[j] & MAX_EXTRA_REFERENCES;
+            }
+        }
+        if(isTableChanged)
+            blockCache.writeBlock(referenceCountIndex + i, 0, entries, BLOCK_SIZE);
+    }
+    delete [] entries;
+
+    if((uint64_t)dataBitmap.countUsed() == superblock.nDataBlocksInUse && (uint64_t)iNodeBitmap.countUsed() == superblock.nINodesInUse && nBytesInUse == superblock.nBytesInUse
+       && nIndexedBlocks == superblock.nIndexedBlocks && nSharedReferences == superblock.nSharedReferences)
+        return false;
+
+    superblock.nDataBlocksInUse = dataBitmap.countUsed();
+    superblock.nINodesInUse = iNodeBitmap.countUsed();
+    superblock.nBytesInUse = nBytesInUse;
+    superblock.nIndexedBlocks = nIndexedBlocks;
+    superblock.nSharedReferences = nSharedReferences;
+    return true;
 }
 
 
 
-///function changes i-node status
-///parameters: i-number to change, new status (free or used)
-void VirtualDisk::changeINodeStatus(int iNodeId, bool newStatus)
+///function changes size of a file, keeping count of bytes in use
+///parameters: i-number of file, new size of file (in bytes)
+void VirtualDisk::setFileSize(int iNumber, uint64_t newSize)
 {
-    unsigned char c;
-    uint8_t byte;
+    INode& file = iNodeCache.getINode(iNumber);
+    std::lock_guard<std::mutex> lock(allocationMutex);
 
-    ///read
-    fseek(vDiskFile, iNodeBitmapIndex * BLOCK_SIZE + iNodeId / BYTE_SIZE, SEEK_SET);
-    c = fgetc(vDiskFile);
-
-    ///change
-    byte = (uint8_t)c;
-    if(newStatus)
-        byte |= (1 << (iNodeId % BYTE_SIZE));   ///set
-    else
-        byte &= ~(1 << (iNodeId % BYTE_SIZE));  ///unset
-    c = (unsigned char)byte;
-
-    ///write
-    fseek(vDiskFile, iNodeBitmapIndex * BLOCK_SIZE + iNodeId / BYTE_SIZE, SEEK_SET);
-    fputc(c, vDiskFile);
+    superblock.nBytesInUse = superblock.nBytesInUse - file.size + newSize;
+    file.size = newSize;
+    ++blockMapVersions[iNumber];
+    iNodeCache.markDirty(iNumber);
 }
 
 
@@ -365,60 +2596,46 @@ void VirtualDisk::changeINodeStatus(int iNodeId, bool newStatus)
 ///return value: status of bit (free or used)
 bool VirtualDisk::checkBitFromBitmap(int bitmapId, int entryId)
 {
-    unsigned char c;
-    uint8_t byte;
-
-    ///read
-    fseek(vDiskFile, bitmapId * BLOCK_SIZE + entryId / BYTE_SIZE, SEEK_SET);
-    c = fgetc(vDiskFile);
-
-    ///check
-    byte = (uint8_t)c;
-    return byte & (1 << (entryId % BYTE_SIZE));
-
+    if(iNodeBitmapIndex == bitmapId)
+        return iNodeBitmap.checkBit(entryId);
+    else
+        return dataBitmap.checkBit(entryId);
 }
 
 
 
 ///function gets i-number of given file from a given directory
-///parameters: name of file, i-number of directory to search in
-///return value: i-number of given file
-short int VirtualDisk::getINumber(char* fileName, uint16_t directoryINumber)
+///parameters: name of file, i-number of directory to search in, whether file is a directory (output, optional)
+///return value: i-number of given file, -1 if there is none
+short int VirtualDisk::getINumber(char* fileName, uint16_t directoryINumber, bool* isDirectory)
 {
-    bool found = false;
+    char* buffer;
     short int iNumber = -1;
-    std::string nameToFind = (std::string)fileName;
-    std::string temporaryString;
-    char* nameBuffer = new char [NAME_SIZE];
-    nameToFind = nameToFind.substr(0, NAME_SIZE);
-
-    uint16_t blockAddress;
-    uint16_t sizeOfDirectory;
+    bool isFileDirectory = false;
 
-
-    ///read directory block address
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + directoryINumber * I_NODE_SIZE + DATA_OFFSET, SEEK_SET);
-    fread(&blockAddress, sizeof(blockAddress), 1, vDiskFile);
-
-    ///read directory size
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + directoryINumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fread(&sizeOfDirectory, sizeof(sizeOfDirectory), 1, vDiskFile);
-
-    for(int i = 0; i < sizeOfDirectory / DIRECTORY_ENTRY_SIZE && !found; ++i)
+    if(!dentryCache.lookup(directoryINumber, fileName, iNumber, isFileDirectory))
     {
-        ///read name
-        fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE + i * DIRECTORY_ENTRY_SIZE + DIRECTORY_NAME_OFFSET, SEEK_SET);
-        fread(nameBuffer, 1, DIRECTORY_NAME_SIZE, vDiskFile);
+        buffer = new char [BLOCK_SIZE];
+
+        ///read only the bucket of the name
+        blockCache.readBlock(findDirectoryBucket(directoryINumber, fileName), 0, buffer, BLOCK_SIZE);
 
-        temporaryString = (std::string)nameBuffer;
-        if(0 == nameToFind.compare(temporaryString)) ///name found
+        for(int i = 0; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i)
         {
-            found = true;
-            fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE + i * DIRECTORY_ENTRY_SIZE + DIRECTORY_I_NUMBER_OFFSET, SEEK_SET);
-            fread(&iNumber, sizeof(iNumber), 1, vDiskFile);
+            if('\0' != buffer[i * DIRECTORY_ENTRY_SIZE + DIRECTORY_NAME_OFFSET] && 0 == strncmp(buffer + i * DIRECTORY_ENTRY_SIZE + DIRECTORY_NAME_OFFSET, fileName, DIRECTORY_NAME_SIZE)) ///name found
+            {
+                memcpy(&iNumber, buffer + i * DIRECTORY_ENTRY_SIZE + DIRECTORY_I_NUMBER_OFFSET, sizeof(iNumber));
+                isFileDirectory = iNodeCache.getINode(iNumber).isDirectory;
+                break;
+            }
         }
+
+        delete [] buffer;
+        dentryCache.insert(directoryINumber, fileName, iNumber, isFileDirectory);  ///negative entry if not found
     }
 
+    if(NULL != isDirectory)
+        *isDirectory = isFileDirectory;
     return iNumber;
 }
 
@@ -450,43 +2667,109 @@ std::vector<std::string> VirtualDisk::parsePath(std::string path)
 
 
 ///function interprets parsed path to specify working (temporary current) directory
-///parameters: parsed path in vector form, mode of specifying (whether to interpret last element of parsed path or not)
-///return value: -1 if could not resolve parsed path
-short int VirtualDisk::specifyWorkingDirectory(std::vector<std::string> parsedPath, int mode)
+///parameters: parsed path in vector form, mode of specifying (whether to interpret last element of parsed path or not), path to working directory (output, optional, only in MODE_CD)
+///return value: i-number of working directory, -1 if could not resolve parsed path
+short int VirtualDisk::specifyWorkingDirectory(const std::vector<std::string>& parsedPath, int mode, std::vector<std::string>* workingPath)
 {
-    bool isDirectory;
     int limit;  ///how far to go
+    bool isDirectory;
+    short int workingDirectory;
+    short int nextDirectory;
+    std::vector<std::string> path;
 
-    workingDirectory = currentDirectory; ///start from current directory
-    workingPath = pathToCurrentDir;      ///start with current path
+    {
+        std::lock_guard<std::mutex> lock(currentDirectoryMutex);
+        workingDirectory = currentDirectory; ///start from current directory
+        if(MODE_CD == mode)
+            path = pathToCurrentDir;         ///start with current path - needed only when changing directory
+    }
 
     if(MODE_CD == mode)
         limit = parsedPath.size();       ///go through everything - just like in cd command
     else
         limit = parsedPath.size() - 1;   ///go through everything but last one - just like in mkdir command
 
+    if(limit < 0)
+    {
+        std::cerr << "No file name given!\n";
+        return -1;
+    }
+
     for(int i = 0; i < limit; ++i)
     {
-        ///find i-number for this directory
-        workingDirectory = getINumber((char*)parsedPath[i].c_str(), (uint16_t)workingDirectory);
+        ///find i-number for this directory - directories are never deleted, so only the one searched is locked
+        iNodeLocks[workingDirectory].lock_shared();
+        nextDirectory = getINumber((char*)parsedPath[i].c_str(), (uint16_t)workingDirectory, &isDirectory);
+        iNodeLocks[workingDirectory].unlock_shared();
+        workingDirectory = nextDirectory;
 
         ///update working path
-        if(parsedPath[i] == ".." && !workingPath.empty())
-            workingPath.pop_back();
-        else if(parsedPath[i] != "." && parsedPath[i] != "..")
-            workingPath.push_back(parsedPath[i]);
-
-        ///check if it is a directory
-        fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + workingDirectory * I_NODE_SIZE + IS_DIRECTORY_OFFSET, SEEK_SET);
-        fread(&isDirectory, sizeof(isDirectory), 1, vDiskFile);
+        if(MODE_CD == mode)
+        {
+            if(parsedPath[i] == ".." && !path.empty())
+                path.pop_back();
+            else if(parsedPath[i] != "." && parsedPath[i] != "..")
+                path.push_back(parsedPath[i]);
+        }
 
-        ///exit if could not find
+        ///exit if could not find or if it is not a directory
         if(-1 == workingDirectory || !isDirectory)
         {
             std::cerr << parsedPath[i] << ": no such directory!\n";
             return -1;
         }
     }
+
+    if(NULL != workingPath)
+        *workingPath = path;
+    return workingDirectory;
+}
+
+
+
+///function finds file in a directory and locks its i-node, so other threads cannot delete or change it while it is used
+///parameters: name of file, i-number of directory, whether i-node is locked for changing (exclusive) or only for reading (shared)
+///return value: i-number of locked file, -1 if there is none (nothing is locked then)
+short int VirtualDisk::lockFile(char* fileName, uint16_t directoryINumber, bool exclusive)
+{
+    short int iNumber;
+    bool isDirectory;
+    bool isLocked = false;
+
+    while(true)
+    {
+        iNodeLocks[directoryINumber].lock_shared();
+        iNumber = getINumber(fileName, directoryINumber, &isDirectory);
+        if(-1 != iNumber && !isDirectory)   ///file could be deleted as soon as directory is unlocked, so it is locked first
+            isLocked = exclusive ? iNodeLocks[iNumber].try_lock() : iNodeLocks[iNumber].try_lock_shared();
+        iNodeLocks[directoryINumber].unlock_shared();
+        if(-1 == iNumber || isDirectory || isLocked)
+            break;
+        waitForINode(iNumber, exclusive);   ///file in use - directory is not kept locked meanwhile
+    }
+
+    if(-1 != iNumber && isDirectory)    ///directories are never deleted (and may be the same i-node, like "."), so they are locked afterwards
+        exclusive ? iNodeLocks[iNumber].lock() : iNodeLocks[iNumber].lock_shared();
+
+    return iNumber;
+}
+
+
+
+///function waits until lock of an i-node is free, without keeping it (caller holds no other lock and looks the file up again afterwards)
+///parameters: i-number, whether i-node is wanted for changing (exclusive) or only for reading (shared)
+void VirtualDisk::waitForINode(short int iNumber, bool exclusive)
+{
+    if(exclusive)
+    {
+        iNodeLocks[iNumber].lock();
+        iNodeLocks[iNumber].unlock();
+    }
+    else
+    {
+        iNodeLocks[iNumber].lock_shared();
+        iNodeLocks[iNumber].unlock_shared();
+    }
 }
 
 
@@ -495,12 +2778,8 @@ short int VirtualDisk::specifyWorkingDirectory(std::vector<std::string> parsedPa
 ///parameters: i-number of file to increase link counter
 void VirtualDisk::increaseLinkCount(uint16_t fileINumber)
 {
-    uint16_t linkCount;
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + fileINumber * I_NODE_SIZE + LINK_COUNT_OFFSET, SEEK_SET);
-    fread(&linkCount, sizeof(linkCount), 1, vDiskFile);
-    ++linkCount;
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + fileINumber * I_NODE_SIZE + LINK_COUNT_OFFSET, SEEK_SET);
-    fwrite((const void* ) &linkCount, sizeof(linkCount), 1, vDiskFile);
+    ++iNodeCache.getINode(fileINumber).linkCount;
+    iNodeCache.markDirty(fileINumber);
 }
 
 
@@ -509,426 +2788,776 @@ void VirtualDisk::increaseLinkCount(uint16_t fileINumber)
 ///parameters: i-number of file to decrease link counter
 void VirtualDisk::decreaseLinkCount(uint16_t fileINumber)
 {
-    uint16_t linkCount;
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + fileINumber * I_NODE_SIZE + LINK_COUNT_OFFSET, SEEK_SET);
-    fread(&linkCount, sizeof(linkCount), 1, vDiskFile);
-    --linkCount;
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + fileINumber * I_NODE_SIZE + LINK_COUNT_OFFSET, SEEK_SET);
-    fwrite((const void* ) &linkCount, sizeof(linkCount), 1, vDiskFile);
+    --iNodeCache.getINode(fileINumber).linkCount;
+    iNodeCache.markDirty(fileINumber);
+}
+
+
+
+
+
+/********************************************************************************************************************************************************************************************
+ *                                                                           public methods                                                                                                 *
+ ********************************************************************************************************************************************************************************************/
+
+
+
+///constructor
+///parameters: name of virtual disk file, size of virtual disk file, storage backend (IO_PREAD or IO_MMAP), memory budget of block cache (in bytes), number of transfers kept in flight when copying
+VirtualDisk::VirtualDisk(char* newVDiskFileName, int64_t diskSize, int ioMode, int64_t cacheSize, int newQueueDepth)
+{
+    vDiskFileName = newVDiskFileName;
+    queueDepth = std::max(1, std::min(newQueueDepth, MAX_QUEUE_DEPTH));
+    isJournaling = false;
+    nUncommittedOperations = 0;
+    isCommitWaiting = false;
+    isStopping = false;
+    nReads = 0;
+    for(int i = 0; i < MAX_READAHEAD_STREAMS; ++i)
+    {
+        readaheads[i].iNumber = -1;
+        readaheads[i].isBusy = false;
+        readaheads[i].lastUse = 0;
+        readaheads[i].nextOffset = 0;
+        readaheads[i].firstBlock = 0;
+        readaheads[i].nBlocks = 0;
+        readaheads[i].nCheckedBlocks = 0;
+        readaheads[i].buffer = NULL;
+        readaheads[i].queue = NULL;
+    }
+    iNodeLocks = new std::shared_mutex [MAX_I_NODES];
+    iNodeGenerations = new uint32_t [MAX_I_NODES]();
+    blockMapVersions = new uint32_t [MAX_I_NODES]();
+    fileHandles = new FileHandle [MAX_OPEN_FILES];
+    for(int i = 0; i < MAX_OPEN_FILES; ++i)
+        fileHandles[i].isOpen = false;
+    openFile(ioMode);
+    blockCache.setBudget(&diskIO, cacheSize);
+
+    if(readSuperblock())   ///existing file system - everything needed is in the superblock
+        mountVDisk();
+    else                   ///empty file - create file system
+        formatVDisk(diskSize);
+
+    startJournal();
+}
+
+
+
+///destructor
+VirtualDisk::~VirtualDisk()
+{
+    ///reads ahead must finish before their buffers go
+    for(int i = 0; i < MAX_READAHEAD_STREAMS; ++i)
+        if(NULL != readaheads[i].queue)
+        {
+            waitForReadahead(readaheads[i]);
+            releaseQueue(readaheads[i].queue);
+            delete [] readaheads[i].buffer;
+        }
+
+    stopJournal();
+
+    ///everything committed goes to its place, then journal is not needed any more
+    blockCache.flush();
+    iNodeCache.flush();
+    flushBitmaps();
+    superblock.checksumTableChecksum = diskIO.storeChecksumTable();    ///nothing with a checksum is written after it
+    if(journal.isEnabled())
+        diskIO.sync();
+    superblock.state = STATE_CLEAN;
+    superblock.journalSequence = journal.reset();
+    writeSuperblock();
+    if(journal.isEnabled())
+        diskIO.sync();
+    closeFile();
+    delete [] iNodeLocks;
+    delete [] iNodeGenerations;
+    delete [] blockMapVersions;
+    delete [] fileHandles;
+    for(int i = 0; i < (int)idleQueues.size(); ++i)
+        delete idleQueues[i];
+}
+
+
+
+///function writes data read from a stream to blocks reserved for a new file, each part of a run with a single write, several writes in flight
+///parameters: stream to read data from (NULL if there is no data), reserved runs of blocks (first block, length), number of blocks of the runs to use, number of bytes written (output)
+///return value: -1 on failure, else 0
+int VirtualDisk::fillPlainFile(FILE* source, const std::vector<std::pair<int, int> >& runs, int nBlocks, uint64_t& fileSize)
+{
+    unsigned char* buffers; ///auxiliary buffers to store data, one for each write in flight
+    unsigned char* buffer;
+    int* expectedBytes;     ///number of bytes written from each buffer
+    std::vector<int> freeSlots; ///buffers not being written
+    AsyncIO* queue;
+    uint64_t slot;
+    int64_t bytesWritten;
+    int nSlots;
+    bool writeFailed = false;
+    int firstBlock;
+    int index = 0;          ///index within file of next block to write
+    int n;
+    bool stop = 0 == nBlocks || NULL == source;
+    int bytesRead;
+    int returnValue = 0;
+
+    fileSize = 0;
+
+    ///writes go on in the background while next parts are read from the stream, at most queueDepth of them at once
+    nSlots = (int)std::min((int64_t)queueDepth, std::max(((int64_t)nBlocks + MAX_TRANSFER_BLOCKS - 1) / MAX_TRANSFER_BLOCKS, (int64_t)1));
+    buffers = new unsigned char [(int64_t)nSlots * MAX_TRANSFER_BLOCKS * BLOCK_SIZE];
+    expectedBytes = new int [nSlots];
+    for(int i = nSlots - 1; i >= 0; --i)
+        freeSlots.push_back(i);
+    queue = acquireQueue();
+    for(int r = 0; r < (int)runs.size() && !stop; ++r)
+    {
+        for(int i = 0; i < runs[r].second && index < nBlocks && !stop; i += n, index += n)
+        {
+            n = std::min(std::min(runs[r].second - i, MAX_TRANSFER_BLOCKS), nBlocks - index);
+            firstBlock = runs[r].first + i;
+
+            if(freeSlots.empty())   ///every buffer is being written - wait for one of them
+            {
+                if(-1 == queue->waitForCompletion(slot, bytesWritten) || bytesWritten != expectedBytes[slot])
+                {
+                    writeFailed = true;
+                    stop = true;
+                    break;
+                }
+                freeSlots.push_back((int)slot);
+            }
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+            buffer = buffers + (int64_t)slot * MAX_TRANSFER_BLOCKS * BLOCK_SIZE;
+
+            bytesRead = fread(buffer, 1, n * BLOCK_SIZE, source);
+            if(ferror(source))
+            {
+                std::cerr << "Error reading file to copy!\n";
+                returnValue = -1;
+                stop = true;
+                break;
+            }
+            if(bytesRead > 0)
+            {
+                blockCache.dropBlocks(firstDataIndex + firstBlock, n);     ///cached copies of freed blocks must not be written back over new data
+                expectedBytes[slot] = bytesRead;
+                diskIO.submitWrite(*queue, firstDataIndex + firstBlock, 0, buffer, bytesRead, slot);
+            }
+            else
+                freeSlots.push_back((int)slot);
+            fileSize += (uint64_t)std::max(bytesRead, 0);
+            stop = bytesRead < n * BLOCK_SIZE;  ///end of file
+        }
+    }
+
+    ///wait for writes still in flight
+    while(-1 != queue->waitForCompletion(slot, bytesWritten))
+    {
+        if(bytesWritten != expectedBytes[slot])
+            writeFailed = true;
+    }
+    releaseQueue(queue);
+    if(writeFailed)
+    {
+        std::cerr << "Could not write the entire block!\n";
+        returnValue = -1;
+    }
+
+    delete [] expectedBytes;
+    delete [] buffers;
+    return returnValue;
 }
 
 
 
+///function creates file in a directory and fills it with data read from a stream - the file is put in the directory once its data is written
+///parameters: i-number of directory, name of new file, stream to read data from (NULL if there is no data), number of bytes expected in the stream, storage mode (STORE_PLAIN, STORE_COMPRESSED or STORE_DEDUPLICATED)
+///return value: -1 on failure, else 0
+int VirtualDisk::createFile(short int directoryINumber, char* fileName, FILE* source, int64_t sourceSize, int storageMode)
+{
+    uint32_t* blockAddresses;
+    std::vector<std::pair<int, int> > runs; ///reserved runs of blocks: first block, length
+    short int iNumber;
+    int firstBlock;
+    int runLength;
+    int nBlocksNeeded;
+    int nBlocksReserved = 0;
+    int countBlocks = 0;
+    int position;
+    int n;
+    bool stop = false;
+    int returnValue = 0;
+    uint64_t fileSize = 0;
+
+    ///i-node and blocks are taken as one operation, data is written outside operations and locks (a commit may run meanwhile)
+    ///the file is in no directory until the end, so nobody else finds it and its i-node needs no lock - after a crash it is freed when the disk is opened
+    {
+        Operation operation(this);
+
+        ///find next free i-node or terminate when there is none
+        iNumber = allocateINode();
+        if(-1 == iNumber)
+        {
+            std::cerr << "No free i-node found (too many files)!\n";
+            return -1;
+        }
+
+        INode& file = iNodeCache.resetINode(iNumber);      ///empty i-node, link count set to 0
+        if(STORE_COMPRESSED == storageMode)     ///compressed data is not known in advance - chunks are compressed and stored one by one
+            file.chunkBlocks = COMPRESSION_CHUNK_BLOCKS;
+        else if(STORE_DEDUPLICATED == storageMode)  ///blocks needed are not known before data is looked up
+            file.isDeduplicated = true;
+
+        ///calculate how many blocks are needed
+        nBlocksNeeded = STORE_PLAIN == storageMode ? (int)std::min((sourceSize + BLOCK_SIZE - 1) / BLOCK_SIZE, (int64_t)MAX_FILE_SIZE_IN_BLOCKS) : 0;
+
+        ///reserve free blocks up front, in as long runs of neighbouring blocks as possible
+        while(nBlocksReserved < nBlocksNeeded)
+        {
+            firstBlock = allocateBlockRun(nBlocksNeeded - nBlocksReserved, runLength);
+            if(-1 == firstBlock)
+            {
+                std::cerr << "No free block found (not enough free space)! Copying file stopped.\n";
+                returnValue = -1;
+                break;
+            }
+
+            runs.push_back(std::make_pair((int)firstBlock, runLength));
+            nBlocksReserved += runLength;
+            if(isJournaling)    ///data goes to the run directly, older images of its blocks must not be replayed over it
+                journal.revokeBlocks(firstDataIndex + firstBlock, runLength);
+        }
+
+        ///note block addresses in i-node
+        blockAddresses = new uint32_t [MAX_TRANSFER_BLOCKS];
+        for(int r = 0; r < (int)runs.size() && !stop; ++r)
+        {
+            for(int i = 0; i < runs[r].second; i += n)
+            {
+                n = std::min(runs[r].second - i, MAX_TRANSFER_BLOCKS);
+                for(int j = 0; j < n; ++j)
+                    blockAddresses[j] = runs[r].first + i + j;
+
+                if(n != writeBlockAddresses(iNumber, countBlocks, n, blockAddresses))
+                {
+                    std::cerr << "No free block found (not enough free space)! Copying file stopped.\n";
+                    returnValue = -1;
+                    stop = true;
+                    break;
+                }
+                countBlocks += n;
+            }
+        }
+        delete [] blockAddresses;
+
+        ///blocks with no address in the i-node go back
+        position = 0;
+        for(int r = 0; r < (int)runs.size(); ++r)
+        {
+            for(int i = 0; i < runs[r].second; ++i, ++position)
+                if(position >= countBlocks)
+                    changeBlockStatus(runs[r].first + i, FREE);
+        }
+    }
+
+    if(STORE_COMPRESSED == storageMode)
+        n = fillCompressedFile(iNumber, source, fileSize);
+    else if(STORE_DEDUPLICATED == storageMode)
+        n = fillDeduplicatedFile(iNumber, source, fileSize);
+    else
+        n = fillPlainFile(source, runs, countBlocks, fileSize);
+    if(-1 == n)
+        returnValue = -1;
+
+    ///blocks which were not needed after all (file shrank, could not be read), size and directory entry go as one operation
+    std::unique_lock<std::shared_mutex> directoryLock(iNodeLocks[directoryINumber]);
+    std::unique_lock<std::shared_mutex> fileLock(iNodeLocks[iNumber]);
+    Operation operation(this);
+
+    if(STORE_PLAIN == storageMode)
+        freeFileBlocks(iNumber, (int)((fileSize + BLOCK_SIZE - 1) / BLOCK_SIZE), countBlocks);
+    setFileSize(iNumber, fileSize);
 
+    if(-1 == addDirectoryEntry(directoryINumber, iNumber, fileName))  ///this will increment link count
+    {
+        freeFileBlocks(iNumber, 0, (int)countFileBlocks(fileSize, iNodeCache.getINode(iNumber).chunkBlocks));
+        setFileSize(iNumber, 0);
+        changeINodeStatus(iNumber, FREE);
+        return -1;
+    }
 
-/********************************************************************************************************************************************************************************************
- *                                                                           public methods                                                                                                 *
- ********************************************************************************************************************************************************************************************/
+    return returnValue;
+}
 
 
 
-///constructor
-///parameters: name of virtual disk file, size of virtual disk file
-VirtualDisk::VirtualDisk(char* newVDiskFileName, int diskSize)
+///function copies file from user system to virtual disk
+///parameters: name of file to copy from user system, path to target location, storage mode (STORE_PLAIN, STORE_COMPRESSED or STORE_DEDUPLICATED)
+///return value: -1 on failure, else 0
+int VirtualDisk::copyToVDisk(char* fileNameToCopy, std::string path, int storageMode)
 {
-    vDiskFileName = newVDiskFileName;
-    openFile();
-    setVDiskSize(diskSize);
-    setVDiskParameters();
-    prepareBitmaps();
-    createRootDirectory();
-}
+    FILE* fileToCopy;
+    struct stat fileStatus;
+    int returnValue;
+    short int workingDirectory;
+
+    std::vector<std::string> parsedPath = parsePath(path);
+    workingDirectory = specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    if(-1 == workingDirectory)
+        return -1;
 
+    fileToCopy = fopen(fileNameToCopy, "rb");
+    if(NULL == fileToCopy)
+    {
+        std::cerr << "Could not open file!\n";
+        return -1;
+    }
 
+    fstat(fileno(fileToCopy), &fileStatus);
+    returnValue = createFile(workingDirectory, (char*)parsedPath.back().c_str(), fileToCopy, fileStatus.st_size, storageMode);
 
-///destructor
-VirtualDisk::~VirtualDisk()
-{
-    closeFile();
+    fclose(fileToCopy);
+    return returnValue;
 }
 
 
 
-///function copies file from user system to virtual disk
-///parameters: name of file to copy from user system, path to target location
-void VirtualDisk::copyToVDisk(char* fileNameToCopy, std::string path)
+///function copies directory tree from user system to virtual disk, reading files on several threads and writing them one by one
+///parameters: name of directory to copy from user system, path to target directory (created if it does not exist), storage mode of files
+///return value: -1 if anything could not be copied, else 0
+int VirtualDisk::importDirectory(char* directoryNameToCopy, std::string path, int storageMode)
 {
-    FILE* fileToCopy;
-    unsigned char* buffer = new unsigned char [BLOCK_SIZE]; ///auxiliary buffer to store data
+    std::vector<ImportedFile> files;
+    std::vector<std::thread> readers;
+    std::mutex mutex;
+    std::condition_variable stateChanged;
+    int nextToRead = 0;      ///index of first file not yet taken by a reader
+    int nextToWrite = 0;     ///index of first file not yet written
+    int64_t bytesInFlight = 0;
+    int nReaders;
     short int iNumber;
-    uint16_t blockAddress;
-    uint16_t countBlocks = 0;
-    uint16_t linkCount = 0;
-    uint16_t checkLinkCount;
-    uint16_t bytesUsedInLastBlock;
-    uint32_t fileSize;
-    int bytesRead;
+    bool isDirectory;
+    struct stat fileStatus;
+    FILE* source;
+    int returnValue = 0;
+    short int workingDirectory;
 
-    ///find next free i-node or terminate when there is none
-    iNumber = findNextFreeInode();
-    if(-1 == iNumber || iNumber > (BLOCK_SIZE / I_NODE_SIZE) * nInodeBlocks)
+    if(-1 == stat(directoryNameToCopy, &fileStatus) || !S_ISDIR(fileStatus.st_mode))
     {
-        std::cerr << "No free i-node found (too many files)!\n";
-        return;
+        std::cerr << "Could not open directory!\n";
+        return -1;
     }
-    changeINodeStatus(iNumber, USED);    ///mark i-node as used
-
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + LINK_COUNT_OFFSET, SEEK_SET);
-    fwrite((const void* ) &linkCount, sizeof(linkCount), 1, vDiskFile);  ///set link count to 0
 
+    ///find target directory, create it if needed
     std::vector<std::string> parsedPath = parsePath(path);
-    specifyWorkingDirectory(parsedPath, MODE_OTHER);
-    addDirectoryEntry(workingDirectory, iNumber, (char*)parsedPath.back().c_str());        ///this will increment link count
-
-    fileToCopy = fopen(fileNameToCopy, "rb+");
-    if(NULL == fileToCopy)
+    workingDirectory = specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    if(-1 == workingDirectory)
+        return -1;
+    iNodeLocks[workingDirectory].lock_shared();
+    iNumber = getINumber((char*)parsedPath.back().c_str(), workingDirectory, &isDirectory);
+    iNodeLocks[workingDirectory].unlock_shared();
+    if(-1 == iNumber)
+        iNumber = createChildDirectory(workingDirectory, (char*)parsedPath.back().c_str());
+    else if(!isDirectory)
     {
-        std::cerr << "Could not open file!\n";
-        return;
+        std::cerr << "Given file is not a directory!\n";
+        return -1;
     }
+    if(-1 == iNumber)
+        return -1;
+
+    ///create directories and list files to copy
+    returnValue = walkHostDirectory(directoryNameToCopy, iNumber, files);
 
-    while((bytesRead = fread(buffer, 1, BLOCK_SIZE, fileToCopy)) > 0 && countBlocks < MAX_FILE_SIZE_IN_BLOCKS)
+    ///reader - takes files in order and reads them whole into memory, while not too many bytes wait for writing
+    auto reader = [&]()
     {
-        if(ferror(fileToCopy))
+        std::unique_lock<std::mutex> lock(mutex);
+        std::vector<unsigned char> data;
+        FILE* file;
+        int bytesRead;
+
+        while(true)
         {
-            std::cerr << "Error reading file to copy!\n";
-            fclose(fileToCopy);
-            return;
+            stateChanged.wait(lock, [&]() { return nextToRead == (int)files.size() || nextToRead == nextToWrite || files[nextToRead].isStreamed || bytesInFlight + files[nextToRead].size <= MAX_IMPORT_BYTES_IN_FLIGHT; });
+            if(nextToRead == (int)files.size())
+                return;
+
+            ImportedFile& imported = files[nextToRead++];
+            if(!imported.isStreamed)
+            {
+                bytesInFlight += imported.size;
+                lock.unlock();
+
+                data.clear();
+                file = fopen(imported.hostPath.c_str(), "rb");
+                if(NULL != file)
+                {
+                    data.resize(imported.size);
+                    bytesRead = fread(data.data(), 1, data.size(), file);
+                    imported.failed = ferror(file) || bytesRead != (int)data.size();
+                    fclose(file);
+                }
+                else
+                    imported.failed = true;
+
+                lock.lock();
+                imported.data.swap(data);
+            }
+
+            imported.isRead = true;
+            stateChanged.notify_all();
         }
+    };
+
+    nReaders = std::max(1, std::min((int)std::thread::hardware_concurrency(), MAX_IMPORT_THREADS));
+    for(int i = 0; i < nReaders; ++i)
+        readers.push_back(std::thread(reader));
 
-        ///note how many bytes in last block used
-        bytesUsedInLastBlock = bytesRead;
+    ///writer - the only one touching the virtual disk, writes files in order
+    for(int i = 0; i < (int)files.size(); ++i)
+    {
+        ImportedFile& imported = files[i];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stateChanged.wait(lock, [&]() { return imported.isRead; });
+        }
 
-        ++countBlocks;
+        if(imported.isStreamed)     ///too big to be kept in memory - copied straight from the file
+            source = fopen(imported.hostPath.c_str(), "rb");
+        else if(!imported.failed && !imported.data.empty())
+            source = fmemopen(imported.data.data(), imported.data.size(), "rb");
+        else
+            source = NULL;
 
-        blockAddress = findNextFreeBlock(); ///find next free block
-        if(-1 == blockAddress || blockAddress > freeBlocks - nInodeBlocks)
+        if(imported.failed || (NULL == source && (imported.isStreamed || !imported.data.empty())))
         {
-            std::cerr << "No free block found (not enough free space)! Copying file stopped.\n";
-            fclose(fileToCopy);
-            return;
+            std::cerr << imported.hostPath << ": could not read file!\n";
+            returnValue = -1;
         }
-        changeBlockStatus(blockAddress, USED);  ///mark data block as used
+        else if(-1 == createFile(imported.directoryINumber, (char*)imported.name.c_str(), source, imported.isStreamed ? imported.size : imported.data.size(), storageMode))
+            returnValue = -1;
 
-        ///add block address to i-node table
-        fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + DATA_OFFSET + (countBlocks - 1) * sizeof(blockAddress), SEEK_SET);  ///set file pointer to next free block address
-        fwrite((const void* ) &blockAddress, sizeof(blockAddress), 1, vDiskFile);
+        if(NULL != source)
+            fclose(source);
 
-        ///write data from buffer
-        fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE, SEEK_SET);
-        fwrite(buffer, 1, bytesRead, vDiskFile);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if(!imported.isStreamed)
+                bytesInFlight -= imported.size;
+            std::vector<unsigned char>().swap(imported.data);
+            ++nextToWrite;
+            stateChanged.notify_all();
+        }
     }
 
-    ///note file size
-    fileSize = (uint32_t)(countBlocks - 1) * BLOCK_SIZE + (uint32_t)bytesUsedInLastBlock;
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fwrite((const void*) &fileSize, sizeof(fileSize), 1, vDiskFile);
+    for(int i = 0; i < nReaders; ++i)
+        readers[i].join();
 
-    fclose(fileToCopy);
+    return returnValue;
 }
 
 
 
 ///function copies file from virtual disk to user system
 ///parameters: path to file on virtual disk, name of target file on user system
-void VirtualDisk::copyFromVDisk(std::string path, char* fileNameToCopy)
+int VirtualDisk::copyFromVDisk(std::string path, char* fileNameToCopy)
 {
-    FILE* fileToCopy;
-    unsigned char* buffer = new unsigned char [BLOCK_SIZE]; ///auxiliary buffer to store data
-    uint16_t blockAddress;
-    uint16_t countBlocks;
-    uint16_t bytesUsedInLastBlock;
+    int fileToCopy;
+    bool failed = false;
     short int iNumber;
-    uint16_t expectedBytes;
-    uint32_t fileSize;
+    uint64_t position = 0; ///offset within both files
+    short int workingDirectory;
+    unsigned char* buffers; ///auxiliary buffers, one for each part being written
+    unsigned char* buffer;
+    int64_t* transferBytes; ///number of bytes of part being written from each buffer
+    std::vector<int> freeSlots; ///buffers not in use
+    AsyncIO* queue;
+    uint64_t slot;
+    int64_t bytesDone;
+    int64_t nBytesRead;
+    int nSlots;
 
     std::vector<std::string> parsedPath = parsePath(path);
-    specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    workingDirectory = specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    if(-1 == workingDirectory)
+        return -1;
 
-    iNumber = getINumber((char*)parsedPath.back().c_str(), workingDirectory);
+    iNumber = lockFile((char*)parsedPath.back().c_str(), workingDirectory, false);
     if(-1 == iNumber)
     {
         std::cerr << "No such file exists!\n";
-        return;
+        return -1;
     }
+    std::shared_lock<std::shared_mutex> fileLock(iNodeLocks[iNumber], std::adopt_lock);
+    INode& file = iNodeCache.getINode(iNumber);
 
-
-    ///read size of file
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fread(&fileSize, sizeof(fileSize), 1, vDiskFile);
-
-
-    ///calculate count blocks and how many bytes in last block were used
-    bytesUsedInLastBlock = (uint16_t)(fileSize % BLOCK_SIZE);
-    countBlocks = (uint16_t)(fileSize / BLOCK_SIZE);
-    if(bytesUsedInLastBlock) ///last block not empty
-        ++countBlocks;
-
-
-    fileToCopy = fopen(fileNameToCopy, "wb+");
-    if(NULL == fileToCopy)
+    fileToCopy = ::open(fileNameToCopy, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(-1 == fileToCopy)
     {
         std::cerr << "Could not open file!\n";
-        return;
+        return -1;
     }
 
-    for(int i = 0; i < countBlocks; ++i)
+    ///file stored plainly - runs of blocks go from the image to the target file inside the kernel
+    if(0 == file.chunkBlocks && !file.isDeduplicated)
     {
-        if(i < countBlocks - 1) ///normal case
-            expectedBytes = BLOCK_SIZE;
-        else                    ///last block case
-            expectedBytes = bytesUsedInLastBlock;
-
+        failed = -1 == copyFileBlocks(iNumber, fileToCopy);
+        if(!failed && -1 == ftruncate(fileToCopy, file.size))    ///holes at the end leave nothing copied there
+        {
+            std::cerr << "Could not write file!\n";
+            failed = true;
+        }
+        ::close(fileToCopy);
+        return failed ? -1 : 0;
+    }
 
-        ///read block address
-        fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + DATA_OFFSET + i * ADDRESS_SIZE, SEEK_SET);
-        fread(&blockAddress, sizeof(uint16_t), 1, vDiskFile);
+    ///compressed or deduplicated file is read in order (following blocks are read ahead) and parts are written to target file in the background,
+    ///at most queueDepth of them at once
+    nSlots = std::min((int64_t)queueDepth, std::max((int64_t)((file.size + READ_CHUNK_SIZE - 1) / READ_CHUNK_SIZE), (int64_t)1));
+    buffers = new unsigned char [(int64_t)nSlots * READ_CHUNK_SIZE];
+    transferBytes = new int64_t [nSlots];
+    for(int i = nSlots - 1; i >= 0; --i)
+        freeSlots.push_back(i);
+    queue = acquireQueue();
+    while(!failed && position < file.size)
+    {
+        ///written part frees its buffer
+        if(freeSlots.empty())
+        {
+            if(-1 == queue->waitForCompletion(slot, bytesDone) || bytesDone != transferBytes[slot])
+            {
+                std::cerr << "Could not write file!\n";
+                failed = true;
+                break;
+            }
+            freeSlots.push_back((int)slot);
+        }
 
-        ///read block content into buffer
-        fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE, SEEK_SET);
+        slot = freeSlots.back();
+        buffer = buffers + (int64_t)slot * READ_CHUNK_SIZE;
+        nBytesRead = readFile(iNumber, NULL, position, READ_CHUNK_SIZE, buffer);
+        if(nBytesRead <= 0)
+        {
+            failed = true;
+            break;
+        }
 
+        ///part of zeros only (e.g. a hole) is not written, target file is left sparse there
+        if(0 != buffer[0] || 0 != memcmp(buffer, buffer + 1, nBytesRead - 1))
+        {
+            freeSlots.pop_back();
+            transferBytes[slot] = nBytesRead;
+            queue->submit(fileToCopy, true, buffer, position, nBytesRead, slot);
+        }
+        position += nBytesRead;
+    }
 
-        if(expectedBytes != fread(buffer, 1, expectedBytes, vDiskFile))
+    ///buffers cannot be freed while anything is still in flight
+    while(-1 != queue->waitForCompletion(slot, bytesDone))
+        if(!failed && bytesDone != transferBytes[slot])
         {
-            std::cerr << "Could not read the entire block!\n";
-            fclose(fileToCopy);
-            return;
+            std::cerr << "Could not write file!\n";
+            failed = true;
         }
-        ///write buffer into file
-        fseek(fileToCopy, 0, SEEK_END);
-        fwrite(buffer, 1, expectedBytes, fileToCopy);
+    releaseQueue(queue);
+
+    ///zeros at the end of the file leave nothing written there
+    if(!failed && -1 == ftruncate(fileToCopy, file.size))
+    {
+        std::cerr << "Could not write file!\n";
+        failed = true;
     }
 
-    fclose(fileToCopy);
+    delete [] transferBytes;
+    delete [] buffers;
+    ::close(fileToCopy);
+    return failed ? -1 : 0;
 }
 
 
 
 ///function deletes a file from virtual disk
 ///parameters: path to file to delete
-void VirtualDisk::deleteFile(std::string path)
+int VirtualDisk::deleteFile(std::string path)
 {
-    uint16_t blockAddress;
-    uint16_t countBlocks;
-    uint32_t fileSize;
+    int countBlocks;
     short int iNumber;
-    uint16_t linkCount;
     bool isDirectory;
+    short int workingDirectory;
 
     std::vector<std::string> parsedPath = parsePath(path);
-    specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    workingDirectory = specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    if(-1 == workingDirectory)
+        return -1;
 
-    iNumber = getINumber((char*)parsedPath.back().c_str(), workingDirectory);
-    if(-1 == iNumber)
+    ///directory and file are locked before the operation starts - a file in use is waited for with the directory unlocked, then looked up again
+    std::unique_lock<std::shared_mutex> directoryLock(iNodeLocks[workingDirectory], std::defer_lock);
+    while(true)
     {
-        std::cerr << "No such file exists!\n";
-        return;
-    }
+        directoryLock.lock();
+        iNumber = getINumber((char*)parsedPath.back().c_str(), workingDirectory, &isDirectory);
+        if(-1 == iNumber)
+        {
+            std::cerr << "No such file exists!\n";
+            return -1;
+        }
 
-    ///check if it is a directory
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + IS_DIRECTORY_OFFSET, SEEK_SET);
-    fread(&isDirectory, sizeof(isDirectory), 1, vDiskFile);
-    if(isDirectory)
-    {
-        std::cerr << "Given file is a directory (removing directories not yet supported)!\n";
-        return;
+        ///check if it is a directory
+        if(isDirectory)
+        {
+            std::cerr << "Given file is a directory (removing directories not yet supported)!\n";
+            return -1;
+        }
+
+        if(iNodeLocks[iNumber].try_lock())
+            break;
+        directoryLock.unlock();
+        waitForINode(iNumber, true);
     }
+    std::unique_lock<std::shared_mutex> fileLock(iNodeLocks[iNumber], std::adopt_lock);
+    Operation operation(this);
+    INode& file = iNodeCache.getINode(iNumber);
 
     deleteDirectoryEntry(workingDirectory, (char*)parsedPath.back().c_str());
+    directoryLock.unlock();
 
     decreaseLinkCount(iNumber);
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + LINK_COUNT_OFFSET, SEEK_SET);
-    fread(&linkCount, sizeof(linkCount), 1, vDiskFile);
-    if(linkCount > 0) ///other links point to this file, cannot delete
-        return;
-
-    ///read size of file
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fread(&fileSize, sizeof(fileSize), 1, vDiskFile);
+    if(file.linkCount > 0) ///other links point to this file, cannot delete
+        return 0;
 
     ///calculate count blocks
-    countBlocks = (uint16_t)(fileSize / BLOCK_SIZE);
-    if(fileSize % BLOCK_SIZE) ///last block not empty
-        ++countBlocks;
-
-
+    countBlocks = (int)countFileBlocks(file.size, file.chunkBlocks);
 
-    for(int i = 0; i < countBlocks; ++i)
-    {
-        ///read block address
-        fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + DATA_OFFSET + i * ADDRESS_SIZE, SEEK_SET);
-        fread(&blockAddress, sizeof(uint16_t), 1, vDiskFile);
-
-        ///free block
-        changeBlockStatus(blockAddress, FREE);
-    }
+    ///free blocks
+    dropReadahead(iNumber);
+    freeFileBlocks(iNumber, 0, countBlocks);
+    setFileSize(iNumber, 0);
 
     ///free i-node
     changeINodeStatus(iNumber, FREE);
+    return 0;
 }
 
 
 
-///function adds null bytes to the end of given file
+///function adds null bytes to the end of given file - they are a hole, no blocks are allocated for them
 ///parameters: path to file, number of bytes to add
-void VirtualDisk::addBytes(std::string path, unsigned int nBytesToAdd)
+int VirtualDisk::addBytes(std::string path, uint64_t nBytesToAdd)
 {
     short int iNumber;
-    uint32_t oldFileSize;
-    uint32_t newFileSize;
-    uint16_t nBlocksToAllocate = 0;
-    uint16_t countBlocks;
-    uint16_t bytesUsedInLastBlock;
-    uint16_t blockAddress;
+    uint64_t newFileSize;
+    int64_t newCountBlocks;
+    short int workingDirectory;
 
     std::vector<std::string> parsedPath = parsePath(path);
-    specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    workingDirectory = specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    if(-1 == workingDirectory)
+        return -1;
 
-    iNumber = getINumber((char*)parsedPath.back().c_str(), workingDirectory);
+    iNumber = lockFile((char*)parsedPath.back().c_str(), workingDirectory, true);
     if(-1 == iNumber)
     {
         std::cerr << "No such file exists!\n";
-        return;
+        return -1;
     }
+    std::unique_lock<std::shared_mutex> fileLock(iNodeLocks[iNumber], std::adopt_lock);
+    Operation operation(this);
+    INode& file = iNodeCache.getINode(iNumber);
 
+    newFileSize = file.size + nBytesToAdd;
 
-    ///read size of file
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fread(&oldFileSize, sizeof(oldFileSize), 1, vDiskFile);
-
-    newFileSize = oldFileSize + nBytesToAdd;
-
-    ///write size of file
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fwrite((const void*) &newFileSize, sizeof(newFileSize), 1, vDiskFile);
-
-    bytesUsedInLastBlock = oldFileSize % BLOCK_SIZE;
-    countBlocks = oldFileSize / BLOCK_SIZE;
-    if(bytesUsedInLastBlock)
-        ++countBlocks;
-
-    ///calculate how many last blocks should be allocated
-    if(bytesUsedInLastBlock)  ///if last block was not empty
-        nBytesToAdd -= (BLOCK_SIZE - bytesUsedInLastBlock);
-
-    nBlocksToAllocate += (nBytesToAdd / BLOCK_SIZE); ///other full blocks
-    if(nBytesToAdd % BLOCK_SIZE)
-        ++nBlocksToAllocate;
-
-    for(int i = 1; i <= nBlocksToAllocate; ++i)
+    ///calculate how many blocks will be used
+    newCountBlocks = countFileBlocks(newFileSize, file.chunkBlocks);
+    if(newCountBlocks > MAX_FILE_SIZE_IN_BLOCKS)
     {
-        blockAddress = findNextFreeBlock(); ///find next free block
-        if(-1 == blockAddress || blockAddress > freeBlocks - nInodeBlocks)
-        {
-            std::cerr << "No free block found (not enough free space)! Adding bytes stopped.\n";
-            return;
-        }
-        changeBlockStatus(blockAddress, USED);  ///mark data block as used
-
-        ///add block address to i-node table
-        fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + DATA_OFFSET + (countBlocks + i) * sizeof(blockAddress), SEEK_SET);  ///set file pointer to next free block address
-        fwrite((const void* ) &blockAddress, sizeof(blockAddress), 1, vDiskFile);
-
+        std::cerr << "File would be too big! Adding bytes stopped.\n";
+        return -1;
     }
 
+    return resizeFile(iNumber, newFileSize);
 }
 
 
 
 ///function deletes bytes from the end of a given file
 ///parameters: path to file, number of bytes to delete
-void VirtualDisk::deleteBytes(std::string path, unsigned int nBytesToDelete)
+int VirtualDisk::deleteBytes(std::string path, uint64_t nBytesToDelete)
 {
     short int iNumber;
-    uint32_t oldFileSize;
-    uint32_t newFileSize;
-    uint16_t nBlocksToFree = 0;
-    uint16_t countBlocks;
-    uint16_t bytesUsedInLastBlock;
-    uint16_t blockAddress;
+    short int workingDirectory;
 
     std::vector<std::string> parsedPath = parsePath(path);
-    specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    workingDirectory = specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    if(-1 == workingDirectory)
+        return -1;
 
-    iNumber = getINumber((char*)parsedPath.back().c_str(), workingDirectory);
+    iNumber = lockFile((char*)parsedPath.back().c_str(), workingDirectory, true);
     if(-1 == iNumber)
     {
         std::cerr << "No such file exists!\n";
-        return;
-    }
-
-
-    ///read size of file
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fread(&oldFileSize, sizeof(oldFileSize), 1, vDiskFile);
-
-    newFileSize = oldFileSize - nBytesToDelete;
-
-    ///write size of file
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fwrite((const void*) &newFileSize, sizeof(newFileSize), 1, vDiskFile);
-
-    bytesUsedInLastBlock = oldFileSize % BLOCK_SIZE;
-    countBlocks = oldFileSize / BLOCK_SIZE;
-    if(bytesUsedInLastBlock)
-        ++countBlocks;
-
-    ///calculate how many last blocks should be freed
-    if(nBytesToDelete >= bytesUsedInLastBlock) ///last block should be freed
-    {
-        ++nBlocksToFree;
-        nBytesToDelete -= bytesUsedInLastBlock;
+        return -1;
     }
-    nBlocksToFree += (nBytesToDelete / BLOCK_SIZE); ///other full blocks
-    nBlocksToFree = std::min(nBlocksToFree, countBlocks); ///no more than allocated blocks should be freed
-
-    for(int i = 0; i < nBlocksToFree; ++i)
-    {
-        ///read block address
-        fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + DATA_OFFSET + (countBlocks - i - 1) * ADDRESS_SIZE, SEEK_SET);
-        fread(&blockAddress, sizeof(uint16_t), 1, vDiskFile);
+    std::unique_lock<std::shared_mutex> fileLock(iNodeLocks[iNumber], std::adopt_lock);
+    Operation operation(this);
+    INode& file = iNodeCache.getINode(iNumber);
 
-        ///free block
-        changeBlockStatus(blockAddress, FREE);
-    }
+    nBytesToDelete = std::min(nBytesToDelete, (uint64_t)file.size); ///no more than whole file can be deleted
 
+    ///free last blocks and write size of file
+    return resizeFile(iNumber, file.size - nBytesToDelete);
 }
 
 
 
 ///function prints disk usage info
-void VirtualDisk::printDiskUsageInfo()
+///parameters: whether counters should be recomputed from bitmaps and i-nodes and corrected
+void VirtualDisk::printDiskUsageInfo(bool verify)
 {
     int nInodesTotal = nInodeBlocks * BLOCK_SIZE / I_NODE_SIZE;
     int nDataBlocksTotal = nBlocks - firstDataIndex;
-    int nInodesInUse = 0;
-    int nDataBlocksInUse = 0;
-    int sizeForUserDataTotal = nDataBlocksTotal * BLOCK_SIZE;
-    int sizeForUserDataInUse = 0;
-    uint16_t fileSize; ///auxiliary
+    int64_t sizeForUserDataTotal = (int64_t)nDataBlocksTotal * BLOCK_SIZE;
+    Operation operation(verify ? this : NULL);    ///corrected counters go to the journal
+    std::lock_guard<std::mutex> lock(allocationMutex);
+
+    if(verify && recountUsage())
+        std::cerr << "Usage counters were wrong, corrected!\n";
+
+    std::cout << "Usage of space (in bytes): " << superblock.nBytesInUse << "/" << sizeForUserDataTotal << "\n";
+    std::cout << "Usage of data blocks: " << superblock.nDataBlocksInUse << "/" << nDataBlocksTotal << "\n";
+    std::cout << "Usage of i-nodes: " << superblock.nINodesInUse << "/" << nInodesTotal << "\n";
+    std::cout << "Deduplicated blocks: " << superblock.nIndexedBlocks << " (" << superblock.nSharedReferences << " more references to them)\n";
+    if(superblock.nDataBlocksInUse > 0)     ///blocks referenced by files for every block used
+        std::cout << "Deduplication ratio: " << (double)(superblock.nDataBlocksInUse + superblock.nSharedReferences) / superblock.nDataBlocksInUse << "\n";
+}
 
-    ///count i-nodes and size of user data in use
-    for(int i = 0; i < nInodesTotal; ++i)
-    {
-        if(checkBitFromBitmap(iNodeBitmapIndex, i))
-        {
-            ++nInodesInUse;
 
-            ///read size of file
-            fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + i * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-            fread(&fileSize, sizeof(fileSize), 1, vDiskFile);
-            sizeForUserDataInUse += (int)fileSize;
-        }
-    }
 
-    ///count data blocks in use
-    for(int i = 0; i < nDataBlocksTotal; ++i)
-        if(checkBitFromBitmap(dataBitmapIndex, i))
-            ++nDataBlocksInUse;
+///function checks every block of the disk against its checksum and lists damaged ones
+///return value: -1 if a block is damaged, else 0
+int VirtualDisk::scrub()
+{
+    std::vector<int64_t> suspectBlocks;
+    std::vector<int64_t> damagedBlocks;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double seconds;
+
+    scanBlocks(false, suspectBlocks);
+
+    ///a block being written right now may not match for a moment - it is damaged if it still does not
+    for(int i = 0; i < (int)suspectBlocks.size(); ++i)
+        diskIO.checkBlocks(suspectBlocks[i], 1, false, damagedBlocks);
+
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Checked blocks: " << nBlocks - 1 - nChecksumBlocks << " (" << (int64_t)nBlocks * BLOCK_SIZE / (1024 * 1024) << "MB in " << seconds << "s)\n";
+    std::cout << "Damaged blocks: " << damagedBlocks.size() << "\n";
+    for(int i = 0; i < (int)damagedBlocks.size(); ++i)
+        std::cout << "Block " << damagedBlocks[i] << ": " << describeBlock(damagedBlocks[i]) << "\n";
 
-    std::cout << "Usage of space (in bytes): " << sizeForUserDataInUse << "/" << sizeForUserDataTotal << "\n";
-    std::cout << "Usage of data blocks: " << nDataBlocksInUse << "/" << nDataBlocksTotal << "\n";
-    std::cout << "Usage of i-nodes: " << nInodesInUse << "/" << nInodesTotal << "\n";
+    return damagedBlocks.empty() ? 0 : -1;
 }
 
 
@@ -936,78 +3565,93 @@ void VirtualDisk::printDiskUsageInfo()
 ///function lists current directory
 void VirtualDisk::listDirectory()
 {
-    uint16_t blockAddress;
-    uint16_t sizeOfDirectory;
+    short int directoryINumber;
+    int nBuckets;
+    char* buffer;
+    char* entry;
     uint16_t entryINumber;
-    uint16_t entryLinkCount;
-    uint16_t entrySize;
-    uint16_t directoryINumber = (uint16_t)currentDirectory;
-    bool entryFileType;
-    char* entryName = new char[DIRECTORY_NAME_SIZE];
-
-    ///read directory block address
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + directoryINumber * I_NODE_SIZE + DATA_OFFSET, SEEK_SET);
-    fread(&blockAddress, sizeof(blockAddress), 1, vDiskFile);
-
-    ///read size
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + directoryINumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fread(&sizeOfDirectory, sizeof(sizeOfDirectory), 1, vDiskFile);
-
-    for(int i = 0; i < sizeOfDirectory / DIRECTORY_ENTRY_SIZE; ++i)
-    {
-        ///print entry i-number
-        fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE + DIRECTORY_ENTRY_SIZE * i + DIRECTORY_I_NUMBER_OFFSET, SEEK_SET);
-        fread(&entryINumber, sizeof(entryINumber), 1, vDiskFile);
-        std::cout << entryINumber << " ";
-
-        ///print entry link count
-        fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + entryINumber * I_NODE_SIZE + LINK_COUNT_OFFSET, SEEK_SET);
-        fread(&entryLinkCount, sizeof(entryLinkCount), 1, vDiskFile);
-        std::cout << entryLinkCount << " ";
-
-        ///print entry size
-        fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + entryINumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-        fread(&entrySize, sizeof(entrySize), 1, vDiskFile);
-        std::cout << entrySize << " ";
-
-        ///print file type
-        fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + entryINumber * I_NODE_SIZE + IS_DIRECTORY_OFFSET, SEEK_SET);
-        fread(&entryFileType, sizeof(entryFileType), 1, vDiskFile);
-        if(entryFileType)
-            std::cout << "directory ";
-        else
-            std::cout << "file ";
+    uint32_t blockAddress;
+
+    {
+        std::lock_guard<std::mutex> lock(currentDirectoryMutex);
+        directoryINumber = currentDirectory;
+    }
+    std::shared_lock<std::shared_mutex> directoryLock(iNodeLocks[directoryINumber]);
+
+    nBuckets = (int)(iNodeCache.getINode(directoryINumber).size / BLOCK_SIZE);
+    buffer = new char [BLOCK_SIZE];
+
+    for(int b = 0; b < nBuckets; ++b)
+    {
+        ///read next bucket
+        readBlockAddresses(directoryINumber, b, 1, &blockAddress);
+        blockCache.readBlock(firstDataIndex + blockAddress, 0, buffer, BLOCK_SIZE);
+
+        for(int i = 0; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i)
+        {
+            entry = buffer + DIRECTORY_ENTRY_SIZE * i;
+            if('\0' == entry[DIRECTORY_NAME_OFFSET])  ///empty slot
+                continue;
+
+            ///print entry i-number
+            memcpy(&entryINumber, entry + DIRECTORY_I_NUMBER_OFFSET, sizeof(entryINumber));
+            std::cout << entryINumber << " ";
+
+            INode& file = iNodeCache.getINode(entryINumber);  ///not locked - size of a file being changed right now may be out of date
+
+            ///print entry link count
+            std::cout << file.linkCount << " ";
 
-        ///print entry name
-        fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE + DIRECTORY_ENTRY_SIZE * i + DIRECTORY_NAME_OFFSET, SEEK_SET);
-        fread(entryName, sizeof(char), DIRECTORY_NAME_SIZE, vDiskFile);
-        puts(entryName);
+            ///print entry size
+            std::cout << file.size << " ";
+
+            ///print file type
+            if(file.isDirectory)
+                std::cout << "directory ";
+            else
+                std::cout << "file ";
+
+            ///print entry name
+            std::cout << std::string(entry + DIRECTORY_NAME_OFFSET, strnlen(entry + DIRECTORY_NAME_OFFSET, DIRECTORY_NAME_SIZE)) << "\n";
+        }
     }
+
+    delete [] buffer;
 }
 
 
 
 ///function creates new directory in location specified by given path
 ///parameters: path to new directory
-void VirtualDisk::createNewDirectory(std::string path)
+int VirtualDisk::createNewDirectory(std::string path)
 {
+    short int workingDirectory;
+
     std::vector<std::string> parsedPath = parsePath(path);
-    specifyWorkingDirectory(parsedPath, MODE_OTHER);
-    createChildDirectory(workingDirectory, (char*)parsedPath.back().c_str());
+    workingDirectory = specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    if(-1 == workingDirectory)
+        return -1;
+    return -1 == createChildDirectory(workingDirectory, (char*)parsedPath.back().c_str()) ? -1 : 0;
 }
 
 
 
 ///function changes current directory
 ///parameters: path to new current directory
-void VirtualDisk::changeDirectory(std::string path)
+int VirtualDisk::changeDirectory(std::string path)
 {
+    short int workingDirectory;
+    std::vector<std::string> workingPath;
+
     std::vector<std::string> parsedPath = parsePath(path);
-    if(-1 != specifyWorkingDirectory(parsedPath, MODE_CD))
-    {
-        currentDirectory = workingDirectory;
-        pathToCurrentDir = workingPath;
-    }
+    workingDirectory = specifyWorkingDirectory(parsedPath, MODE_CD, &workingPath);
+    if(-1 == workingDirectory)
+        return -1;
+
+    std::lock_guard<std::mutex> lock(currentDirectoryMutex);
+    currentDirectory = workingDirectory;
+    pathToCurrentDir = workingPath;
+    return 0;
 }
 
 
@@ -1015,6 +3659,8 @@ void VirtualDisk::changeDirectory(std::string path)
 ///function prints path to current directory
 void VirtualDisk::printPath()
 {
+    std::lock_guard<std::mutex> lock(currentDirectoryMutex);
+
     if(pathToCurrentDir.empty())                       ///root directory
         std::cout << "/";
 
@@ -1028,92 +3674,401 @@ void VirtualDisk::printPath()
 
 ///function adds link to a given file
 ///parameters: path to existing file, path to new file
-void VirtualDisk::addLink(std::string target, std::string linkName)
+int VirtualDisk::addLink(std::string target, std::string linkName)
 {
     short int iNumber;
+    short int targetDirectory;  ///directory holding existing file
+    short int linkDirectory;    ///directory to add new link to
     bool isDirectory;
+    int returnValue = -1;
 
-    ///find i-number
+    ///find directories
     std::vector<std::string> parsedPathToTarget = parsePath(target);
-    specifyWorkingDirectory(parsedPathToTarget, MODE_OTHER);
-    iNumber = getINumber((char*)parsedPathToTarget.back().c_str(), (uint16_t)workingDirectory);
-    if(-1 == iNumber)
+    targetDirectory = specifyWorkingDirectory(parsedPathToTarget, MODE_OTHER);
+    if(-1 == targetDirectory)
+        return -1;
+    std::vector<std::string> parsedPathToNewLink = parsePath(linkName);
+    linkDirectory = specifyWorkingDirectory(parsedPathToNewLink, MODE_OTHER);
+    if(-1 == linkDirectory)
+        return -1;
+
+    while(true)
     {
+        ///lock both directories in order of i-numbers, the changed one exclusively
+        if(targetDirectory < linkDirectory)
+            iNodeLocks[targetDirectory].lock_shared();
+        iNodeLocks[linkDirectory].lock();
+        if(targetDirectory > linkDirectory)
+            iNodeLocks[targetDirectory].lock_shared();
+
+        ///find i-number and lock the file, its link count changes - a file in use is waited for with directories unlocked, then looked up again
+        iNumber = getINumber((char*)parsedPathToTarget.back().c_str(), (uint16_t)targetDirectory, &isDirectory);
+        if(-1 == iNumber || isDirectory || iNodeLocks[iNumber].try_lock())
+            break;
+        iNodeLocks[linkDirectory].unlock();
+        if(targetDirectory != linkDirectory)
+            iNodeLocks[targetDirectory].unlock_shared();
+        waitForINode(iNumber, true);
+    }
+
+    if(-1 == iNumber)
         std::cerr << "No such file exists!\n";
-        return;
+    else if(isDirectory)  ///check if it is a directory
+        std::cerr << "Given file is a directory (links to directories not allowed)!\n";
+    else                  ///add to directory
+    {
+        {
+            Operation operation(this);
+            returnValue = addDirectoryEntry(linkDirectory, iNumber, (char*)parsedPathToNewLink.back().c_str());
+        }
+        iNodeLocks[iNumber].unlock();
     }
 
-    ///check if it is a directory
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + IS_DIRECTORY_OFFSET, SEEK_SET);
-    fread(&isDirectory, sizeof(isDirectory), 1, vDiskFile);
-    if(isDirectory)
+    iNodeLocks[linkDirectory].unlock();
+    if(targetDirectory != linkDirectory)
+        iNodeLocks[targetDirectory].unlock_shared();
+    return returnValue;
+}
+
+
+
+///function reads bytes of a file, exactly as they are (sequential reads are served from blocks read ahead in the background)
+///parameters: path to file, offset within file, number of bytes, destination buffer
+///return value: number of bytes read (less than asked at end of file), -1 on failure
+int64_t VirtualDisk::read(std::string path, uint64_t offset, int64_t nBytes, void* destination)
+{
+    short int iNumber;
+    short int workingDirectory;
+
+    std::vector<std::string> parsedPath = parsePath(path);
+    workingDirectory = specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    if(-1 == workingDirectory)
+        return -1;
+
+    iNumber = lockFile((char*)parsedPath.back().c_str(), workingDirectory, false);
+    if(-1 == iNumber)
     {
-        std::cerr << "Given file is a directory (links to directories not allowed)!\n";
-        return;
+        std::cerr << "No such file exists!\n";
+        return -1;
     }
+    std::shared_lock<std::shared_mutex> fileLock(iNodeLocks[iNumber], std::adopt_lock);
 
-    ///add to directory
-    std::vector<std::string> parsedPathToNewLink = parsePath(linkName);
-    specifyWorkingDirectory(parsedPathToNewLink, MODE_OTHER);
-    addDirectoryEntry((short int)workingDirectory, iNumber, (char*)parsedPathToNewLink.back().c_str());
+    return readFile(iNumber, NULL, offset, nBytes, destination);
 }
 
 
 
-///function prints contents of a given file on console
-///parameters: path to file to print on console
-void VirtualDisk::printOnConsole(std::string path)
+///function opens a file for reading and writing at any offset, without resolving its path again
+///parameters: path to file
+///return value: handle of file, -1 on failure
+int VirtualDisk::open(std::string path)
 {
-    unsigned char* buffer = new unsigned char [BLOCK_SIZE]; ///auxiliary buffer to store data
-    uint16_t blockAddress;
-    uint16_t countBlocks;
-    uint16_t bytesUsedInLastBlock;
     short int iNumber;
-    uint16_t expectedBytes;
-    uint32_t fileSize;
+    short int workingDirectory;
+    int handle = -1;
 
     std::vector<std::string> parsedPath = parsePath(path);
-    specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    workingDirectory = specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    if(-1 == workingDirectory)
+        return -1;
 
-    iNumber = getINumber((char*)parsedPath.back().c_str(), workingDirectory);
+    iNumber = lockFile((char*)parsedPath.back().c_str(), workingDirectory, false);
     if(-1 == iNumber)
     {
         std::cerr << "No such file exists!\n";
-        return;
+        return -1;
+    }
+    std::shared_lock<std::shared_mutex> fileLock(iNodeLocks[iNumber], std::adopt_lock);
+
+    if(iNodeCache.getINode(iNumber).isDirectory)
+    {
+        std::cerr << "Given file is a directory!\n";
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(handleMutex);
+    for(int i = 0; i < MAX_OPEN_FILES && -1 == handle; ++i)
+        if(!fileHandles[i].isOpen)
+            handle = i;
+    if(-1 == handle)
+    {
+        std::cerr << "Too many open files!\n";
+        return -1;
+    }
+
+    ///block map is read on first use
+    fileHandles[handle].isOpen = true;
+    fileHandles[handle].iNumber = iNumber;
+    fileHandles[handle].generation = iNodeGenerations[iNumber];
+    fileHandles[handle].isMapRead = false;
+    return handle;
+}
+
+
+
+///function closes a handle returned by open() (it must not be in use by another thread)
+///parameters: handle
+///return value: -1 if handle is not open, else 0
+int VirtualDisk::close(int handle)
+{
+    FileHandle* fileHandle = getHandle(handle);
+
+    if(NULL == fileHandle)
+        return -1;
+
+    std::lock_guard<std::mutex> lock(handleMutex);
+    std::vector<uint32_t>().swap(fileHandle->blockMap);
+    fileHandle->isOpen = false;
+    return 0;
+}
+
+
+
+///function reads bytes of an open file
+///parameters: handle, offset within file, number of bytes, destination buffer
+///return value: number of bytes read (less than asked at end of file), -1 on failure
+int64_t VirtualDisk::pread(int handle, uint64_t offset, int64_t nBytes, void* destination)
+{
+    FileHandle* fileHandle = getHandle(handle);
+
+    if(NULL == fileHandle)
+        return -1;
+
+    std::shared_lock<std::shared_mutex> fileLock(iNodeLocks[fileHandle->iNumber]);
+    std::lock_guard<std::mutex> mapLock(fileHandle->mapMutex);
+    if(-1 == checkHandle(*fileHandle))
+        return -1;
+
+    return readFile(fileHandle->iNumber, fileHandle->blockMap.data(), offset, nBytes, destination);
+}
+
+
+
+///function writes bytes of an open file, touching only blocks they fall into - holes get blocks, file grows if written past its end
+///parameters: handle, offset within file, number of bytes, source buffer
+///return value: number of bytes written, -1 on failure
+int64_t VirtualDisk::pwrite(int handle, uint64_t offset, int64_t nBytes, const void* source)
+{
+    const unsigned char* data = (const unsigned char*)source;
+    unsigned char* buffer;      ///auxiliary buffer for whole blocks given to a hole or replacing blocks of a deduplicated file
+    uint32_t* blockAddresses;
+    uint32_t* oldAddresses;     ///blocks replaced by new ones
+    bool isRead;
+    short int iNumber;
+    int64_t index;              ///index within file of next block to write
+    int offsetInBlock;
+    int runLength;
+    int runBytes;
+    int bytesWritten;
+    int firstBlock;
+    int nWritten;
+    bool failed = false;
+    int64_t nBytesLeft = nBytes;
+    FileHandle* fileHandle = getHandle(handle);
+
+    if(NULL == fileHandle)
+        return -1;
+    if(nBytes <= 0)
+        return 0;
+
+    iNumber = fileHandle->iNumber;
+    std::unique_lock<std::shared_mutex> fileLock(iNodeLocks[iNumber]);
+    std::lock_guard<std::mutex> mapLock(fileHandle->mapMutex);
+    if(-1 == checkHandle(*fileHandle))
+        return -1;
+    Operation operation(this);  ///once the file is locked and known to exist - lock of a deleted file is not kept while waiting for a commit
+    INode& file = iNodeCache.getINode(iNumber);
+    if(countFileBlocks(offset + nBytes, file.chunkBlocks) > MAX_FILE_SIZE_IN_BLOCKS)
+    {
+        std::cerr << "File would be too big!\n";
+        return -1;
+    }
+
+    ///file grows first - bytes between its old end and the offset are a hole, block map gets the new blocks as holes
+    dropReadahead(iNumber);
+    if(offset + nBytes > file.size)
+    {
+        if(-1 == resizeFile(iNumber, offset + nBytes))
+            return -1;
+        checkHandle(*fileHandle);
+    }
+
+    if(file.chunkBlocks > 0)    ///compressed file - every chunk written to is compressed and stored again whole
+    {
+        failed = -1 == writeChunks(iNumber, offset, nBytes, data);
+        fileHandle->isMapRead = false;
+        return failed ? -1 : nBytes;
+    }
+    std::vector<uint32_t>& blockMap = fileHandle->blockMap;
+
+    buffer = new unsigned char [MAX_TRANSFER_BLOCKS * BLOCK_SIZE];
+    blockAddresses = new uint32_t [MAX_TRANSFER_BLOCKS];
+    oldAddresses = new uint32_t [MAX_TRANSFER_BLOCKS];
+    index = (int64_t)(offset / BLOCK_SIZE);
+    offsetInBlock = (int)(offset % BLOCK_SIZE);
+    while(nBytesLeft > 0 && !failed)
+    {
+        runLength = countContiguousBlocks(blockMap.data() + index, (int)std::min((offsetInBlock + nBytesLeft + BLOCK_SIZE - 1) / BLOCK_SIZE, (int64_t)MAX_TRANSFER_BLOCKS));
+
+        if(NO_BLOCK != blockMap[index] && !file.isDeduplicated)     ///blocks exist - bytes are written in place
+        {
+            runBytes = (int)std::min((int64_t)runLength * BLOCK_SIZE - offsetInBlock, nBytesLeft);
+            blockCache.dropBlocks(firstDataIndex + blockMap[index], runLength);     ///cached copies would go stale
+            bytesWritten = diskIO.writeBytes(firstDataIndex + blockMap[index], offsetInBlock, data, runBytes);
+            blockCache.dropBlocks(firstDataIndex + blockMap[index], runLength);     ///so would copies read while they were written
+            if(runBytes != bytesWritten)
+            {
+                std::cerr << "Could not write the entire block!\n";
+                failed = true;
+                break;
+            }
+        }
+        else    ///hole, or blocks which may be shared - new blocks are allocated and written whole, zeros or old bytes around the bytes
+        {
+            firstBlock = allocateBlockRun(runLength, runLength);
+            if(-1 == firstBlock)
+            {
+                std::cerr << "No free block found (not enough free space)!\n";
+                failed = true;
+                break;
+            }
+            if(isJournaling)    ///data goes to the run directly, older images of its blocks must not be replayed over it
+                journal.revokeBlocks(firstDataIndex + firstBlock, runLength);
+            blockCache.dropBlocks(firstDataIndex + firstBlock, runLength);     ///cached copies of freed blocks must not be written back over new data
+
+            runBytes = (int)std::min((int64_t)runLength * BLOCK_SIZE - offsetInBlock, nBytesLeft);
+            memset(buffer, 0, runLength * BLOCK_SIZE);
+            isRead = true;
+            if(NO_BLOCK != blockMap[index] && (0 != offsetInBlock || runBytes != runLength * BLOCK_SIZE))  ///blocks written in part keep their other bytes
+                isRead = runLength * BLOCK_SIZE == blockCache.readBlocks(firstDataIndex + blockMap[index], 0, buffer, runLength * BLOCK_SIZE);
+            memcpy(buffer + offsetInBlock, data, runBytes);
+            memcpy(oldAddresses, blockMap.data() + index, runLength * ADDRESS_SIZE);
+
+            ///data is written before addresses point to it
+            nWritten = 0;
+            if(!isRead)
+                std::cerr << "Could not read the entire block!\n";
+            else if(runLength * BLOCK_SIZE != diskIO.writeBytes(firstDataIndex + firstBlock, 0, buffer, runLength * BLOCK_SIZE))
+                std::cerr << "Could not write the entire block!\n";
+            else
+            {
+                for(int j = 0; j < runLength; ++j)
+                    blockAddresses[j] = firstBlock + j;
+                nWritten = writeBlockAddresses(iNumber, (int)index, runLength, blockAddresses);
+                memcpy(blockMap.data() + index, blockAddresses, nWritten * ADDRESS_SIZE);
+                if(nWritten < runLength)
+                    std::cerr << "No free block found (not enough free space)!\n";
+            }
+
+            ///blocks which did not become part of the file are freed, so are blocks replaced
+            for(int j = nWritten; j < runLength; ++j)
+                changeBlockStatus(firstBlock + j, FREE);
+            for(int j = 0; j < nWritten; ++j)
+                if(NO_BLOCK != oldAddresses[j])
+                    changeBlockStatus(oldAddresses[j], FREE);
+            if(nWritten < runLength)
+            {
+                failed = true;
+                break;
+            }
+        }
+
+        data += runBytes;
+        nBytesLeft -= runBytes;
+        index += runLength;
+        offsetInBlock = 0;
     }
+    fileHandle->mapVersion = blockMapVersions[iNumber];  ///block map was kept up to date on the way
+
+    delete [] oldAddresses;
+    delete [] blockAddresses;
+    delete [] buffer;
+    return failed ? -1 : nBytes;
+}
 
-    ///read size of file
-    fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + SIZE_OFFSET, SEEK_SET);
-    fread(&fileSize, sizeof(fileSize), 1, vDiskFile);
 
 
-    ///calculate count blocks and how many bytes in last block were used
-    bytesUsedInLastBlock = (uint16_t)(fileSize % BLOCK_SIZE);
-    countBlocks = (uint16_t)(fileSize / BLOCK_SIZE);
-    if(bytesUsedInLastBlock) ///last block not empty
-        ++countBlocks;
+///function changes size of an open file - bytes past the new size are deleted, bytes added read as zeros
+///parameters: handle, new size of file
+///return value: -1 on failure, else 0
+int VirtualDisk::truncate(int handle, uint64_t newSize)
+{
+    FileHandle* fileHandle = getHandle(handle);
+
+    if(NULL == fileHandle)
+        return -1;
 
-    for(int i = 0; i < countBlocks; ++i)
+    std::unique_lock<std::shared_mutex> fileLock(iNodeLocks[fileHandle->iNumber]);
+    std::lock_guard<std::mutex> mapLock(fileHandle->mapMutex);
+    if(-1 == checkHandle(*fileHandle))
+        return -1;
+    Operation operation(this);  ///once the file is locked and known to exist, like in pwrite()
+    if(countFileBlocks(newSize, iNodeCache.getINode(fileHandle->iNumber).chunkBlocks) > MAX_FILE_SIZE_IN_BLOCKS)
     {
-        if(i < countBlocks - 1) ///normal case
-            expectedBytes = BLOCK_SIZE;
-        else                    ///last block case
-            expectedBytes = bytesUsedInLastBlock;
+        std::cerr << "File would be too big!\n";
+        return -1;
+    }
+
+    return resizeFile(fileHandle->iNumber, newSize);
+}
+
 
 
-        ///read block address
-        fseek(vDiskFile, firstINodeIndex * BLOCK_SIZE + iNumber * I_NODE_SIZE + DATA_OFFSET + i * ADDRESS_SIZE, SEEK_SET);
-        fread(&blockAddress, sizeof(uint16_t), 1, vDiskFile);
+///function prints contents of a given file on console, exactly as they are
+///parameters: path to file to print on console
+int VirtualDisk::printOnConsole(std::string path)
+{
+    unsigned char* buffer; ///auxiliary buffer to store data
+    short int iNumber;
+    int64_t nBytesRead;
+    uint64_t position = 0;
+    bool failed = false;
+    short int workingDirectory;
 
-        ///read block content into buffer
-        fseek(vDiskFile, (firstDataIndex + blockAddress) * BLOCK_SIZE, SEEK_SET);
+    std::vector<std::string> parsedPath = parsePath(path);
+    workingDirectory = specifyWorkingDirectory(parsedPath, MODE_OTHER);
+    if(-1 == workingDirectory)
+        return -1;
 
+    iNumber = lockFile((char*)parsedPath.back().c_str(), workingDirectory, false);
+    if(-1 == iNumber)
+    {
+        std::cerr << "No such file exists!\n";
+        return -1;
+    }
+    std::shared_lock<std::shared_mutex> fileLock(iNodeLocks[iNumber], std::adopt_lock);
 
-        if(expectedBytes != fread(buffer, 1, expectedBytes, vDiskFile))
+    ///file is read in order, so following blocks are read ahead while a part is printed
+    buffer = new unsigned char [READ_CHUNK_SIZE];
+    while(!failed)
+    {
+        nBytesRead = readFile(iNumber, NULL, position, READ_CHUNK_SIZE, buffer);
+        if(nBytesRead <= 0)
         {
-            std::cerr << "Could not read the entire block!\n";
-            return;
+            failed = (-1 == nBytesRead);
+            break;
         }
-        std::cout << buffer;
+        std::cout.write((char*)buffer, nBytesRead);
+        position += nBytesRead;
     }
+
+    delete [] buffer;
+    return failed ? -1 : 0;
+}
+
+
+
+///function prints block cache and dentry cache statistics
+void VirtualDisk::printCacheInfo()
+{
+    uint64_t nAccesses = blockCache.getHits() + blockCache.getMisses();
+
+    std::cout << "Cached blocks: " << blockCache.getCachedBlocks() << "/" << blockCache.getMaxBlocks() << "\n";
+    std::cout << "Cache hits: " << blockCache.getHits() << "\n";
+    std::cout << "Cache misses: " << blockCache.getMisses() << "\n";
+    if(nAccesses > 0)
+        std::cout << "Hit ratio: " << 100.0 * blockCache.getHits() / nAccesses << "%\n";
+    std::cout << "Cached dentries: " << dentryCache.getNDentries() << "/" << MAX_DENTRIES << "\n";
+    std::cout << "Dentry hits: " << dentryCache.getHits() << "\n";
+    std::cout << "Dentry misses: " << dentryCache.getMisses() << "\n";
 }
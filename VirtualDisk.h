@@ -10,12 +10,26 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
 #include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
 #include "Defines.h"
+#include "Bitmap.h"
+#include "DiskIO.h"
+#include "AsyncIO.h"
+#include "Codec.h"
+#include "INodeCache.h"
+#include "BlockCache.h"
+#include "DentryCache.h"
+#include "Journal.h"
+#include "Superblock.h"
 
 
 
@@ -25,17 +39,109 @@
  *********************************************************************/
 /**
         This class handles everything related to the virtual disk.
-        Overview of disk architecture:
+        Overview of disk architecture (format version 9):
 
-        average file -> 2 blocks
-        each i-node: 128B
+        block 0 -> superblock, then journal, i-node bitmap, data bitmap, reference count table,
+        fingerprint index, checksum table, i-node tables and data blocks
 
-        maxFileSize = 124kB
+        journal -> 1/64 of the disk, at most 8192 blocks (32MB), none on disks under 1024 blocks
 
-        each i-node block -> 32 files
+        average file -> 2 blocks
+        each i-node: 128B
 
-        maxDiskSize = 128MB <- calculated from size of data bitmap (4kB = 32kb, which gives 32768 data blocks, each 4kB, total 128MB),
-        also limited by (unsigned) uint16_t range (65536)
+        each i-node: 26 direct block addresses, 1 single indirect and 1 double indirect block address (all 32-bit)
+        each indirect block: 1024 addresses
+
+        maxFileSize = about 4GB (direct blocks alone: 104kB), file size kept in 64 bits
+
+        block address NO_BLOCK within size of a file -> hole, reads as zeros; 'ab' only makes holes,
+        a block is allocated when data is written there
+
+        each i-node block -> 32 files, at most 32768 files (i-numbers are 16-bit in directory entries)
+
+        each bitmap block -> 32768 entries, bitmaps take as many blocks as needed
+
+        each directory: hash table, one block (256 entries) per bucket, number of buckets is a power of two
+        and doubles when a bucket overflows; directory size = number of buckets * block size
+
+        maxDiskSize = 1TB <- block addresses are 32-bit, but bitmaps are kept in memory
+
+        Public methods may be called from several threads at once. Every i-node has
+        its own lock: shared for reading a file or looking names up in a directory,
+        exclusive for changing it. A file is locked before its directory is unlocked,
+        so it cannot be deleted in between (order: directory, then file; two
+        directories in order of i-numbers). A file in use is waited for with its
+        directory unlocked, and looked up again. Directories are never deleted, so a path
+        is resolved holding one directory at a time. Bitmaps and usage counters are
+        guarded by allocationMutex; caches and the image file have their own locks,
+        and no i-node lock is waited for while one of those is held.
+
+        Copying between user system and virtual disk keeps up to queueDepth
+        transfers in flight (AsyncIO - io_uring, or worker threads). Each
+        copying thread takes a queue of its own from a list of idle ones.
+
+        Metadata (bitmaps, i-nodes, directories, indirect blocks, counters)
+        reaches its place on the disk only through the journal. Every public
+        method changing it is an operation (an Operation object lives for its
+        duration, holding operationLock shared). An operation starts once the
+        i-nodes it changes are locked, never waiting for an i-node lock (which a
+        long 'dcp' may hold) while a commit waits for it. A commit waits until running
+        operations end, collects their changes into one transaction and lets
+        new operations go on while the transaction is written and synced -
+        up to JOURNAL_GROUP_SIZE operations, or whatever ran within
+        JOURNAL_COMMIT_INTERVAL, share one fdatasync. Commits are done by a
+        thread of their own. Freed data blocks are reused only after the
+        transaction freeing them is committed; file data is written in place,
+        before the transaction pointing to it.
+
+        Reads of a file (read(), 'cat', 'dcp') are followed for up to
+        MAX_READAHEAD_STREAMS files at once: a read starting where the previous
+        one of the same file ended is sequential and keeps up to
+        READAHEAD_BLOCKS following blocks being read in the background (the
+        window slides once half of it is used). Blocks read ahead are
+        forgotten whenever the file changes.
+
+        open() gives a handle keeping the i-number of a file and addresses of
+        all its blocks, so pread(), pwrite() and truncate() need no path
+        lookup and pwrite() touches only the blocks it writes to. Addresses
+        are read again once anything changes them (every file has a version
+        counter of its addresses); a handle of a deleted file stops working
+        (every i-node has a generation counter, advanced when it is freed).
+
+        A file copied with compression ('ucp -z') is cut into chunks of
+        COMPRESSION_CHUNK_BLOCKS blocks, each compressed on its own (Codec).
+        Chunk i keeps the addresses of blocks i * COMPRESSION_CHUNK_BLOCKS
+        onwards: compressed bytes, after their number, in as few blocks as
+        they need - or all the blocks, with the chunk as it is, if it does
+        not compress; a chunk of zeros has no blocks. So any chunk is found
+        and read alone. A chunk which changes is compressed again into new
+        blocks and its old blocks are freed afterwards.
+
+        A file copied with deduplication ('ucp -d', 'import -d') looks every
+        block up in the fingerprint index - a hash table on the disk, one
+        block per bucket, FINGERPRINTS_PER_BLOCK entries of 32 bits of
+        fingerprint and a block address. A block with the same data is
+        shared instead of storing another copy. The reference count table
+        has a 16-bit entry for every data block: REFERENCE_INDEXED for a
+        block written by a deduplicated copy, and number of references beyond
+        the first one. Freeing a shared block only drops one reference; the
+        entry is cleared when a block is freed for good. Blocks of
+        deduplicated files are never written in place - a write stores them
+        anew and drops the old ones - so a block in the index keeps its data
+        while it is indexed. Index entries are not removed: one is trusted
+        only after a reference to its block is taken (so the block can not
+        go away) and the data is compared. Both tables are metadata, kept in
+        the block cache and the journal.
+
+        Every block but the superblock and the checksum table has a CRC32C
+        (Checksum) there, CHECKSUMS_PER_BLOCK of them per block. DiskIO keeps
+        the table in memory while the disk is open: every write stores CRCs
+        of blocks it touches and every read checks them, so a damaged block
+        fails the read instead of handing back wrong bytes. The table goes to
+        the disk when the disk is closed, with its own CRC in the superblock;
+        a disk which was not closed properly (or whose table does not match)
+        gets it computed anew from the blocks when opened. 'scrub' checks
+        every block against it, on up to MAX_SCRUB_THREADS threads.
 **/
 
 
@@ -47,21 +153,110 @@ class VirtualDisk
  *                                                                           private attributes                                                                                             *
  ********************************************************************************************************************************************************************************************/
 
-    FILE *vDiskFile;                           ///pointer to file on user system implementing virtual disk
+    DiskIO diskIO;                             ///access to file on user system implementing virtual disk
     char* vDiskFileName;                       ///name
-    int vDiskSize;                             ///size
+    int64_t vDiskSize;                         ///size
     int nBlocks;                               ///total number of blocks
     int freeBlocks;                            ///number of blocks for i-node tables and user data
     int nInodeBlocks;                          ///number of blocks for i-node tables
     int iNodeBitmapIndex;                      ///index of i-node bitmap
     int dataBitmapIndex;                       ///index of data bitmap
+    int referenceCountIndex;                   ///index of first block of reference count table
+    int fingerprintIndex;                      ///index of first block of fingerprint index
+    int nFingerprintBlocks;                    ///size of fingerprint index (in blocks)
+    int checksumIndex;                         ///index of first block of checksum table
+    int nChecksumBlocks;                       ///size of checksum table (in blocks)
     int firstINodeIndex;                       ///index of first i-node block
     int firstDataIndex;                        ///index of first data block
+    int journalIndex;                          ///index of first block of the journal
+    int nJournalBlocks;                        ///size of the journal (in blocks), 0 if there is none
+
+    Bitmap iNodeBitmap;                        ///in-memory copy of i-node bitmap
+    Bitmap dataBitmap;                         ///in-memory copy of data bitmap
+    INodeCache iNodeCache;                     ///in-memory copies of i-nodes
+    BlockCache blockCache;                     ///in-memory copies of recently used data blocks
+    DentryCache dentryCache;                   ///results of recent lookups of names in directories
+    Superblock superblock;                     ///in-memory copy of superblock, with usage counters
 
     int currentDirectory;                      ///current directory (usually given by the 'pwd' command)
-    int workingDirectory;                      ///temporary current directory within a function
     std::vector<std::string> pathToCurrentDir; ///path to current directory
-    std::vector<std::string> workingPath;      ///path to temporary current directory
+    std::mutex currentDirectoryMutex;          ///guards current directory and path to it
+
+    std::shared_mutex* iNodeLocks;             ///lock of every i-node - shared for reading, exclusive for changing
+    std::mutex allocationMutex;                ///guards bitmaps and usage counters in the superblock
+
+    int queueDepth;                            ///number of transfers kept in flight when copying between user system and virtual disk
+    std::vector<AsyncIO*> idleQueues;          ///queues of transfers not used by any thread at the moment
+    std::mutex queueMutex;                     ///guards list of idle queues
+
+    struct Readahead
+    {
+        short int iNumber;                     ///file followed, -1 if none
+        bool isBusy;                           ///whether a read uses the stream right now
+        uint64_t lastUse;                      ///number of read which used the stream last - least recently used one is taken for another file
+        uint64_t nextOffset;                   ///offset right after last read - read starting there is sequential
+        int64_t firstBlock;                    ///index within file of first block in buffer
+        int nBlocks;                           ///number of blocks in buffer (some may still be in flight)
+        int nCheckedBlocks;                    ///number of blocks at the start of buffer already checked against their checksums
+        unsigned char* buffer;                 ///blocks read ahead, READAHEAD_BLOCKS at most
+        AsyncIO* queue;                        ///queue reading blocks into buffer, NULL until first needed
+    };
+    Readahead readaheads[MAX_READAHEAD_STREAMS]; ///files being read sequentially
+    uint64_t nReads;                           ///number of reads so far
+    std::mutex readaheadMutex;                 ///guards followed files, busy flags and use counters of readahead streams
+
+    struct FileHandle
+    {
+        bool isOpen;                           ///whether handle is in use
+        short int iNumber;                     ///file the handle was opened for
+        uint32_t generation;                   ///generation of the i-node when file was opened - changes once the file is deleted
+        uint32_t mapVersion;                   ///version of block addresses of the file the block map was read at
+        bool isMapRead;                        ///whether block map was read at all
+        std::vector<uint32_t> blockMap;        ///address of every block of the file (NO_BLOCK for holes)
+        std::mutex mapMutex;                   ///guards block map when the handle is used by several threads
+    };
+    FileHandle* fileHandles;                   ///handles returned by open(), MAX_OPEN_FILES of them
+    std::mutex handleMutex;                    ///guards which handles are in use
+    uint32_t* iNodeGenerations;                ///generation of every i-node, advanced when it is freed
+    uint32_t* blockMapVersions;                ///version of block addresses of every file, advanced whenever they change
+
+    Journal journal;                           ///write-ahead log of metadata changes
+    bool isJournaling;                         ///whether changes go through the journal (not while disk is formatted, mounted or closed)
+    std::shared_mutex operationLock;           ///shared by running operations, exclusive while a commit collects their changes
+    std::mutex commitMutex;                    ///lets one commit run at a time
+    std::mutex committerMutex;                 ///guards counter of uncommitted operations and flags below
+    std::condition_variable committerWakeUp;   ///signalled when enough operations wait for commit, or committer has to stop
+    std::condition_variable commitFinished;    ///signalled when a commit lets operations go on
+    int nUncommittedOperations;                ///number of operations ended since changes were last collected
+    bool isCommitWaiting;                      ///whether a commit waits for running operations - new ones wait then
+    bool isStopping;                           ///whether committer thread has to stop
+    std::thread committer;                     ///thread committing transactions
+
+    class Operation
+    {
+        VirtualDisk* disk;                     ///disk changed by the operation, NULL if there is no journal (or nothing changes)
+
+    public:
+
+        ///constructor - waits until operations may run
+        ///parameters: disk changed by the operation, NULL if operation changes nothing after all
+        Operation(VirtualDisk* newDisk);
+
+        ///destructor - counts operation for next commit
+        ~Operation();
+    };
+
+    struct ImportedFile
+    {
+        std::string hostPath;                  ///path to file on user system
+        short int directoryINumber;            ///i-number of target directory
+        std::string name;                      ///name of file on virtual disk
+        int64_t size;                          ///size of file when tree was listed
+        std::vector<unsigned char> data;       ///contents read by reader thread
+        bool isRead;                           ///whether reader thread is done with the file
+        bool isStreamed;                       ///whether file is too big to be kept in memory - copied straight from the file by writer
+        bool failed;                           ///whether file could not be read
+    };
 
 
 
@@ -73,7 +268,8 @@ class VirtualDisk
 
 
     ///function opens file from user system be used for virtual disk implementation
-    void openFile();
+    ///parameters: backend to use (IO_PREAD or IO_MMAP)
+    void openFile(int ioMode);
 
 
 
@@ -82,20 +278,134 @@ class VirtualDisk
 
 
 
-    ///function clears i-node and data bitmaps during virtual disk creation
-    void prepareBitmaps();
+    ///function reads and checks superblock of the virtual disk
+    ///return value: true if file system already exists, false if virtual disk is empty (exits if format is unsupported)
+    bool readSuperblock();
+
+
+
+    ///function writes superblock of the virtual disk
+    void writeSuperblock();
+
+
+
+    ///function opens existing file system - geometry is taken from the superblock
+    void mountVDisk();
+
+
+
+    ///function creates new file system on empty virtual disk
+    ///parameters: size of virtual disk (in bytes), -1 to ask the user
+    void formatVDisk(int64_t diskSize);
+
+
+
+    ///function prepares in-memory i-node and data bitmaps, loading them from the disk or clearing them during virtual disk creation
+    ///parameters: whether bitmaps should be loaded from the disk
+    void prepareBitmaps(bool load);
+
+
+
+    ///function starts checking blocks against checksum table - loaded from the disk if it was closed properly, computed anew from the blocks otherwise
+    ///parameters: whether the disk was closed properly
+    void prepareChecksums(bool wasClean);
+
+
+
+    ///function checks every block with a checksum against it, or computes every checksum anew, on several threads
+    ///parameters: whether to compute checksums instead of checking them, blocks which do not match or could not be read (output, in ascending order)
+    void scanBlocks(bool recompute, std::vector<int64_t>& damagedBlocks);
+
+
+
+    ///function tells what a block of the disk holds
+    ///parameters: index of block
+    ///return value: name of region the block belongs to (for data blocks also whether the block is in use)
+    std::string describeBlock(int64_t blockIndex);
+
+
+
+    ///function writes dirty blocks of a bitmap back to the disk
+    ///parameters: bitmap to write, index of first block of the bitmap on the disk
+    void writeBitmap(Bitmap& bitmap, int firstBlockIndex);
+
+
+
+    ///function writes changed parts of in-memory bitmaps back to the disk
+    void flushBitmaps();
+
+
+
+    ///function starts journaling changes, if disk has a journal - changes wait in memory and a committer thread starts
+    void startJournal();
+
+
+
+    ///function stops committer thread and commits changes of last operations
+    void stopJournal();
+
+
+
+    ///function lets an operation start - waits while a commit collects changes
+    void beginOperation();
+
+
+
+    ///function ends an operation, waking committer thread when enough operations wait for commit
+    void endOperation();
+
+
+
+    ///function waits until running operations end and keeps new ones waiting
+    void pauseOperations();
+
+
+
+    ///function lets waiting operations go on
+    void resumeOperations();
+
+
+
+    ///function commits transactions until committer thread has to stop (body of committer thread)
+    void runCommitter();
+
+
+
+    ///function commits changes of ended operations to the journal as one transaction
+    void commitJournal();
+
+
+
+    ///function adds changes of bitmaps, superblock, i-nodes and cached blocks to next transaction
+    void logChanges();
+
+
+
+    ///function adds changed blocks of a bitmap to next transaction
+    ///parameters: bitmap, index of first block of the bitmap on the disk
+    void logBitmap(Bitmap& bitmap, int firstBlockIndex);
+
+
+
+    ///function replays committed transactions to their places on the disk and starts journal over
+    void checkpointJournal();
+
+
+
+    ///function writes every change kept in memory to its place on the disk directly (when a transaction does not fit into the journal)
+    void writeInPlace();
 
 
 
     ///function sets virtual disk size
     ///parameters: new size of virtual disk (in bytes)
-    void setVDiskSize(int newSize);
+    void setVDiskSize(int64_t newSize);
 
 
 
     ///function gets virtual disk size
     ///return value: size of virtual disk
-    int getVDiskSize();
+    int64_t getVDiskSize();
 
 
 
@@ -104,8 +414,13 @@ class VirtualDisk
 
 
 
+    ///function sets virtual disk parameters of existing file system from the superblock
+    void loadVDiskParameters();
+
+
+
     ///function creates empty directory
-    ///return value: i-number of created directory
+    ///return value: i-number of created directory, -1 if there is no free i-node or block
     short int createEmptyDirectory();
 
 
@@ -117,13 +432,231 @@ class VirtualDisk
 
     ///function creates child directory
     ///parameters: i-number of parent directory, name of child directory
-    void createChildDirectory(uint16_t directoryINumber, char* childName);
+    ///return value: i-number of created directory, -1 on failure
+    short int createChildDirectory(uint16_t directoryINumber, char* childName);
+
+
+
+    ///function creates directories of a tree from user system on virtual disk and lists its files
+    ///parameters: path to directory on user system, i-number of matching directory on virtual disk, list of files to add to (output)
+    ///return value: -1 if anything could not be copied, else 0
+    int walkHostDirectory(std::string hostPath, short int directoryINumber, std::vector<ImportedFile>& files);
+
+
+
+    ///function writes data read from a stream to blocks reserved for a new file, each part of a run with a single write, several writes in flight
+    ///parameters: stream to read data from (NULL if there is no data), reserved runs of blocks (first block, length), number of blocks of the runs to use, number of bytes written (output)
+    ///return value: -1 on failure, else 0
+    int fillPlainFile(FILE* source, const std::vector<std::pair<int, int> >& runs, int nBlocks, uint64_t& fileSize);
+
+
+
+    ///function creates file in a directory and fills it with data read from a stream - the file is put in the directory once its data is written
+    ///parameters: i-number of directory, name of new file, stream to read data from (NULL if there is no data), number of bytes expected in the stream, storage mode (STORE_PLAIN, STORE_COMPRESSED or STORE_DEDUPLICATED)
+    ///return value: -1 on failure, else 0
+    int createFile(short int directoryINumber, char* fileName, FILE* source, int64_t sourceSize, int storageMode);
+
+
+
+    ///function gets queue of transfers for the calling thread, reusing an idle one if there is any
+    ///return value: started queue
+    AsyncIO* acquireQueue();
+
+
+
+    ///function gives back queue taken with acquireQueue(), every transfer must be collected first
+    ///parameters: queue to give back
+    void releaseQueue(AsyncIO* queue);
+
+
+
+    ///function gets addresses of consecutive blocks of a file, from block map of a handle if there is one
+    ///parameters: i-number of file, block map of the file (NULL to read addresses from i-node and indirect blocks), index of first block within file, number of addresses, destination buffer
+    void getBlockAddresses(short int iNumber, const uint32_t* blockMap, int64_t firstIndex, int count, uint32_t* blockAddresses);
+
+
+
+    ///function gets a handle returned by open()
+    ///parameters: handle
+    ///return value: handle data, NULL if handle is not open
+    FileHandle* getHandle(int handle);
+
+
+
+    ///function checks that file of a handle still exists (caller holds lock of the i-node and of the block map), reading block map again if addresses changed
+    ///parameters: handle data
+    ///return value: -1 if the file was deleted, else 0
+    int checkHandle(FileHandle& fileHandle);
+
+
+
+    ///function changes size of a file - blocks past the new end are freed, bytes added are a hole (caller holds exclusive lock of the i-node)
+    ///parameters: i-number of file, new size (within MAX_FILE_SIZE_IN_BLOCKS blocks)
+    ///return value: -1 if last chunk of a compressed file or last block of a deduplicated file could not be stored again (size stays), else 0
+    int resizeFile(short int iNumber, uint64_t newSize);
+
+
+
+    ///function counts block addresses a file of given size uses - a compressed file uses whole chunks
+    ///parameters: size of file (in bytes), blocks in a chunk (0 if file is not compressed)
+    ///return value: number of blocks from the beginning of the file which may have addresses
+    int64_t countFileBlocks(uint64_t size, int chunkBlocks);
+
+
+
+    ///function reads and decompresses one chunk of a compressed file
+    ///parameters: i-number of file, block map of the file (NULL if none), index of chunk, destination buffer (a whole chunk, bytes past those stored read as zeros)
+    ///return value: -1 if the chunk could not be read or is damaged, else 0
+    int readChunk(short int iNumber, const uint32_t* blockMap, int64_t chunkIndex, unsigned char* destination);
+
+
+
+    ///function compresses one chunk of a file and stores it in new blocks, freeing blocks the chunk had before (a failure leaves the old chunk)
+    ///parameters: i-number of file, index of chunk, bytes of chunk, number of bytes (at most a whole chunk)
+    ///return value: -1 on failure, else 0
+    int writeChunk(short int iNumber, int64_t chunkIndex, const unsigned char* data, int nBytes);
+
+
+
+    ///function reads bytes of a compressed file, decompressing every chunk they fall into
+    ///parameters: i-number of file, block map of the file (NULL if none), offset within file, number of bytes (within file size), destination buffer
+    ///return value: -1 if a chunk could not be read, else 0
+    int readChunks(short int iNumber, const uint32_t* blockMap, uint64_t offset, int64_t nBytes, unsigned char* destination);
+
+
+
+    ///function writes bytes of a compressed file (within its size), storing every chunk they fall into again
+    ///parameters: i-number of file, offset within file, number of bytes, source buffer
+    ///return value: -1 on failure, else 0
+    int writeChunks(short int iNumber, uint64_t offset, int64_t nBytes, const unsigned char* source);
+
+
+
+    ///function fills a new compressed file with data read from a stream, chunk by chunk, each chunk stored as one operation
+    ///parameters: i-number of file (empty, not in any directory yet), stream to read data from (NULL if there is no data), number of bytes stored (output)
+    ///return value: -1 on failure, else 0
+    int fillCompressedFile(short int iNumber, FILE* source, uint64_t& fileSize);
+
+
+
+    ///function computes fingerprint of a block of data (XXH64 rounds over 64-bit words)
+    ///parameters: bytes of block
+    ///return value: fingerprint of block
+    uint64_t fingerprintBlock(const unsigned char* data);
+
+
+
+    ///function finds a block with the same data in the fingerprint index and takes a reference to it
+    ///parameters: bytes of block, fingerprint of block
+    ///return value: address of block holding the same data, NO_BLOCK if there is none
+    uint32_t findDuplicateBlock(const unsigned char* data, uint64_t fingerprint);
+
+
+
+    ///function adds a block written by a deduplicated copy to the fingerprint index
+    ///parameters: address of block, fingerprint of its data
+    void indexBlock(uint32_t blockAddress, uint64_t fingerprint);
+
+
+
+    ///function fills a new deduplicated file with data read from a stream, each part stored as one operation - blocks already on the disk are shared, blocks of zeros are holes
+    ///parameters: i-number of file (empty, not in any directory yet), stream to read data from (NULL if there is no data), number of bytes stored (output)
+    ///return value: -1 on failure, else 0
+    int fillDeduplicatedFile(short int iNumber, FILE* source, uint64_t& fileSize);
+
+
+
+    ///function stores a block of a deduplicated file in a new block and frees the old one (such blocks may be shared, so they are never written in place)
+    ///parameters: i-number of file, index of block within file, address of block to replace, new bytes of block
+    ///return value: -1 on failure (old block stays), else 0
+    int replaceBlock(short int iNumber, int index, uint32_t oldAddress, const unsigned char* data);
+
+
+
+    ///function finds readahead stream of a file for a read, taking least recently used one if file has none
+    ///parameters: i-number of file, offset of read, number of bytes of read
+    ///return value: index of stream (marked busy), -1 if read is not sequential or no stream is free
+    int takeReadahead(short int iNumber, uint64_t offset, int64_t nBytes);
+
+
+
+    ///function gives back readahead stream taken with takeReadahead()
+    ///parameters: index of stream
+    void leaveReadahead(int stream);
+
+
+
+    ///function forgets blocks read ahead for a file (called when the file changes)
+    ///parameters: i-number of file
+    void dropReadahead(short int iNumber);
+
+
+
+    ///function waits for blocks of a readahead stream still in flight, forgetting the buffer if any could not be read
+    ///parameters: readahead stream
+    void waitForReadahead(Readahead& readahead);
+
+
+
+    ///function checks blocks which arrived in buffer of a readahead stream against their checksums, forgetting the buffer if one does not match
+    ///parameters: readahead stream, i-number of file, block map of the file (NULL if none)
+    void checkReadahead(Readahead& readahead, short int iNumber, const uint32_t* blockMap);
+
+
+
+    ///function starts reading blocks of a file into buffer of a readahead stream without waiting
+    ///parameters: readahead stream, i-number of file, block map of the file (NULL if none), index of first block within file, position within buffer, number of blocks
+    ///return value: -1 if a read already finished with an error, else 0
+    int startReadahead(Readahead& readahead, short int iNumber, const uint32_t* blockMap, int64_t firstIndex, int bufferIndex, int count);
+
+
+
+    ///function reads bytes of a file straight from its blocks, holes read as zeros
+    ///parameters: i-number of file, block map of the file (NULL if none), offset within file, number of bytes (within file size), destination buffer
+    ///return value: -1 if a block could not be read, else 0
+    int readFileBlocks(short int iNumber, const uint32_t* blockMap, uint64_t offset, int64_t nBytes, unsigned char* destination);
+
+
+
+    ///function reads bytes of a file, through readahead when reads are sequential (caller holds lock of the i-node)
+    ///parameters: i-number of file, block map of the file (NULL if none), offset within file, number of bytes, destination buffer
+    ///return value: number of bytes read (less than asked at end of file), -1 on failure
+    int64_t readFile(short int iNumber, const uint32_t* blockMap, uint64_t offset, int64_t nBytes, void* destination);
+
+
+
+    ///function copies blocks of a file stored plainly into a file on user system inside the kernel, run by run - holes are left out (caller holds lock of the i-node)
+    ///parameters: i-number of file, descriptor of target file
+    ///return value: -1 if a block could not be copied, else 0
+    int copyFileBlocks(short int iNumber, int targetFile);
+
+
+
+    ///function computes hash of a file name (FNV-1a over at most DIRECTORY_NAME_SIZE characters)
+    ///parameters: name of file
+    ///return value: hash of name
+    uint32_t hashName(const char* fileName);
+
+
+
+    ///function finds bucket of a directory which holds entry with given name
+    ///parameters: i-number of directory, name of file
+    ///return value: index of bucket block on the disk
+    int64_t findDirectoryBucket(short int directoryINumber, const char* fileName);
+
+
+
+    ///function doubles number of buckets of a directory and redistributes its entries
+    ///parameters: i-number of directory
+    ///return value: -1 if there is no free space for new buckets, else 0
+    int growDirectory(short int directoryINumber);
 
 
 
     ///function adds directory entry
     ///parameters: i-number of directory to add in. i-number of file to add, name of file to add
-    void addDirectoryEntry(short int directoryINumber, short int iNumberToAdd, char* fileNameToAdd);
+    ///return value: -1 if directory could not grow, else 0
+    int addDirectoryEntry(short int directoryINumber, short int iNumberToAdd, char* fileNameToAdd);
 
 
 
@@ -133,30 +666,127 @@ class VirtualDisk
 
 
 
-    ///function finds next free data block
-    ///return value: index of first free data block
-    short int findNextFreeBlock();
+    ///function finds next free data block and marks it as used
+    ///return value: index of allocated data block, -1 if there is none
+    int allocateBlock();
+
+
+
+    ///function finds run of neighbouring free data blocks and marks them as used
+    ///parameters: wanted number of blocks, number of blocks allocated (output, may be less than wanted)
+    ///return value: index of first data block of the run, -1 if there is no free block
+    int allocateBlockRun(int nBlocksWanted, int& runLength);
+
+
+
+    ///function counts how many of given block addresses are neighbouring blocks, or holes if the first one is a hole
+    ///parameters: block addresses, maximum number of addresses to check
+    ///return value: length of the run of neighbouring blocks or of holes (at most MAX_TRANSFER_BLOCKS)
+    int countContiguousBlocks(uint32_t* blockAddresses, int maxCount);
+
+
+
+    ///function allocates and clears a block for block addresses
+    ///return value: address of allocated block, NO_BLOCK if there is no free block
+    uint32_t allocateIndirectBlock();
+
+
+
+    ///function gets indirect block holding address of given block of a file
+    ///parameters: i-number of file, index of block within file (at least N_DIRECT_BLOCKS), slot of address within indirect block (output), whether missing indirect blocks should be allocated
+    ///return value: address of indirect block, NO_BLOCK if there is none
+    uint32_t getIndirectBlock(int iNumber, int fileBlockIndex, int& slot, bool allocate);
+
+
+
+    ///function reads addresses of consecutive blocks of a file
+    ///parameters: i-number of file, index of first block within file, number of addresses, destination buffer
+    void readBlockAddresses(int iNumber, int firstIndex, int count, uint32_t* blockAddresses);
+
+
 
+    ///function writes addresses of consecutive blocks of a file, allocating indirect blocks when needed
+    ///parameters: i-number of file, index of first block within file, number of addresses, source buffer
+    ///return value: number of addresses written (less than count if no free block for indirect block)
+    int writeBlockAddresses(int iNumber, int firstIndex, int count, uint32_t* blockAddresses);
 
 
-    ///function finds next free i-node
-    ///return value: first free i-number
-    short int findNextFreeInode();
 
+    ///function frees blocks of a file from given index on, together with indirect blocks which are no longer needed
+    ///parameters: i-number of file, index of first block to free, number of blocks used by file
+    void freeFileBlocks(int iNumber, int firstIndex, int countBlocks);
 
 
-    ///function changes data block status
-    ///parameters: index of data block to change, new status (free or used)
+
+    ///function frees files which are in no directory - left by copies cut off when the disk was not closed properly
+    ///return value: number of files freed
+    int freeOrphans();
+
+
+
+    ///function finds next free i-node and marks it as used
+    ///return value: allocated i-number, -1 if there is none
+    short int allocateINode();
+
+
+
+    ///function changes data block status (with a journal, a freed block is only released - freed once the transaction is committed)
+    ///parameters: index of data block to change, new status (free or used - freeing a shared block only drops one reference)
     void changeBlockStatus(int blockId, bool newStatus);
 
 
 
+    ///function reads reference count entry of a data block (caller holds allocationMutex)
+    ///parameters: index of data block
+    ///return value: REFERENCE_INDEXED flag and number of references beyond the first one
+    uint16_t getReferenceCount(int blockId);
+
+
+
+    ///function writes reference count entry of a data block (caller holds allocationMutex)
+    ///parameters: index of data block, new entry
+    void setReferenceCount(int blockId, uint16_t entry);
+
+
+
+    ///function takes another reference to a block of the fingerprint index, unless it was freed in the meantime
+    ///parameters: index of data block
+    ///return value: true if reference was taken
+    bool referenceBlock(int blockId);
+
+
+
+    ///function drops a reference to a data block
+    ///parameters: index of data block
+    ///return value: true if it was the last one - block has to be freed
+    bool dropReference(int blockId);
+
+
+
     ///function changes i-node status
     ///parameters: i-number to change, new status (free or used)
     void changeINodeStatus(int iNodeId, bool newStatus);
 
 
 
+    ///function frees data blocks whose freeing was committed
+    ///parameters: indices of data blocks
+    void releaseBlocks(const std::vector<uint32_t>& blockIds);
+
+
+
+    ///function recomputes usage counters from bitmaps and i-nodes
+    ///return value: true if counters were wrong and had to be corrected
+    bool recountUsage();
+
+
+
+    ///function changes size of a file, keeping count of bytes in use
+    ///parameters: i-number of file, new size of file (in bytes)
+    void setFileSize(int iNumber, uint64_t newSize);
+
+
+
     ///function checks status of a bit from a given bitmap
     ///parameters: id of bitmap (i-node or data block), id of entry on that bitmap
     ///return value: status of bit (free or used)
@@ -165,9 +795,9 @@ class VirtualDisk
 
 
     ///function gets i-number of given file from a given directory
-    ///parameters: name of file, i-number of directory to search in
-    ///return value: i-number of given file
-    short int getINumber(char* fileName, uint16_t directoryINumber);
+    ///parameters: name of file, i-number of directory to search in, whether file is a directory (output, optional)
+    ///return value: i-number of given file, -1 if there is none
+    short int getINumber(char* fileName, uint16_t directoryINumber, bool* isDirectory = NULL);
 
 
 
@@ -179,9 +809,22 @@ class VirtualDisk
 
 
     ///function interprets parsed path to specify working (temporary current) directory
-    ///parameters: parsed path in vector form, mode of specifying (whether to interpret last element of parsed path or not)
-    ///return value: -1 if could not resolve parsed path
-    short int specifyWorkingDirectory(std::vector<std::string> parsedPath, int mode = MODE_CD);
+    ///parameters: parsed path in vector form, mode of specifying (whether to interpret last element of parsed path or not), path to working directory (output, optional, only in MODE_CD)
+    ///return value: i-number of working directory, -1 if could not resolve parsed path
+    short int specifyWorkingDirectory(const std::vector<std::string>& parsedPath, int mode = MODE_CD, std::vector<std::string>* workingPath = NULL);
+
+
+
+    ///function finds file in a directory and locks its i-node, so other threads cannot delete or change it while it is used
+    ///parameters: name of file, i-number of directory, whether i-node is locked for changing (exclusive) or only for reading (shared)
+    ///return value: i-number of locked file, -1 if there is none (nothing is locked then)
+    short int lockFile(char* fileName, uint16_t directoryINumber, bool exclusive);
+
+
+
+    ///function waits until lock of an i-node is free, without keeping it (caller holds no other lock and looks the file up again afterwards)
+    ///parameters: i-number, whether i-node is wanted for changing (exclusive) or only for reading (shared)
+    void waitForINode(short int iNumber, bool exclusive);
 
 
 
@@ -209,8 +852,8 @@ class VirtualDisk
 public:
 
     ///constructor
-    ///parameters: name of virtual disk file, size of virtual disk file
-    VirtualDisk(char* newVDiskFileName = DEFAULT_NAME, int diskSize = -1);
+    ///parameters: name of virtual disk file, size of virtual disk file, storage backend (IO_PREAD or IO_MMAP), memory budget of block cache (in bytes), number of transfers kept in flight when copying
+    VirtualDisk(char* newVDiskFileName = DEFAULT_NAME, int64_t diskSize = -1, int ioMode = IO_PREAD, int64_t cacheSize = DEFAULT_CACHE_SIZE, int newQueueDepth = DEFAULT_QUEUE_DEPTH);
 
 
 
@@ -220,37 +863,56 @@ public:
 
 
     ///function copies file from user system to virtual disk
-    ///parameters: name of file to copy from user system, path to target location
-    void copyToVDisk(char* fileNameToCopy, std::string path);
+    ///parameters: name of file to copy from user system, path to target location, storage mode (STORE_PLAIN, STORE_COMPRESSED or STORE_DEDUPLICATED)
+    ///return value: -1 on failure, else 0
+    int copyToVDisk(char* fileNameToCopy, std::string path, int storageMode = STORE_PLAIN);
+
+
+
+    ///function copies directory tree from user system to virtual disk, reading files on several threads and writing them one by one
+    ///parameters: name of directory to copy from user system, path to target directory (created if it does not exist), storage mode of files
+    ///return value: -1 if anything could not be copied, else 0
+    int importDirectory(char* directoryNameToCopy, std::string path, int storageMode = STORE_PLAIN);
 
 
 
     ///function copies file from virtual disk to user system
     ///parameters: path to file on virtual disk, name of target file on user system
-    void copyFromVDisk(std::string path, char* fileNameToCopy);
+    ///return value: -1 on failure, else 0
+    int copyFromVDisk(std::string path, char* fileNameToCopy);
 
 
 
     ///function deletes a file from virtual disk
     ///parameters: path to file to delete
-    void deleteFile(std::string path);
+    ///return value: -1 on failure, else 0
+    int deleteFile(std::string path);
 
 
 
-    ///function adds null bytes to the end of given file
+    ///function adds null bytes to the end of given file - they are a hole, no blocks are allocated for them
     ///parameters: path to file, number of bytes to add
-    void addBytes(std::string path, unsigned int nBytesToAdd);
+    ///return value: -1 on failure, else 0
+    int addBytes(std::string path, uint64_t nBytesToAdd);
 
 
 
     ///function deletes bytes from the end of a given file
     ///parameters: path to file, number of bytes to delete
-    void deleteBytes(std::string path, unsigned int nBytesToDelete);
+    ///return value: -1 on failure, else 0
+    int deleteBytes(std::string path, uint64_t nBytesToDelete);
 
 
 
     ///function prints disk usage info
-    void printDiskUsageInfo();
+    ///parameters: whether counters should be recomputed from bitmaps and i-nodes and corrected
+    void printDiskUsageInfo(bool verify = false);
+
+
+
+    ///function checks every block of the disk against its checksum and lists damaged ones
+    ///return value: -1 if a block is damaged, else 0
+    int scrub();
 
 
 
@@ -261,13 +923,15 @@ public:
 
     ///function creates new directory in location specified by given path
     ///parameters: path to new directory
-    void createNewDirectory(std::string path);
+    ///return value: -1 on failure, else 0
+    int createNewDirectory(std::string path);
 
 
 
     ///function changes current directory
     ///parameters: path to new current directory
-    void changeDirectory(std::string path);
+    ///return value: -1 on failure, else 0
+    int changeDirectory(std::string path);
 
 
 
@@ -278,13 +942,62 @@ public:
 
     ///function adds link to a given file
     ///parameters: path to existing file, path to new file
-    void addLink(std::string target, std::string linkName);
+    ///return value: -1 on failure, else 0
+    int addLink(std::string target, std::string linkName);
+
+
+
+    ///function reads bytes of a file, exactly as they are (sequential reads are served from blocks read ahead in the background)
+    ///parameters: path to file, offset within file, number of bytes, destination buffer
+    ///return value: number of bytes read (less than asked at end of file), -1 on failure
+    int64_t read(std::string path, uint64_t offset, int64_t nBytes, void* destination);
+
+
+
+    ///function opens a file for reading and writing at any offset, without resolving its path again
+    ///parameters: path to file
+    ///return value: handle of file, -1 on failure
+    int open(std::string path);
 
 
 
-    ///function prints contents of a given file on console
+    ///function closes a handle returned by open() (it must not be in use by another thread)
+    ///parameters: handle
+    ///return value: -1 if handle is not open, else 0
+    int close(int handle);
+
+
+
+    ///function reads bytes of an open file
+    ///parameters: handle, offset within file, number of bytes, destination buffer
+    ///return value: number of bytes read (less than asked at end of file), -1 on failure
+    int64_t pread(int handle, uint64_t offset, int64_t nBytes, void* destination);
+
+
+
+    ///function writes bytes of an open file, touching only blocks they fall into - holes get blocks, file grows if written past its end
+    ///parameters: handle, offset within file, number of bytes, source buffer
+    ///return value: number of bytes written, -1 on failure
+    int64_t pwrite(int handle, uint64_t offset, int64_t nBytes, const void* source);
+
+
+
+    ///function changes size of an open file - bytes past the new size are deleted, bytes added read as zeros
+    ///parameters: handle, new size of file
+    ///return value: -1 on failure, else 0
+    int truncate(int handle, uint64_t newSize);
+
+
+
+    ///function prints contents of a given file on console, exactly as they are
     ///parameters: path to file to print on console
-    void printOnConsole(std::string path);
+    ///return value: -1 on failure, else 0
+    int printOnConsole(std::string path);
+
+
+
+    ///function prints block cache and dentry cache statistics
+    void printCacheInfo();
 
 
 
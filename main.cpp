@@ -14,16 +14,36 @@ using namespace std;
 
 int main(int argc, char** argv)
 {
-    int diskSize = -1;
-    if(argc <= 1) ///not enough arguments
+    int64_t diskSize = -1;
+    int ioMode = IO_PREAD;
+    int64_t cacheSize = DEFAULT_CACHE_SIZE;
+    int queueDepth = DEFAULT_QUEUE_DEPTH;
+    char* scriptName = NULL;
+    vector<char*> arguments; ///arguments other than options
+
+    for(int i = 1; i < argc; ++i)
+    {
+        if(0 == strcmp(argv[i], "-m"))  ///memory-mapped storage backend
+            ioMode = IO_MMAP;
+        else if(0 == strcmp(argv[i], "-c") && i + 1 < argc)  ///memory budget of block cache
+            cacheSize = atoll(argv[++i]);
+        else if(0 == strcmp(argv[i], "-q") && i + 1 < argc)  ///transfers kept in flight when copying
+            queueDepth = atoi(argv[++i]);
+        else if(0 == strcmp(argv[i], "-f") && i + 1 < argc)  ///batch mode - commands from script file
+            scriptName = argv[++i];
+        else
+            arguments.push_back(argv[i]);
+    }
+
+    if(arguments.size() < 1) ///not enough arguments
     {
         cerr << "Name of virtual disk file not specified!\n";
         return 0;
     }
-    if(argc >= 3)
-        diskSize = atoi(argv[2]);
+    if(arguments.size() >= 2)
+        diskSize = atoll(arguments[1]);
 
-    CommandLineInterpreter myCMD(argv[1], diskSize); ///start command line interpreter for virtual disk
+    CommandLineInterpreter myCMD(arguments[0], diskSize, ioMode, cacheSize, queueDepth, scriptName); ///start command line interpreter for virtual disk
 
     return 0;
 }